@@ -0,0 +1,38 @@
+#version 450
+
+layout (location = 0) out vec3 out_colour;
+
+layout (set = 0, binding = 0) uniform sampler2DArray heights;
+
+layout (push_constant) uniform constants
+{
+    mat4 view_proj;
+    // Of the grid's first vertex, in multiples of spacing
+    ivec2 origin;
+    int level;
+    int size;
+    float spacing;
+    float height_min;
+    float height_max;
+} PushConstants;
+
+void main()
+{
+    int size = PushConstants.size;
+    ivec2 grid = PushConstants.origin +
+                 ivec2(gl_VertexIndex % size, gl_VertexIndex / size);
+
+    // The texture wraps, so a texel is only rewritten when its grid point
+    // scrolls out of view on one side and in on the other
+    ivec2 texel = ((grid % size) + size) % size;
+    float height = texelFetch(heights, ivec3(texel, PushConstants.level), 0).r;
+
+    vec2 xz = vec2(grid) * PushConstants.spacing;
+    gl_Position = PushConstants.view_proj * vec4(xz.x, -height, xz.y, 1.0f);
+
+    // The same black to red gradient as the tile meshes
+    float range =
+        max(PushConstants.height_max - PushConstants.height_min, 1e-6f);
+    float t = clamp((height - PushConstants.height_min) / range, 0.0f, 1.0f);
+    out_colour = vec3(t, 0.0f, 0.0f);
+}
@@ -0,0 +1,35 @@
+#version 450
+
+layout (location = 0) in vec3 pos;
+layout (location = 1) in vec3 colour;
+
+layout (location = 0) out vec3 out_colour;
+
+struct Tile
+{
+    mat4 model_matrix;
+    vec4 bounds_min;
+    vec4 bounds_max;
+    uint index_count;
+    uint first_index;
+    int vertex_offset;
+    uint padding;
+};
+
+layout (std430, set = 0, binding = 0) readonly buffer Tiles
+{
+    Tile tiles[];
+};
+
+layout (push_constant) uniform constants
+{
+    mat4 view_proj;
+} PushConstants;
+
+void main()
+{
+    // first_instance is the tile index
+    mat4 model = tiles[gl_InstanceIndex].model_matrix;
+    gl_Position = PushConstants.view_proj * model * vec4(pos, 1.0f);
+    out_colour = colour;
+}
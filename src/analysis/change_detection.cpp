@@ -0,0 +1,392 @@
+#include "change_detection.hpp"
+#include "jobs/job_system.hpp"
+#include "profiling/profiler.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SILICONIA_SSE2
+#endif
+
+namespace siliconia::analysis {
+
+namespace {
+
+// A run of cells lying in one earlier tile, contiguous in both tiles' rows
+struct run_inputs {
+  const float *later;
+  const float *earlier;
+  float later_nodata;
+  float earlier_nodata;
+  float *out;
+};
+
+// Summed in floats over a run, at most a row, then added to the doubles
+struct run_sums {
+  size_t compared = 0;
+  size_t later_cells = 0;
+  float cut = 0, fill = 0;
+  float sum = 0, sum_squares = 0;
+  float min = std::numeric_limits<float>::infinity();
+  float max = -std::numeric_limits<float>::infinity();
+};
+
+void difference_run_scalar(
+    const run_inputs &in, size_t begin, size_t end, run_sums &sums)
+{
+  for (auto i = begin; i < end; i++) {
+    auto a = in.later[i];
+    auto b = in.earlier[i];
+    if (a == in.later_nodata) {
+      in.out[i] = std::numeric_limits<float>::quiet_NaN();
+      continue;
+    }
+    sums.later_cells++;
+    if (b == in.earlier_nodata) {
+      in.out[i] = std::numeric_limits<float>::quiet_NaN();
+      continue;
+    }
+    auto d = a - b;
+    in.out[i] = d;
+    sums.compared++;
+    sums.fill += std::max(d, 0.f);
+    sums.cut += std::min(d, 0.f);
+    sums.sum += d;
+    sums.sum_squares += d * d;
+    sums.min = std::min(sums.min, d);
+    sums.max = std::max(sums.max, d);
+  }
+}
+
+#ifdef SILICONIA_SSE2
+float horizontal_sum(__m128 v)
+{
+  alignas(16) float lanes[4];
+  _mm_store_ps(lanes, v);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+// The same as the scalar run, four cells at a time, with the cells lacking
+// data masked out of the sums rather than branched around
+size_t difference_run_sse2(const run_inputs &in, size_t count, run_sums &sums)
+{
+  auto later_nodata = _mm_set1_ps(in.later_nodata);
+  auto earlier_nodata = _mm_set1_ps(in.earlier_nodata);
+  auto nan = _mm_set1_ps(std::numeric_limits<float>::quiet_NaN());
+  auto inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+  auto neg_inf = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+  auto zero = _mm_setzero_ps();
+  auto fill = zero, cut = zero, sum = zero, sum_squares = zero;
+  auto min = inf, max = neg_inf;
+
+  auto i = size_t{0};
+  for (; i + 4 <= count; i += 4) {
+    auto a = _mm_loadu_ps(in.later + i);
+    auto b = _mm_loadu_ps(in.earlier + i);
+    auto has_later = _mm_cmpneq_ps(a, later_nodata);
+    auto valid = _mm_and_ps(has_later, _mm_cmpneq_ps(b, earlier_nodata));
+    auto d = _mm_sub_ps(a, b);
+    _mm_storeu_ps(in.out + i,
+        _mm_or_ps(_mm_and_ps(valid, d), _mm_andnot_ps(valid, nan)));
+
+    auto masked = _mm_and_ps(valid, d);
+    fill = _mm_add_ps(fill, _mm_max_ps(masked, zero));
+    cut = _mm_add_ps(cut, _mm_min_ps(masked, zero));
+    sum = _mm_add_ps(sum, masked);
+    sum_squares = _mm_add_ps(sum_squares, _mm_mul_ps(masked, masked));
+    min = _mm_min_ps(
+        min, _mm_or_ps(masked, _mm_andnot_ps(valid, inf)));
+    max = _mm_max_ps(
+        max, _mm_or_ps(masked, _mm_andnot_ps(valid, neg_inf)));
+    sums.compared += std::popcount(unsigned(_mm_movemask_ps(valid)));
+    sums.later_cells += std::popcount(unsigned(_mm_movemask_ps(has_later)));
+  }
+
+  alignas(16) float lanes[4];
+  _mm_store_ps(lanes, min);
+  sums.min = std::min({sums.min, lanes[0], lanes[1], lanes[2], lanes[3]});
+  _mm_store_ps(lanes, max);
+  sums.max = std::max({sums.max, lanes[0], lanes[1], lanes[2], lanes[3]});
+  sums.fill += horizontal_sum(fill);
+  sums.cut += horizontal_sum(cut);
+  sums.sum += horizontal_sum(sum);
+  sums.sum_squares += horizontal_sum(sum_squares);
+  return i;
+}
+#endif
+
+void difference_run(const run_inputs &in, size_t count, run_sums &sums)
+{
+  auto done = size_t{0};
+#ifdef SILICONIA_SSE2
+  done = difference_run_sse2(in, count, sums);
+#endif
+  difference_run_scalar(in, done, count, sums);
+}
+
+void add_run(change_statistics &statistics, const run_sums &sums,
+    double cell_area)
+{
+  statistics.compared += sums.compared;
+  statistics.missing += sums.later_cells - sums.compared;
+  if (sums.compared == 0) {
+    return;
+  }
+  statistics.fill += sums.fill * cell_area;
+  statistics.cut -= sums.cut * cell_area;
+  statistics.sum += sums.sum;
+  statistics.sum_squares += sums.sum_squares;
+  statistics.min = std::min(statistics.min, sums.min);
+  statistics.max = std::max(statistics.max, sums.max);
+}
+
+} // namespace
+
+double change_statistics::net() const
+{
+  return fill - cut;
+}
+
+double change_statistics::mean() const
+{
+  return compared ? sum / double(compared) : 0.0;
+}
+
+double change_statistics::rms() const
+{
+  return compared ? std::sqrt(sum_squares / double(compared)) : 0.0;
+}
+
+void change_statistics::merge(const change_statistics &other)
+{
+  if (other.compared > 0) {
+    min = compared ? std::min(min, other.min) : other.min;
+    max = compared ? std::max(max, other.max) : other.max;
+  }
+  compared += other.compared;
+  missing += other.missing;
+  cut += other.cut;
+  fill += other.fill;
+  sum += other.sum;
+  sum_squares += other.sum_squares;
+}
+
+bool aligned(const chunks::Chunk &a, const chunks::Chunk &b)
+{
+  auto offset = [](unsigned int p, unsigned int q, unsigned int cell) {
+    return (p > q ? p - q : q - p) % cell == 0;
+  };
+  return a.cell_size == b.cell_size && a.cell_size > 0 &&
+         offset(a.xllcorner, b.xllcorner, a.cell_size) &&
+         offset(a.yllcorner, b.yllcorner, a.cell_size);
+}
+
+difference_grid difference_tile(const chunks::Chunk &later,
+    const std::vector<const chunks::Chunk *> &earlier,
+    change_statistics &statistics)
+{
+  auto grid = difference_grid{};
+  grid.ncols = later.ncols;
+  grid.nrows = later.nrows;
+  grid.values.assign(size_t(later.ncols) * later.nrows,
+      std::numeric_limits<float>::quiet_NaN());
+
+  auto tile = change_statistics{};
+  tile.min = std::numeric_limits<float>::infinity();
+  tile.max = -tile.min;
+  auto cell = double(later.cell_size);
+  auto r = later.rect();
+  auto top = r.y + double(r.height);
+  const auto *hint = static_cast<const chunks::Chunk *>(nullptr);
+  auto contains = [](const chunks::Chunk &chunk, double x, double y) {
+    auto c = chunk.rect();
+    return x >= c.x && x < c.x + double(c.width) && y >= c.y &&
+           y < c.y + double(c.height);
+  };
+
+  for (unsigned int j = 0; j < later.nrows; j++) {
+    auto y = top - (j + 0.5) * cell;
+    auto sums = run_sums{};
+    auto i = 0u;
+    while (i < later.ncols) {
+      auto x = r.x + (i + 0.5) * cell;
+      if (!hint || !contains(*hint, x, y)) {
+        auto it = std::find_if(earlier.begin(), earlier.end(),
+            [&](const auto *chunk) { return contains(*chunk, x, y); });
+        hint = it == earlier.end() ? nullptr : *it;
+      }
+      auto k = i + size_t(j) * later.ncols;
+      if (!hint) {
+        // Nothing to compare against
+        sums.later_cells += later.data[k] != later.nodata_value;
+        i++;
+        continue;
+      }
+
+      auto e = hint->rect();
+      auto ei = unsigned((x - e.x) / cell);
+      auto ej = unsigned((e.y + double(e.height) - y) / cell);
+      auto count = std::min(later.ncols - i, hint->ncols - ei);
+      auto in = run_inputs{&later.data[k],
+          &hint->data[ei + size_t(ej) * hint->ncols], later.nodata_value,
+          hint->nodata_value, &grid.values[k]};
+      difference_run(in, count, sums);
+      i += count;
+    }
+    add_run(tile, sums, cell * cell);
+  }
+  statistics.merge(tile);
+  return grid;
+}
+
+std::vector<size_t> overlapping(
+    const chunks::ChunkCollection &earlier, const chunks::Chunk &tile)
+{
+  auto t = tile.rect();
+  auto result = std::vector<size_t>{};
+  const auto &headers = earlier.headers();
+  for (size_t i = 0; i < headers.size(); i++) {
+    auto h = headers[i].rect();
+    if (h.x < t.x + t.width && t.x < h.x + h.width &&
+        h.y < t.y + t.height && t.y < h.y + h.height) {
+      result.push_back(i);
+    }
+  }
+  return result;
+}
+
+ChangeDetector::ChangeDetector(
+    const std::string &earlier_path, const chunks::ChunkCollection &later)
+  : state_(std::make_shared<shared_state>(
+        chunks::ChunkCollection::scan(earlier_path)))
+{
+  auto &state = *state_;
+  state.tiles = std::vector<earlier_tile>(state.earlier.headers().size());
+  for (const auto &header : later.headers()) {
+    for (auto h : overlapping(state.earlier, header)) {
+      state.tiles[h].remaining++;
+    }
+  }
+}
+
+bool ChangeDetector::valid() const
+{
+  return state_ != nullptr;
+}
+
+void ChangeDetector::tile_added(size_t index)
+{
+  pending_.push_back(index);
+}
+
+std::vector<size_t> ChangeDetector::update(
+    const chunks::ChunkCollection &later)
+{
+  auto changed = std::vector<size_t>{};
+  if (!state_) {
+    return changed;
+  }
+  const auto &chunks = later.chunks();
+  differences_.resize(chunks.size());
+  for (auto &finished : state_->finished) {
+    differences_[finished.index] = std::move(finished.difference);
+    statistics_.merge(finished.statistics);
+    misaligned_ += finished.misaligned;
+    differenced_++;
+    running_--;
+    changed.push_back(finished.index);
+  }
+  state_->finished.clear();
+
+  // A job holds a copy of its later tile, as the collection's tiles move
+  // when it grows, so only so many are started at once
+  auto max_jobs = std::max(1u, jobs::job_system().thread_count());
+  while (!pending_.empty() && running_ < max_jobs) {
+    auto index = pending_.front();
+    pending_.pop_front();
+    running_++;
+    auto tile = std::make_shared<const chunks::Chunk>(chunks[index]);
+    jobs::job_system().spawn_background([state = state_, index, tile] {
+      auto finished =
+          std::make_shared<result>(difference_job(*state, index, *tile));
+      jobs::job_system().post_main([state, finished] {
+        state->finished.push_back(std::move(*finished));
+      });
+    });
+  }
+  return changed;
+}
+
+ChangeDetector::result ChangeDetector::difference_job(
+    shared_state &state, size_t index, const chunks::Chunk &tile)
+{
+  auto zone = profiling::Zone{"Change detection", tile.path};
+  auto finished = result{index};
+  auto overlaps = overlapping(state.earlier, tile);
+  auto held = std::vector<std::shared_ptr<const chunks::Chunk>>{};
+  auto earlier = std::vector<const chunks::Chunk *>{};
+  for (auto h : overlaps) {
+    auto &entry = state.tiles[h];
+    {
+      auto lock = std::lock_guard{entry.mutex};
+      if (!entry.chunk) {
+        try {
+          entry.chunk = std::make_shared<const chunks::Chunk>(
+              state.earlier.headers()[h].path);
+        } catch (const std::exception &e) {
+          // Compared as if it had no data
+          std::cout << e.what() << std::endl;
+          continue;
+        }
+      }
+      held.push_back(entry.chunk);
+    }
+    if (aligned(tile, *held.back())) {
+      earlier.push_back(held.back().get());
+    } else {
+      finished.misaligned++;
+    }
+  }
+  finished.difference = difference_tile(tile, earlier, finished.statistics);
+
+  for (auto h : overlaps) {
+    auto &entry = state.tiles[h];
+    auto lock = std::lock_guard{entry.mutex};
+    if (entry.remaining > 0 && --entry.remaining == 0) {
+      entry.chunk.reset();
+    }
+  }
+  return finished;
+}
+
+const difference_grid &ChangeDetector::difference(size_t tile) const
+{
+  static const auto empty = difference_grid{};
+  return tile < differences_.size() ? differences_[tile] : empty;
+}
+
+const change_statistics &ChangeDetector::statistics() const
+{
+  return statistics_;
+}
+
+size_t ChangeDetector::misaligned() const
+{
+  return misaligned_;
+}
+
+size_t ChangeDetector::differenced() const
+{
+  return differenced_;
+}
+
+size_t ChangeDetector::queued() const
+{
+  return pending_.size() + running_;
+}
+
+} // namespace siliconia::analysis
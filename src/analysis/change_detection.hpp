@@ -0,0 +1,119 @@
+#ifndef SILICONIA_CHANGE_DETECTION_HPP
+#define SILICONIA_CHANGE_DETECTION_HPP
+
+#include <chunks/chunk_collection.hpp>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace siliconia::analysis {
+
+// Later less earlier heights, in the same layout as the later tile's data.
+// NaN where either survey has no data.
+struct difference_grid {
+  unsigned int ncols = 0, nrows = 0;
+  std::vector<float> values;
+};
+
+// Summed as tiles are differenced, so the totals grow while they stream in
+struct change_statistics {
+  // Cells with data in both surveys, and cells in the later one only
+  size_t compared = 0;
+  size_t missing = 0;
+  // Volumes lowered and raised, both positive, in cubed map units
+  double cut = 0;
+  double fill = 0;
+  double sum = 0, sum_squares = 0;
+  float min = 0, max = 0;
+
+  double net() const;
+  double mean() const;
+  double rms() const;
+  void merge(const change_statistics &other);
+};
+
+// Whether the cells of two tiles line up, so they can be differenced
+bool aligned(const chunks::Chunk &a, const chunks::Chunk &b);
+
+// The later tile against the earlier tiles overlapping it, which must be
+// aligned with it. An earlier tile covering exactly the same cells is read
+// straight through, four cells at a time; otherwise each cell is looked up
+// in whichever earlier tile holds it.
+difference_grid difference_tile(const chunks::Chunk &later,
+    const std::vector<const chunks::Chunk *> &earlier,
+    change_statistics &statistics);
+
+// Differences tiles of a later survey as they are added against an earlier
+// one, as background jobs that hand their results back through the main
+// queue. Only the earlier survey's headers are read up front; its tiles are
+// parsed as the later tiles that overlap them arrive, and dropped once no
+// later tile still to come overlaps them.
+class ChangeDetector {
+public:
+  ChangeDetector() = default;
+  // The later survey's headers say which later tiles each earlier one is
+  // still needed for
+  ChangeDetector(const std::string &earlier_path,
+      const chunks::ChunkCollection &later);
+
+  bool valid() const;
+  // The tile at index in the later collection's chunks was just added
+  void tile_added(size_t index);
+
+  // Starts jobs for the new tiles and collects the results handed back
+  // since the last call, returning their indices
+  std::vector<size_t> update(const chunks::ChunkCollection &later);
+
+  // Empty for tiles not differenced yet
+  const difference_grid &difference(size_t tile) const;
+  const change_statistics &statistics() const;
+  // Earlier tiles that didn't line up with the later ones and were skipped
+  size_t misaligned() const;
+  size_t differenced() const;
+  // Added but not differenced yet
+  size_t queued() const;
+
+private:
+  struct earlier_tile {
+    // Held while parsing, so jobs needing the same tile parse it once
+    std::mutex mutex;
+    std::shared_ptr<const chunks::Chunk> chunk;
+    // Later tiles overlapping it that haven't been differenced yet
+    size_t remaining = 0;
+  };
+  struct result {
+    size_t index;
+    difference_grid difference;
+    change_statistics statistics;
+    size_t misaligned = 0;
+  };
+  // Shared with the jobs, which may outlive the detector
+  struct shared_state {
+    chunks::ChunkCollection earlier;
+    std::vector<earlier_tile> tiles;
+    // Only touched on the main thread
+    std::vector<result> finished;
+  };
+
+  static result difference_job(
+      shared_state &state, size_t index, const chunks::Chunk &tile);
+
+  std::shared_ptr<shared_state> state_;
+  std::deque<size_t> pending_;
+  size_t running_ = 0;
+  std::vector<difference_grid> differences_;
+  change_statistics statistics_;
+  size_t misaligned_ = 0;
+  size_t differenced_ = 0;
+};
+
+// The earlier survey's headers overlapping a tile
+std::vector<size_t> overlapping(
+    const chunks::ChunkCollection &earlier, const chunks::Chunk &tile);
+
+} // namespace siliconia::analysis
+
+#endif // SILICONIA_CHANGE_DETECTION_HPP
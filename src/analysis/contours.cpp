@@ -0,0 +1,362 @@
+#include "contours.hpp"
+#include "jobs/job_system.hpp"
+#include "profiling/profiler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+
+namespace siliconia::analysis {
+
+namespace {
+
+// Where the level crosses the edge from a to b. Each edge is always taken
+// in the same direction, so squares either side of it (even in different
+// tiles) put the point in exactly the same place.
+glm::vec3 crossing(glm::vec2 a, float va, glm::vec2 b, float vb, float level)
+{
+  auto t = (level - va) / (vb - va);
+  auto p = a + (b - a) * t;
+  return {p.x, level, p.y};
+}
+
+// The heights the tile's squares need: its own, plus a column and row from
+// the tiles to the right and below. NaN where there is no data.
+std::vector<float> square_corners(
+    const chunks::ChunkCollection &collection, const chunks::Chunk &chunk)
+{
+  auto w = chunk.ncols + 1;
+  auto h = chunk.nrows + 1;
+  auto heights = std::vector<float>(size_t(w) * h);
+  auto nan = std::numeric_limits<float>::quiet_NaN();
+  auto r = chunk.rect();
+  const auto *hint = static_cast<const chunks::Chunk *>(nullptr);
+  for (unsigned int j = 0; j < h; j++) {
+    for (unsigned int i = 0; i < w; i++) {
+      auto v = nan;
+      if (i < chunk.ncols && j < chunk.nrows) {
+        v = chunk.data[i + j * chunk.ncols];
+        v = v == chunk.nodata_value ? nan : v;
+      } else {
+        auto map_x = r.x + (i + 0.5) * chunk.cell_size;
+        auto map_y = r.y + double(r.height) - (j + 0.5) * chunk.cell_size;
+        hint = collection.chunk_at(map_x, map_y, hint);
+        if (hint) {
+          v = collection.height_at(map_x, map_y, hint).value_or(nan);
+        }
+      }
+      heights[i + j * w] = v;
+    }
+  }
+  return heights;
+}
+
+bool is_multiple(int64_t key, float interval)
+{
+  auto q = key / 1000.0 / interval;
+  return std::abs(q - std::round(q)) < 1e-4;
+}
+
+} // namespace
+
+int64_t level_key(double level)
+{
+  return std::llround(level * 1000.0);
+}
+
+contour_levels contour_tile(const chunks::ChunkCollection &collection,
+    const chunks::Chunk &chunk, float interval, const contour_levels &skip)
+{
+  auto result = contour_levels{};
+  if (interval <= 0.f) {
+    return result;
+  }
+  auto heights = square_corners(collection, chunk);
+  auto lo = std::numeric_limits<float>::infinity();
+  auto hi = -lo;
+  for (auto v : heights) {
+    if (!std::isnan(v)) {
+      lo = std::min(lo, v);
+      hi = std::max(hi, v);
+    }
+  }
+  if (lo > hi) {
+    return result;
+  }
+
+  // Indexed by level, null for the levels already done
+  auto k_min = int64_t(std::ceil(lo / interval));
+  auto k_max = int64_t(std::floor(hi / interval));
+  auto outputs = std::vector<std::vector<glm::vec3> *>{};
+  for (auto k = k_min; k <= k_max; k++) {
+    auto key = level_key(double(k) * interval);
+    outputs.push_back(skip.count(key) ? nullptr : &result[key]);
+  }
+
+  auto w = chunk.ncols + 1;
+  for (unsigned int j = 0; j < chunk.nrows; j++) {
+    for (unsigned int i = 0; i < chunk.ncols; i++) {
+      auto tl = heights[i + j * w];
+      auto tr = heights[i + 1 + j * w];
+      auto bl = heights[i + (j + 1) * w];
+      auto br = heights[i + 1 + (j + 1) * w];
+      if (std::isnan(tl) || std::isnan(tr) || std::isnan(bl) ||
+          std::isnan(br)) {
+        continue;
+      }
+
+      auto p_tl = glm::vec2{i, j};
+      auto p_tr = glm::vec2{i + 1, j};
+      auto p_bl = glm::vec2{i, j + 1};
+      auto p_br = glm::vec2{i + 1, j + 1};
+      auto square_lo = std::min(std::min(tl, tr), std::min(bl, br));
+      auto square_hi = std::max(std::max(tl, tr), std::max(bl, br));
+      auto first = std::max(k_min, int64_t(std::ceil(square_lo / interval)));
+      auto last = std::min(k_max, int64_t(std::floor(square_hi / interval)));
+      for (auto k = first; k <= last; k++) {
+        auto *out = outputs[k - k_min];
+        if (!out) {
+          continue;
+        }
+        auto level = float(double(k) * interval);
+        auto a_tl = tl >= level, a_tr = tr >= level;
+        auto a_bl = bl >= level, a_br = br >= level;
+
+        // Top, right, bottom and left edges, each from its top or left end
+        glm::vec3 points[4];
+        auto count = 0;
+        if (a_tl != a_tr) {
+          points[count++] = crossing(p_tl, tl, p_tr, tr, level);
+        }
+        if (a_tr != a_br) {
+          points[count++] = crossing(p_tr, tr, p_br, br, level);
+        }
+        if (a_bl != a_br) {
+          points[count++] = crossing(p_bl, bl, p_br, br, level);
+        }
+        if (a_tl != a_bl) {
+          points[count++] = crossing(p_tl, tl, p_bl, bl, level);
+        }
+
+        if (count == 2) {
+          out->push_back(points[0]);
+          out->push_back(points[1]);
+        } else if (count == 4) {
+          // A saddle: the centre decides whether the corners above the
+          // level join up through the middle
+          auto centre_above = (tl + tr + bl + br) / 4 >= level;
+          if (centre_above == a_tl) {
+            // Cut off the top right and bottom left corners
+            out->insert(out->end(), {points[0], points[1]});
+            out->insert(out->end(), {points[2], points[3]});
+          } else {
+            out->insert(out->end(), {points[0], points[3]});
+            out->insert(out->end(), {points[1], points[2]});
+          }
+        }
+      }
+    }
+  }
+  return result;
+}
+
+void ContourCache::tile_added(
+    const chunks::ChunkCollection &collection, size_t index)
+{
+  const auto &chunks = collection.chunks();
+  tiles_.resize(chunks.size());
+  tiles_[index] = tile_state{};
+
+  // Any tile whose right column or bottom row of squares reads from the
+  // new one has to be redone
+  auto t = chunks[index].rect();
+  for (size_t i = 0; i < chunks.size(); i++) {
+    if (i == index) {
+      continue;
+    }
+    auto u = chunks[i].rect();
+    auto cell = double(chunks[i].cell_size);
+    auto overlaps = [&](double x0, double y0, double x1, double y1) {
+      return x0 < t.x + double(t.width) && t.x < x1 &&
+             y0 < t.y + double(t.height) && t.y < y1;
+    };
+    auto right = u.x + double(u.width);
+    auto top = u.y + double(u.height);
+    if (overlaps(right, u.y - cell, right + cell, top) ||
+        overlaps(u.x, u.y - cell, right + cell, u.y)) {
+      tiles_[i].stale = true;
+    }
+  }
+}
+
+void ContourCache::set_interval(float interval)
+{
+  if (interval == interval_ || interval <= 0.f) {
+    return;
+  }
+  interval_ = interval;
+  // Levels shared with the last interval are kept, as going from 10 to 20
+  // or back only needs half of them
+  for (auto &tile : tiles_) {
+    std::erase_if(tile.levels,
+        [&](const auto &level) { return !is_multiple(level.first, interval); });
+    tile.incomplete = true;
+  }
+}
+
+float ContourCache::interval() const
+{
+  return interval_;
+}
+
+std::vector<size_t> ContourCache::update(
+    const chunks::ChunkCollection &collection)
+{
+  auto changed = std::vector<size_t>{};
+  for (size_t i = 0; i < tiles_.size(); i++) {
+    if (tiles_[i].stale || tiles_[i].incomplete) {
+      changed.push_back(i);
+    }
+  }
+  if (changed.empty()) {
+    return changed;
+  }
+
+  auto zone = profiling::Zone{"Contours"};
+  const auto &chunks = collection.chunks();
+  jobs::job_system().parallel_for(
+      0, changed.size(), 1, [&](size_t begin, size_t end) {
+        for (auto c = begin; c < end; c++) {
+          auto &tile = tiles_[changed[c]];
+          if (tile.stale) {
+            tile.levels.clear();
+          }
+          auto added =
+              contour_tile(collection, chunks[changed[c]], interval_,
+                  tile.levels);
+          tile.levels.merge(added);
+
+          tile.lines.clear();
+          for (const auto &[key, segments] : tile.levels) {
+            tile.lines.insert(
+                tile.lines.end(), segments.begin(), segments.end());
+          }
+          tile.stale = tile.incomplete = false;
+        }
+      });
+  return changed;
+}
+
+const std::vector<glm::vec3> &ContourCache::lines(size_t tile) const
+{
+  return tiles_[tile].lines;
+}
+
+size_t ContourCache::segment_count() const
+{
+  auto count = size_t{0};
+  for (const auto &tile : tiles_) {
+    count += tile.lines.size() / 2;
+  }
+  return count;
+}
+
+bool ContourCache::write_geojson(const std::string &path,
+    const chunks::ChunkCollection &collection) const
+{
+  struct segment {
+    glm::dvec2 a, b;
+    float level;
+  };
+  struct end_key {
+    int64_t x, y, level;
+    bool operator==(const end_key &) const = default;
+  };
+  struct end_hash {
+    size_t operator()(const end_key &k) const
+    {
+      return std::hash<int64_t>{}(k.x * 73856093 ^ k.y * 19349663 ^ k.level);
+    }
+  };
+  auto key = [](glm::dvec2 p, float level) {
+    return end_key{std::llround(p.x * 1000.0), std::llround(p.y * 1000.0),
+        level_key(level)};
+  };
+
+  // In map coordinates, where the tiles' cells line up
+  auto segments = std::vector<segment>{};
+  const auto &chunks = collection.chunks();
+  for (size_t t = 0; t < tiles_.size() && t < chunks.size(); t++) {
+    auto r = chunks[t].rect();
+    auto cell = double(chunks[t].cell_size);
+    auto top = r.y + double(r.height);
+    auto to_map = [&](const glm::vec3 &p) {
+      return glm::dvec2{r.x + (p.x + 0.5) * cell, top - (p.z + 0.5) * cell};
+    };
+    const auto &lines = tiles_[t].lines;
+    for (size_t i = 0; i + 1 < lines.size(); i += 2) {
+      segments.push_back(
+          {to_map(lines[i]), to_map(lines[i + 1]), lines[i].y});
+    }
+  }
+
+  auto ends = std::unordered_multimap<end_key, size_t, end_hash>{};
+  for (size_t i = 0; i < segments.size(); i++) {
+    ends.emplace(key(segments[i].a, segments[i].level), i);
+    ends.emplace(key(segments[i].b, segments[i].level), i);
+  }
+
+  auto file = std::ofstream{path};
+  if (!file) {
+    return false;
+  }
+  file << std::fixed << std::setprecision(3);
+  file << "{\"type\": \"FeatureCollection\", \"features\": [";
+
+  auto used = std::vector<bool>(segments.size());
+  // The unused segment meeting p, and its other end
+  auto next = [&](glm::dvec2 p, float level) -> std::optional<glm::dvec2> {
+    auto [begin, end] = ends.equal_range(key(p, level));
+    for (auto it = begin; it != end; ++it) {
+      if (!used[it->second]) {
+        used[it->second] = true;
+        const auto &s = segments[it->second];
+        return key(s.a, level) == key(p, level) ? s.b : s.a;
+      }
+    }
+    return std::nullopt;
+  };
+
+  auto features = size_t{0};
+  for (size_t i = 0; i < segments.size(); i++) {
+    if (used[i]) {
+      continue;
+    }
+    used[i] = true;
+    auto level = segments[i].level;
+    auto line = std::deque<glm::dvec2>{segments[i].a, segments[i].b};
+    while (auto p = next(line.back(), level)) {
+      line.push_back(*p);
+    }
+    while (auto p = next(line.front(), level)) {
+      line.push_front(*p);
+    }
+
+    file << (features++ ? ",\n" : "\n")
+         << "{\"type\": \"Feature\", \"properties\": {\"elevation\": "
+         << level << "}, \"geometry\": {\"type\": \"LineString\", "
+         << "\"coordinates\": [";
+    for (size_t p = 0; p < line.size(); p++) {
+      file << (p ? ", " : "") << "[" << line[p].x << ", " << line[p].y << "]";
+    }
+    file << "]}}";
+  }
+  file << "\n]}\n";
+  return bool(file);
+}
+
+} // namespace siliconia::analysis
@@ -0,0 +1,67 @@
+#ifndef SILICONIA_CONTOURS_HPP
+#define SILICONIA_CONTOURS_HPP
+
+#include <chunks/chunk_collection.hpp>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace siliconia::analysis {
+
+// Contour levels are compared by this rather than as floats
+int64_t level_key(double level);
+
+using contour_levels = std::map<int64_t, std::vector<glm::vec3>>;
+
+// Marching squares over one tile at every multiple of interval, as line
+// segments (pairs of points) with x along the rows, y the elevation and z
+// down the rows, in the tile's cells. The squares on the right and bottom
+// edges reach into the neighbouring tiles, so lines carry on across them.
+// Every level the tile spans is returned, even if empty, except those
+// already in skip.
+contour_levels contour_tile(const chunks::ChunkCollection &collection,
+    const chunks::Chunk &chunk, float interval,
+    const contour_levels &skip = {});
+
+// Contours of every added tile, kept per tile and per level so only what
+// changed is redone: new tiles and the tiles they border, and the levels
+// that a new interval adds
+class ContourCache {
+public:
+  // The tile at index in the collection's chunks was just added
+  void tile_added(const chunks::ChunkCollection &collection, size_t index);
+  void set_interval(float interval);
+  float interval() const;
+
+  // Contours every stale tile on the job system, returning the ones whose
+  // lines changed
+  std::vector<size_t> update(const chunks::ChunkCollection &collection);
+
+  // Segments at the current interval
+  const std::vector<glm::vec3> &lines(size_t tile) const;
+  size_t segment_count() const;
+
+  // Joins the segments into lines across tiles and writes them as GeoJSON
+  // LineStrings in map coordinates, with an elevation property
+  bool write_geojson(const std::string &path,
+      const chunks::ChunkCollection &collection) const;
+
+private:
+  struct tile_state {
+    contour_levels levels;
+    std::vector<glm::vec3> lines;
+    // Its neighbours changed, so its edge squares have to be redone
+    bool stale = true;
+    // Levels are missing for the current interval
+    bool incomplete = true;
+  };
+
+  float interval_ = 10.f;
+  std::vector<tile_state> tiles_;
+};
+
+} // namespace siliconia::analysis
+
+#endif // SILICONIA_CONTOURS_HPP
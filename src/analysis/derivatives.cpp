@@ -0,0 +1,246 @@
+#include "derivatives.hpp"
+#include "jobs/job_system.hpp"
+#include "profiling/profiler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SILICONIA_SSE2
+#endif
+
+namespace siliconia::analysis {
+
+namespace {
+
+constexpr auto pi = 3.14159265358979f;
+
+// What a row of cells needs from the 3x3 windows around it
+struct row_inputs {
+  const float *above;
+  const float *centre;
+  const float *below;
+  // Horn's weights over the cell size, with the z factor folded in
+  float scale;
+  glm::vec3 light;
+};
+
+struct row_outputs {
+  float *nx, *ny, *nz;
+  float *hillshade;
+};
+
+// p and q are the height gradients east and north. Rows run south, so the
+// row above is north.
+void gradient_row_scalar(
+    const row_inputs &in, const row_outputs &out, size_t begin, size_t end)
+{
+  for (auto i = begin; i < end; i++) {
+    auto a = in.above[i], b = in.above[i + 1], c = in.above[i + 2];
+    auto d = in.centre[i], f = in.centre[i + 2];
+    auto g = in.below[i], h = in.below[i + 1], k = in.below[i + 2];
+    auto p = ((c + 2 * f + k) - (a + 2 * d + g)) * in.scale;
+    auto q = ((a + 2 * b + c) - (g + 2 * h + k)) * in.scale;
+
+    auto inv = 1.f / std::sqrt(p * p + q * q + 1.f);
+    out.nx[i] = -p * inv;
+    out.ny[i] = -q * inv;
+    out.nz[i] = inv;
+    out.hillshade[i] = std::max(0.f, (-p * in.light.x - q * in.light.y +
+                                         in.light.z) * inv);
+  }
+}
+
+#ifdef SILICONIA_SSE2
+// The same as the scalar row, four cells at a time
+size_t gradient_row_sse2(const row_inputs &in, const row_outputs &out,
+    size_t count)
+{
+  auto two = _mm_set1_ps(2.f);
+  auto one = _mm_set1_ps(1.f);
+  auto zero = _mm_setzero_ps();
+  auto scale = _mm_set1_ps(in.scale);
+  auto lx = _mm_set1_ps(in.light.x);
+  auto ly = _mm_set1_ps(in.light.y);
+  auto lz = _mm_set1_ps(in.light.z);
+  auto sign = _mm_set1_ps(-0.f);
+
+  auto i = size_t{0};
+  for (; i + 4 <= count; i += 4) {
+    auto a = _mm_loadu_ps(in.above + i);
+    auto b = _mm_loadu_ps(in.above + i + 1);
+    auto c = _mm_loadu_ps(in.above + i + 2);
+    auto d = _mm_loadu_ps(in.centre + i);
+    auto f = _mm_loadu_ps(in.centre + i + 2);
+    auto g = _mm_loadu_ps(in.below + i);
+    auto h = _mm_loadu_ps(in.below + i + 1);
+    auto k = _mm_loadu_ps(in.below + i + 2);
+
+    auto east = _mm_add_ps(_mm_add_ps(c, _mm_mul_ps(two, f)), k);
+    auto west = _mm_add_ps(_mm_add_ps(a, _mm_mul_ps(two, d)), g);
+    auto north = _mm_add_ps(_mm_add_ps(a, _mm_mul_ps(two, b)), c);
+    auto south = _mm_add_ps(_mm_add_ps(g, _mm_mul_ps(two, h)), k);
+    auto p = _mm_mul_ps(_mm_sub_ps(east, west), scale);
+    auto q = _mm_mul_ps(_mm_sub_ps(north, south), scale);
+
+    auto len2 = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(p, p), _mm_mul_ps(q, q)), one);
+    auto inv = _mm_div_ps(one, _mm_sqrt_ps(len2));
+    auto nx = _mm_mul_ps(_mm_xor_ps(p, sign), inv);
+    auto ny = _mm_mul_ps(_mm_xor_ps(q, sign), inv);
+    _mm_storeu_ps(out.nx + i, nx);
+    _mm_storeu_ps(out.ny + i, ny);
+    _mm_storeu_ps(out.nz + i, inv);
+
+    auto lit = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(nx, lx), _mm_mul_ps(ny, ly)),
+        _mm_mul_ps(inv, lz));
+    _mm_storeu_ps(out.hillshade + i, _mm_max_ps(lit, zero));
+  }
+  return i;
+}
+#endif
+
+} // namespace
+
+std::vector<float> padded_heights(
+    const chunks::ChunkCollection &collection, const chunks::Chunk &chunk)
+{
+  auto w = chunk.ncols + 2;
+  auto h = chunk.nrows + 2;
+  auto padded = std::vector<float>(size_t(w) * h);
+  auto nan = std::numeric_limits<float>::quiet_NaN();
+  auto r = chunk.rect();
+
+  const auto *hint = static_cast<const chunks::Chunk *>(nullptr);
+  for (unsigned int y = 0; y < h; y++) {
+    for (unsigned int x = 0; x < w; x++) {
+      // In the tile's cells, so the border is at -1 and ncols or nrows
+      auto i = int(x) - 1;
+      auto j = int(y) - 1;
+      auto inside = i >= 0 && j >= 0 && i < int(chunk.ncols) &&
+                    j < int(chunk.nrows);
+
+      auto v = 0.f;
+      if (inside) {
+        v = chunk.data[i + j * chunk.ncols];
+      } else {
+        // At the cell's centre, as rows run down from the top of the rect
+        auto map_x = r.x + (i + 0.5) * chunk.cell_size;
+        auto map_y = r.y + double(r.height) - (j + 0.5) * chunk.cell_size;
+        hint = collection.chunk_at(map_x, map_y, hint);
+        if (hint) {
+          v = collection.height_at(map_x, map_y, hint).value_or(nan);
+        } else {
+          auto ci = std::clamp(i, 0, int(chunk.ncols) - 1);
+          auto cj = std::clamp(j, 0, int(chunk.nrows) - 1);
+          v = chunk.data[ci + cj * chunk.ncols];
+        }
+      }
+      padded[x + y * w] = v == chunk.nodata_value ? nan : v;
+    }
+  }
+  return padded;
+}
+
+derivative_grids compute_derivatives(const chunks::Chunk &chunk,
+    const std::vector<float> &padded, const sun &light, float z_factor)
+{
+  auto grids = derivative_grids{};
+  grids.ncols = chunk.ncols;
+  grids.nrows = chunk.nrows;
+  grids.nodata_value = chunk.nodata_value;
+  auto cells = size_t(chunk.ncols) * chunk.nrows;
+  grids.normals.resize(cells);
+  grids.slope.resize(cells);
+  grids.aspect.resize(cells);
+  grids.hillshade.resize(cells);
+
+  auto azimuth = light.azimuth_deg * pi / 180.f;
+  auto altitude = light.altitude_deg * pi / 180.f;
+  auto towards_sun = glm::vec3{std::sin(azimuth) * std::cos(altitude),
+      std::cos(azimuth) * std::cos(altitude), std::sin(altitude)};
+
+  // Split into components so each is a contiguous row for SIMD
+  auto nx = std::vector<float>(chunk.ncols);
+  auto ny = std::vector<float>(chunk.ncols);
+  auto nz = std::vector<float>(chunk.ncols);
+  auto w = chunk.ncols + 2;
+  for (unsigned int j = 0; j < chunk.nrows; j++) {
+    auto in = row_inputs{&padded[j * w], &padded[(j + 1) * w],
+        &padded[(j + 2) * w], z_factor / (8.f * chunk.cell_size),
+        towards_sun};
+    auto row = size_t(j) * chunk.ncols;
+    auto out = row_outputs{
+        nx.data(), ny.data(), nz.data(), grids.hillshade.data() + row};
+
+    auto done = size_t{0};
+#ifdef SILICONIA_SSE2
+    done = gradient_row_sse2(in, out, chunk.ncols);
+#endif
+    gradient_row_scalar(in, out, done, chunk.ncols);
+
+    // atan2 and acos aren't vectorised, so these are left to the compiler
+    for (unsigned int i = 0; i < chunk.ncols; i++) {
+      auto k = row + i;
+      if (std::isnan(nz[i])) {
+        grids.normals[k] = glm::vec3{0.f};
+        grids.slope[k] = grids.aspect[k] = grids.hillshade[k] =
+            chunk.nodata_value;
+        continue;
+      }
+      grids.normals[k] = {nx[i], ny[i], nz[i]};
+      grids.slope[k] = std::acos(std::min(1.f, nz[i])) * 180.f / pi;
+      if (nx[i] == 0.f && ny[i] == 0.f) {
+        grids.aspect[k] = -1.f;
+      } else {
+        auto aspect = std::atan2(nx[i], ny[i]) * 180.f / pi;
+        grids.aspect[k] = aspect < 0.f ? aspect + 360.f : aspect;
+      }
+    }
+  }
+  return grids;
+}
+
+std::vector<derivative_grids> compute_derivatives(
+    const chunks::ChunkCollection &collection, const sun &light,
+    float z_factor)
+{
+  const auto &chunks = collection.chunks();
+  auto grids = std::vector<derivative_grids>(chunks.size());
+  jobs::job_system().parallel_for(
+      0, chunks.size(), 1, [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; i++) {
+          auto zone = profiling::Zone{"Derivatives", chunks[i].path};
+          auto padded = padded_heights(collection, chunks[i]);
+          grids[i] = compute_derivatives(chunks[i], padded, light, z_factor);
+        }
+      });
+  return grids;
+}
+
+bool write_asc(const std::string &path, const chunks::Chunk &chunk,
+    const std::vector<float> &values, float nodata_value)
+{
+  auto file = std::ofstream{path};
+  if (!file) {
+    return false;
+  }
+  file << "ncols " << chunk.ncols << "\n"
+       << "nrows " << chunk.nrows << "\n"
+       << "xllcorner " << chunk.xllcorner << "\n"
+       << "yllcorner " << chunk.yllcorner << "\n"
+       << "cellsize " << chunk.cell_size << "\n"
+       << "NODATA_value " << nodata_value << "\n";
+  for (unsigned int j = 0; j < chunk.nrows; j++) {
+    for (unsigned int i = 0; i < chunk.ncols; i++) {
+      file << (i ? " " : "") << values[i + j * chunk.ncols];
+    }
+    file << "\n";
+  }
+  return bool(file);
+}
+
+} // namespace siliconia::analysis
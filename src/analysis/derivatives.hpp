@@ -0,0 +1,54 @@
+#ifndef SILICONIA_DERIVATIVES_HPP
+#define SILICONIA_DERIVATIVES_HPP
+
+#include <chunks/chunk.hpp>
+#include <chunks/chunk_collection.hpp>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+namespace siliconia::analysis {
+
+struct sun {
+  // Clockwise from north
+  float azimuth_deg = 315.f;
+  float altitude_deg = 45.f;
+};
+
+// Per cell, in the same layout as the tile's data. Cells whose 3x3
+// neighbourhood touches nodata are nodata_value (and a zero normal).
+struct derivative_grids {
+  unsigned int ncols = 0, nrows = 0;
+  float nodata_value = -9999.f;
+  // Unit normals in x east, y north, z up
+  std::vector<glm::vec3> normals;
+  // Degrees from flat
+  std::vector<float> slope;
+  // Degrees clockwise from north that the slope faces, -1 where flat
+  std::vector<float> aspect;
+  // 0 in shadow to 1 facing the sun
+  std::vector<float> hillshade;
+};
+
+// The tile's heights with a one cell border from whichever neighbouring
+// tiles have been added, repeating the tile's own edge where there are
+// none. Nodata is NaN.
+std::vector<float> padded_heights(
+    const chunks::ChunkCollection &collection, const chunks::Chunk &chunk);
+
+// Horn's 3x3 gradient over padded heights from padded_heights
+derivative_grids compute_derivatives(const chunks::Chunk &chunk,
+    const std::vector<float> &padded, const sun &light, float z_factor = 1.f);
+
+// Every added tile, as jobs
+std::vector<derivative_grids> compute_derivatives(
+    const chunks::ChunkCollection &collection, const sun &light,
+    float z_factor = 1.f);
+
+// As an ESRI ASCII grid with the tile's header
+bool write_asc(const std::string &path, const chunks::Chunk &chunk,
+    const std::vector<float> &values, float nodata_value);
+
+} // namespace siliconia::analysis
+
+#endif // SILICONIA_DERIVATIVES_HPP
@@ -0,0 +1,222 @@
+#include "height_pyramid.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+namespace siliconia::analysis {
+
+namespace {
+
+constexpr auto infinity = std::numeric_limits<float>::infinity();
+
+// The ray parameters where it enters and leaves the box, if it does
+std::optional<std::pair<float, float>> slab(
+    const ray &r, const glm::vec3 &lo, const glm::vec3 &hi)
+{
+  auto t0 = 0.f;
+  auto t1 = infinity;
+  for (int axis = 0; axis < 3; axis++) {
+    auto inv = 1.f / r.dir[axis];
+    auto near = (lo[axis] - r.origin[axis]) * inv;
+    auto far = (hi[axis] - r.origin[axis]) * inv;
+    if (near > far) {
+      std::swap(near, far);
+    }
+    // NaN from a zero direction inside the slab leaves the range alone
+    t0 = near > t0 ? near : t0;
+    t1 = far < t1 ? far : t1;
+    if (t0 > t1) {
+      return std::nullopt;
+    }
+  }
+  return std::pair{t0, t1};
+}
+
+// Möller-Trumbore, from either side
+std::optional<float> triangle(
+    const ray &r, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+{
+  auto ab = b - a;
+  auto ac = c - a;
+  auto p = glm::cross(r.dir, ac);
+  auto det = glm::dot(ab, p);
+  if (std::abs(det) < 1e-12f) {
+    return std::nullopt;
+  }
+  auto inv = 1.f / det;
+  auto s = r.origin - a;
+  auto u = glm::dot(s, p) * inv;
+  if (u < 0.f || u > 1.f) {
+    return std::nullopt;
+  }
+  auto q = glm::cross(s, ab);
+  auto v = glm::dot(r.dir, q) * inv;
+  if (v < 0.f || u + v > 1.f) {
+    return std::nullopt;
+  }
+  auto t = glm::dot(ac, q) * inv;
+  if (t < 0.f) {
+    return std::nullopt;
+  }
+  return t;
+}
+
+} // namespace
+
+HeightPyramid::HeightPyramid(const chunks::Chunk &chunk)
+{
+  if (chunk.ncols < 2 || chunk.nrows < 2) {
+    return;
+  }
+
+  auto base = level{{chunk.ncols - 1, chunk.nrows - 1}, {}, {}};
+  base.min.resize(base.extent.x * base.extent.y, infinity);
+  base.max.resize(base.extent.x * base.extent.y, -infinity);
+  for (uint32_t j = 0; j < base.extent.y; j++) {
+    for (uint32_t i = 0; i < base.extent.x; i++) {
+      auto lo = infinity;
+      auto hi = -infinity;
+      auto empty = false;
+      for (auto [di, dj] : {std::pair{0u, 0u}, {1u, 0u}, {0u, 1u}, {1u, 1u}}) {
+        auto v = chunk.data[(i + di) + (j + dj) * chunk.ncols];
+        empty |= v == chunk.nodata_value;
+        lo = std::min(lo, v);
+        hi = std::max(hi, v);
+      }
+      if (!empty) {
+        base.min[i + j * base.extent.x] = lo;
+        base.max[i + j * base.extent.x] = hi;
+      }
+    }
+  }
+  levels_.push_back(std::move(base));
+
+  while (levels_.back().extent.x > 1 || levels_.back().extent.y > 1) {
+    const auto &below = levels_.back();
+    auto next = level{(below.extent + 1u) / 2u, {}, {}};
+    next.min.resize(next.extent.x * next.extent.y, infinity);
+    next.max.resize(next.extent.x * next.extent.y, -infinity);
+    for (uint32_t j = 0; j < below.extent.y; j++) {
+      for (uint32_t i = 0; i < below.extent.x; i++) {
+        auto &lo = next.min[i / 2 + j / 2 * next.extent.x];
+        auto &hi = next.max[i / 2 + j / 2 * next.extent.x];
+        lo = std::min(lo, below.min[i + j * below.extent.x]);
+        hi = std::max(hi, below.max[i + j * below.extent.x]);
+      }
+    }
+    levels_.push_back(std::move(next));
+  }
+}
+
+std::optional<float> HeightPyramid::intersect(
+    const ray &r, const chunks::Chunk &chunk, float t_max) const
+{
+  struct node {
+    uint32_t level, i, j;
+    float t;
+  };
+  auto box = [&](uint32_t l, uint32_t i, uint32_t j) {
+    const auto &lvl = levels_[l];
+    auto cells = levels_[0].extent;
+    auto x0 = i << l;
+    auto z0 = j << l;
+    auto x1 = std::min((i + 1) << l, cells.x);
+    auto z1 = std::min((j + 1) << l, cells.y);
+    auto k = i + j * lvl.extent.x;
+    return std::pair{glm::vec3{x0, lvl.min[k], z0},
+        glm::vec3{x1, lvl.max[k], z1}};
+  };
+
+  auto best = t_max;
+  auto stack = std::vector<node>{};
+  if (auto t = entry(r)) {
+    stack.push_back({uint32_t(levels_.size() - 1), 0, 0, *t});
+  }
+
+  auto height = [&](uint32_t i, uint32_t j) {
+    return chunk.data[i + j * chunk.ncols];
+  };
+  while (!stack.empty()) {
+    auto n = stack.back();
+    stack.pop_back();
+    if (n.t >= best) {
+      continue;
+    }
+
+    if (n.level == 0) {
+      auto tl = glm::vec3{n.i, height(n.i, n.j), n.j};
+      auto tr = glm::vec3{n.i + 1, height(n.i + 1, n.j), n.j};
+      auto bl = glm::vec3{n.i, height(n.i, n.j + 1), n.j + 1};
+      auto br = glm::vec3{n.i + 1, height(n.i + 1, n.j + 1), n.j + 1};
+      for (auto t : {triangle(r, tl, tr, bl), triangle(r, tr, br, bl)}) {
+        if (t && *t < best) {
+          best = *t;
+        }
+      }
+      continue;
+    }
+
+    // Pushed furthest first so the nearest child is tried first, and
+    // anything behind a hit is skipped when it is popped
+    auto children = std::array<node, 4>{};
+    auto count = 0;
+    const auto &below = levels_[n.level - 1];
+    for (auto cj = n.j * 2; cj < std::min(n.j * 2 + 2, below.extent.y); cj++) {
+      for (auto ci = n.i * 2; ci < std::min(n.i * 2 + 2, below.extent.x);
+           ci++) {
+        if (below.max[ci + cj * below.extent.x] == -infinity) {
+          continue;
+        }
+        auto [lo, hi] = box(n.level - 1, ci, cj);
+        if (auto t = slab(r, lo, hi); t && t->first < best) {
+          children[count++] = {n.level - 1, ci, cj, t->first};
+        }
+      }
+    }
+    std::sort(children.begin(), children.begin() + count,
+        [](const node &a, const node &b) { return a.t > b.t; });
+    stack.insert(stack.end(), children.begin(), children.begin() + count);
+  }
+
+  if (best < t_max) {
+    return best;
+  }
+  return std::nullopt;
+}
+
+std::optional<float> HeightPyramid::entry(const ray &r) const
+{
+  if (levels_.empty() || levels_.back().max[0] == -infinity) {
+    return std::nullopt;
+  }
+  auto cells = levels_[0].extent;
+  auto t = slab(r, {0.f, levels_.back().min[0], 0.f},
+      {cells.x, levels_.back().max[0], cells.y});
+  if (!t) {
+    return std::nullopt;
+  }
+  return t->first;
+}
+
+uint32_t HeightPyramid::levels() const
+{
+  return levels_.size();
+}
+
+glm::uvec2 HeightPyramid::extent(uint32_t level) const
+{
+  return levels_[level].extent;
+}
+
+float HeightPyramid::min_at(uint32_t level, uint32_t i, uint32_t j) const
+{
+  return levels_[level].min[i + j * levels_[level].extent.x];
+}
+
+float HeightPyramid::max_at(uint32_t level, uint32_t i, uint32_t j) const
+{
+  return levels_[level].max[i + j * levels_[level].extent.x];
+}
+
+} // namespace siliconia::analysis
@@ -0,0 +1,53 @@
+#ifndef SILICONIA_HEIGHT_PYRAMID_HPP
+#define SILICONIA_HEIGHT_PYRAMID_HPP
+
+#include <chunks/chunk.hpp>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <optional>
+#include <vector>
+
+namespace siliconia::analysis {
+
+// Tile-local coordinates: x is the column, y the elevation (up, unlike the
+// renderer's negated heights) and z the row
+struct ray {
+  glm::vec3 origin;
+  glm::vec3 dir;
+};
+
+// Min and max heights over a tile's cells, halving in each direction per
+// level up to a single node. A cell spans the four vertices around it, as
+// it does in the tile's mesh, and cells touching nodata are empty.
+class HeightPyramid {
+public:
+  HeightPyramid() = default;
+  explicit HeightPyramid(const chunks::Chunk &chunk);
+
+  // Descends only into nodes whose height range the ray passes through,
+  // nearest first, and tests the same two triangles per cell as the mesh.
+  // Returns the ray parameter of the first hit before t_max.
+  std::optional<float> intersect(
+      const ray &r, const chunks::Chunk &chunk, float t_max) const;
+  // Where the ray enters the box around the whole tile, if it does
+  std::optional<float> entry(const ray &r) const;
+
+  uint32_t levels() const;
+  // Cells along each side of a level
+  glm::uvec2 extent(uint32_t level) const;
+  float min_at(uint32_t level, uint32_t i, uint32_t j) const;
+  float max_at(uint32_t level, uint32_t i, uint32_t j) const;
+
+private:
+  struct level {
+    glm::uvec2 extent;
+    std::vector<float> min;
+    std::vector<float> max;
+  };
+
+  std::vector<level> levels_;
+};
+
+} // namespace siliconia::analysis
+
+#endif // SILICONIA_HEIGHT_PYRAMID_HPP
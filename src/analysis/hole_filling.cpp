@@ -0,0 +1,192 @@
+#include "hole_filling.hpp"
+#include "jobs/job_system.hpp"
+#include "profiling/profiler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace siliconia::analysis {
+
+namespace {
+
+enum class cell_kind : uint8_t { data, hole, outside };
+
+} // namespace
+
+hole_fill_result fill_holes(const chunks::ChunkCollection *collection,
+    const chunks::Chunk &chunk, const hole_options &options)
+{
+  auto zone = profiling::Zone{"Fill holes", chunk.path};
+  auto result = hole_fill_result{};
+  result.data = chunk.data;
+  if (options.max_hole_size == 0 ||
+      std::find(chunk.data.begin(), chunk.data.end(), chunk.nodata_value) ==
+          chunk.data.end()) {
+    return result;
+  }
+
+  // A hole and its rim are found the same way from every tile it touches,
+  // however far into the neighbour it reaches
+  auto pad = int(options.max_hole_size) + 1;
+  auto w = int(chunk.ncols) + 2 * pad;
+  auto h = int(chunk.nrows) + 2 * pad;
+  auto values = std::vector<float>(size_t(w) * h);
+  auto kinds = std::vector<cell_kind>(values.size(), cell_kind::outside);
+  auto r = chunk.rect();
+  auto top = r.y + double(r.height);
+  const auto *hint = static_cast<const chunks::Chunk *>(nullptr);
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      auto i = x - pad;
+      auto j = y - pad;
+      auto k = x + size_t(y) * w;
+      if (i >= 0 && j >= 0 && i < int(chunk.ncols) && j < int(chunk.nrows)) {
+        values[k] = chunk.data[i + size_t(j) * chunk.ncols];
+        kinds[k] = values[k] == chunk.nodata_value ? cell_kind::hole
+                                                   : cell_kind::data;
+        continue;
+      }
+      if (!collection) {
+        continue;
+      }
+      auto map_x = r.x + (i + 0.5) * chunk.cell_size;
+      auto map_y = top - (j + 0.5) * chunk.cell_size;
+      hint = collection->chunk_at(map_x, map_y, hint);
+      if (hint) {
+        auto v = collection->height_at(map_x, map_y, hint);
+        values[k] = v.value_or(0.f);
+        kinds[k] = v ? cell_kind::data : cell_kind::hole;
+      }
+    }
+  }
+
+  auto visited = std::vector<bool>(values.size());
+  auto component = std::vector<size_t>{};
+  auto rim = std::vector<size_t>{};
+  auto stack = std::vector<size_t>{};
+  for (int j = 0; j < int(chunk.nrows); j++) {
+    for (int i = 0; i < int(chunk.ncols); i++) {
+      auto start = (i + pad) + size_t(j + pad) * w;
+      if (kinds[start] != cell_kind::hole || visited[start]) {
+        continue;
+      }
+
+      // The whole hole, even where it goes too far to be filled, so none of
+      // it is walked again
+      component.clear();
+      rim.clear();
+      stack.assign(1, start);
+      visited[start] = true;
+      auto open = false;
+      auto min_x = w, min_y = h, max_x = 0, max_y = 0;
+      while (!stack.empty()) {
+        auto k = stack.back();
+        stack.pop_back();
+        component.push_back(k);
+        auto x = int(k % w), y = int(k / w);
+        min_x = std::min(min_x, x);
+        max_x = std::max(max_x, x);
+        min_y = std::min(min_y, y);
+        max_y = std::max(max_y, y);
+        for (auto [dx, dy] : {std::pair{-1, 0}, {1, 0}, {0, -1}, {0, 1}}) {
+          auto nx = x + dx, ny = y + dy;
+          if (nx < 0 || ny < 0 || nx >= w || ny >= h) {
+            open = true;
+            continue;
+          }
+          auto n = nx + size_t(ny) * w;
+          if (kinds[n] == cell_kind::outside) {
+            open = true;
+          } else if (kinds[n] == cell_kind::data) {
+            rim.push_back(n);
+          } else if (!visited[n]) {
+            visited[n] = true;
+            stack.push_back(n);
+          }
+        }
+      }
+
+      auto size = unsigned(std::max(max_x - min_x, max_y - min_y) + 1);
+      if (open || size > options.max_hole_size || rim.empty()) {
+        result.holes_skipped++;
+        continue;
+      }
+
+      // In row order, which is the same from any tile, so the sums are too
+      std::sort(rim.begin(), rim.end());
+      rim.erase(std::unique(rim.begin(), rim.end()), rim.end());
+      for (auto k : component) {
+        auto x = int(k % w) - pad, y = int(k / w) - pad;
+        if (x < 0 || y < 0 || x >= int(chunk.ncols) || y >= int(chunk.nrows)) {
+          continue;
+        }
+        auto sum = 0.0, weights = 0.0;
+        for (auto n : rim) {
+          auto dx = double(int(n % w) - pad - x);
+          auto dy = double(int(n / w) - pad - y);
+          auto weight = std::pow(dx * dx + dy * dy, -0.5 * options.power);
+          sum += weight * values[n];
+          weights += weight;
+        }
+        result.data[x + size_t(y) * chunk.ncols] = float(sum / weights);
+        result.cells_filled++;
+      }
+      result.holes_filled++;
+    }
+  }
+  return result;
+}
+
+hole_fill_result fill_holes(const std::vector<chunks::Chunk> &headers,
+    const chunks::Chunk &chunk, const hole_options &options)
+{
+  // Holes further in than the halo is wide never reach it
+  auto pad = options.max_hole_size + 1;
+  auto near_edge = false;
+  for (unsigned int j = 0; j < chunk.nrows && !near_edge; j++) {
+    for (unsigned int i = 0; i < chunk.ncols && !near_edge; i++) {
+      near_edge = (i < pad || j < pad || i + pad >= chunk.ncols ||
+                      j + pad >= chunk.nrows) &&
+                  chunk.data[i + size_t(j) * chunk.ncols] ==
+                      chunk.nodata_value;
+    }
+  }
+  if (!near_edge) {
+    return fill_holes(nullptr, chunk, options);
+  }
+
+  auto reach = double(pad) * chunk.cell_size;
+  auto r = chunk.rect();
+  auto neighbours = std::vector<chunks::Chunk>{};
+  for (const auto &header : headers) {
+    auto n = header.rect();
+    if (header.path != chunk.path &&
+        n.x < r.x + double(r.width) + reach &&
+        double(r.x) - reach < n.x + double(n.width) &&
+        n.y < r.y + double(r.height) + reach &&
+        double(r.y) - reach < n.y + double(n.height)) {
+      neighbours.push_back(header);
+    }
+  }
+  auto collection = chunks::ChunkCollection{std::move(neighbours)};
+  for (const auto &header : collection.headers()) {
+    collection.add(chunks::Chunk{header.path});
+  }
+  return fill_holes(&collection, chunk, options);
+}
+
+std::vector<hole_fill_result> fill_holes(
+    const chunks::ChunkCollection &collection, const hole_options &options)
+{
+  const auto &chunks = collection.chunks();
+  auto results = std::vector<hole_fill_result>(chunks.size());
+  jobs::job_system().parallel_for(
+      0, chunks.size(), 1, [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; i++) {
+          results[i] = fill_holes(&collection, chunks[i], options);
+        }
+      });
+  return results;
+}
+
+} // namespace siliconia::analysis
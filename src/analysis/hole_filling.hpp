@@ -0,0 +1,47 @@
+#ifndef SILICONIA_HOLE_FILLING_HPP
+#define SILICONIA_HOLE_FILLING_HPP
+
+#include <chunks/chunk_collection.hpp>
+#include <vector>
+
+namespace siliconia::analysis {
+
+struct hole_options {
+  // Holes wider or taller than this many cells are left alone, as are
+  // holes that run off the edge of the data
+  unsigned int max_hole_size = 32;
+  // Of the inverse distance weighting
+  float power = 2.f;
+};
+
+struct hole_fill_result {
+  // The tile's cells, with the holes filled
+  std::vector<float> data;
+  size_t holes_filled = 0;
+  size_t cells_filled = 0;
+  size_t holes_skipped = 0;
+};
+
+// Fills the tile's nodata holes by inverse distance weighting from the
+// cells with data around each hole. The tile is padded with a halo from
+// the neighbouring tiles at least as wide as the largest hole, so a hole
+// crossing into a neighbour is filled with exactly the same values from
+// either side. Without a collection there is no halo, and holes touching
+// the tile's edge are left alone.
+hole_fill_result fill_holes(const chunks::ChunkCollection *collection,
+    const chunks::Chunk &chunk, const hole_options &options);
+
+// The same, but with a halo from just the neighbours it reaches, parsed
+// from the survey's headers, and only if a hole comes near enough the edge
+// to need one. Each tile can then be filled on its own, with only it and
+// its neighbours in memory.
+hole_fill_result fill_holes(const std::vector<chunks::Chunk> &headers,
+    const chunks::Chunk &chunk, const hole_options &options);
+
+// Every added tile, as jobs
+std::vector<hole_fill_result> fill_holes(
+    const chunks::ChunkCollection &collection, const hole_options &options);
+
+} // namespace siliconia::analysis
+
+#endif // SILICONIA_HOLE_FILLING_HPP
@@ -0,0 +1,95 @@
+#include "profile.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace siliconia::analysis {
+
+namespace {
+
+// Cell centres are at (left + (i + 0.5) * cell, top - (j + 0.5) * cell),
+// the tiles' cells all lining up
+float interpolate(chunks::ChunkCursor &cursor, double left, double top,
+    double cell, glm::dvec2 p)
+{
+  auto u = (p.x - left) / cell - 0.5;
+  auto v = (top - p.y) / cell - 0.5;
+  auto i = std::floor(u);
+  auto j = std::floor(v);
+  auto fu = u - i;
+  auto fv = v - j;
+
+  auto sum = 0.0;
+  auto weight = 0.0;
+  auto corner = [&](double ci, double cj, double w) {
+    auto h =
+        cursor.height_at(left + (ci + 0.5) * cell, top - (cj + 0.5) * cell);
+    if (h) {
+      sum += *h * w;
+      weight += w;
+    }
+  };
+  corner(i, j, (1 - fu) * (1 - fv));
+  corner(i + 1, j, fu * (1 - fv));
+  corner(i, j + 1, (1 - fu) * fv);
+  corner(i + 1, j + 1, fu * fv);
+  if (weight < 0.5) {
+    return std::numeric_limits<float>::quiet_NaN();
+  }
+  return float(sum / weight);
+}
+
+} // namespace
+
+elevation_profile sample_profile(const chunks::ChunkCollection &collection,
+    const std::vector<glm::dvec2> &points, size_t count)
+{
+  auto profile = elevation_profile{};
+  profile.min = std::numeric_limits<float>::infinity();
+  profile.max = -profile.min;
+  const auto &chunks = collection.chunks();
+  if (points.size() < 2 || count < 2 || chunks.empty()) {
+    return profile;
+  }
+
+  auto cumulative = std::vector<double>{0.0};
+  for (size_t i = 1; i < points.size(); i++) {
+    cumulative.push_back(
+        cumulative.back() + glm::distance(points[i - 1], points[i]));
+  }
+  profile.length = cumulative.back();
+
+  auto cell = double(chunks.front().cell_size);
+  auto left = double(collection.rect.x);
+  auto top = collection.rect.y + double(collection.rect.height);
+  auto cursor = chunks::ChunkCursor{collection};
+  profile.points.reserve(count);
+  profile.distances.reserve(count);
+  profile.elevations.reserve(count);
+
+  // The samples only move forwards, so the segment does too
+  size_t segment = 1;
+  for (size_t s = 0; s < count; s++) {
+    auto d = profile.length * double(s) / double(count - 1);
+    while (segment + 1 < points.size() && cumulative[segment] < d) {
+      segment++;
+    }
+    auto a = points[segment - 1];
+    auto b = points[segment];
+    auto span = cumulative[segment] - cumulative[segment - 1];
+    auto t = span > 0 ? (d - cumulative[segment - 1]) / span : 0.0;
+    auto p = a + (b - a) * std::clamp(t, 0.0, 1.0);
+
+    auto h = interpolate(cursor, left, top, cell, p);
+    if (!std::isnan(h)) {
+      profile.min = std::min(profile.min, h);
+      profile.max = std::max(profile.max, h);
+    }
+    profile.points.push_back(p);
+    profile.distances.push_back(float(d));
+    profile.elevations.push_back(h);
+  }
+  return profile;
+}
+
+} // namespace siliconia::analysis
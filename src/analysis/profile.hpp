@@ -0,0 +1,30 @@
+#ifndef SILICONIA_PROFILE_HPP
+#define SILICONIA_PROFILE_HPP
+
+#include <chunks/chunk_collection.hpp>
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace siliconia::analysis {
+
+// Elevations at even steps along a polyline, NaN where there is no data
+struct elevation_profile {
+  std::vector<glm::dvec2> points;
+  std::vector<float> distances;
+  std::vector<float> elevations;
+  double length = 0;
+  // Over the samples with data, min > max if there are none
+  float min = 0, max = 0;
+};
+
+// Samples count points from the first to the last of points, which are in
+// the same coordinates as ChunkCollection::rect. Each is bilinear between
+// the four cells around it, which may be in different tiles. Cells without
+// data are left out, and if they carry most of the weight the sample has
+// none either, so the gaps stay about where the nodata cells are.
+elevation_profile sample_profile(const chunks::ChunkCollection &collection,
+    const std::vector<glm::dvec2> &points, size_t count);
+
+} // namespace siliconia::analysis
+
+#endif // SILICONIA_PROFILE_HPP
@@ -0,0 +1,56 @@
+#include "terrain_picker.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace siliconia::analysis {
+
+void TerrainPicker::add(HeightPyramid pyramid, const glm::vec3 &offset)
+{
+  tiles_.push_back({std::move(pyramid), offset});
+}
+
+std::optional<pick_result> TerrainPicker::pick(const glm::vec3 &origin,
+    const glm::vec3 &dir, const std::vector<chunks::Chunk> &chunks) const
+{
+  // The renderer negates heights, so elevation runs along -y
+  auto local_ray = [&](const tile &t) {
+    auto local_origin =
+        glm::vec3{origin.x - t.offset.x, -origin.y, origin.z - t.offset.z};
+    return ray{local_origin, glm::normalize(glm::vec3{dir.x, -dir.y, dir.z})};
+  };
+
+  // Ordered by where each tile's box is entered, so later tiles can be
+  // dropped as soon as one is entered past the best hit
+  auto order = std::vector<std::pair<float, size_t>>{};
+  for (size_t i = 0; i < std::min(tiles_.size(), chunks.size()); i++) {
+    if (auto entry = tiles_[i].pyramid.entry(local_ray(tiles_[i]))) {
+      order.push_back({*entry, i});
+    }
+  }
+  std::sort(order.begin(), order.end());
+
+  auto best = std::numeric_limits<float>::infinity();
+  auto result = std::optional<pick_result>{};
+  for (auto [entry, i] : order) {
+    if (entry >= best) {
+      break;
+    }
+    const auto &t = tiles_[i];
+    auto r = local_ray(t);
+    if (auto hit = t.pyramid.intersect(r, chunks[i], best)) {
+      best = *hit;
+      auto local = r.origin + r.dir * best;
+      result = pick_result{i,
+          glm::vec3{local.x + t.offset.x, -local.y, local.z + t.offset.z},
+          local.y};
+    }
+  }
+  return result;
+}
+
+size_t TerrainPicker::size() const
+{
+  return tiles_.size();
+}
+
+} // namespace siliconia::analysis
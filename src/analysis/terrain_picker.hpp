@@ -0,0 +1,44 @@
+#ifndef SILICONIA_TERRAIN_PICKER_HPP
+#define SILICONIA_TERRAIN_PICKER_HPP
+
+#include "height_pyramid.hpp"
+#include <chunks/chunk.hpp>
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <optional>
+#include <vector>
+
+namespace siliconia::analysis {
+
+struct pick_result {
+  size_t tile;
+  // In world space, as the renderer draws it
+  glm::vec3 position;
+  float elevation;
+};
+
+// Intersects world space rays with every tile's height pyramid, nearest
+// tile first, stopping once the next tile starts beyond the best hit.
+class TerrainPicker {
+public:
+  // Tiles are numbered in the order they are added, which has to match the
+  // chunks passed to pick. offset is where the tile's mesh is drawn.
+  void add(HeightPyramid pyramid, const glm::vec3 &offset);
+
+  std::optional<pick_result> pick(const glm::vec3 &origin,
+      const glm::vec3 &dir, const std::vector<chunks::Chunk> &chunks) const;
+
+  size_t size() const;
+
+private:
+  struct tile {
+    HeightPyramid pyramid;
+    glm::vec3 offset;
+  };
+
+  std::vector<tile> tiles_;
+};
+
+} // namespace siliconia::analysis
+
+#endif // SILICONIA_TERRAIN_PICKER_HPP
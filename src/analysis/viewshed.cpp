@@ -0,0 +1,150 @@
+#include "viewshed.hpp"
+#include "jobs/job_system.hpp"
+#include "profiling/profiler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace siliconia::analysis {
+
+namespace {
+
+// Rays overlap near the observer, so the cells are flags that any ray can
+// add to: reached with data, and seen by at least one ray
+constexpr uint8_t reached = 1;
+constexpr uint8_t seen = 2;
+
+// Earth radius over one less the refraction coefficient
+constexpr double effective_earth_diameter = 2.0 * 6371000.0 / (1.0 - 0.13);
+
+void mark(uint8_t &cell, uint8_t flags)
+{
+  auto ref = std::atomic_ref<uint8_t>{cell};
+  if ((ref.load(std::memory_order_relaxed) & flags) != flags) {
+    ref.fetch_or(flags, std::memory_order_relaxed);
+  }
+}
+
+} // namespace
+
+uint8_t viewshed_grid::at(double map_x, double map_y) const
+{
+  auto i = std::floor((map_x - x) / cell_size);
+  auto j = std::floor((y - map_y) / cell_size);
+  if (i < 0 || j < 0 || i >= ncols || j >= nrows) {
+    return nodata;
+  }
+  return cells[size_t(i) + size_t(j) * ncols];
+}
+
+std::optional<viewshed_grid> compute_viewshed(
+    const chunks::ChunkCollection &collection,
+    const viewshed_options &options)
+{
+  auto zone = profiling::Zone{"Viewshed"};
+  const auto *chunk = collection.chunk_at(options.x, options.y);
+  if (!chunk) {
+    return std::nullopt;
+  }
+
+  // On the centre of the observer's cell, so the grid lines up with the
+  // tiles' cells
+  auto cell_size = double(chunk->cell_size);
+  auto r = chunk->rect();
+  auto top = r.y + double(r.height);
+  auto centre_x =
+      r.x + (std::floor((options.x - r.x) / cell_size) + 0.5) * cell_size;
+  auto centre_y =
+      top - (std::floor((top - options.y) / cell_size) + 0.5) * cell_size;
+  auto ground = collection.height_at(centre_x, centre_y, chunk);
+  if (!ground) {
+    return std::nullopt;
+  }
+  auto eye = double(*ground) + options.observer_height;
+
+  auto n = std::max(1, int(std::ceil(options.radius / cell_size)));
+  auto grid = viewshed_grid{};
+  grid.cell_size = cell_size;
+  grid.ncols = grid.nrows = 2 * n + 1;
+  grid.x = centre_x - (n + 0.5) * cell_size;
+  grid.y = centre_y + (n + 0.5) * cell_size;
+  grid.cells.assign(size_t(grid.ncols) * grid.nrows, 0);
+  grid.cells[n + size_t(n) * grid.ncols] = reached | seen;
+
+  // Every cell on the square's edge, clockwise from the top left
+  auto perimeter = [n](int p) {
+    auto side = p / (2 * n);
+    auto t = p % (2 * n);
+    switch (side) {
+    case 0:
+      return std::pair{-n + t, -n};
+    case 1:
+      return std::pair{n, -n + t};
+    case 2:
+      return std::pair{n - t, n};
+    default:
+      return std::pair{-n, n - t};
+    }
+  };
+
+  auto radius2 = double(options.radius) * options.radius;
+  auto step = [&](int px, int py, int k, double &horizon,
+                  chunks::ChunkCursor &cursor) {
+    auto ci = int(std::lround(double(px) * k / n));
+    auto cj = int(std::lround(double(py) * k / n));
+    auto d2 = (double(ci) * ci + double(cj) * cj) * cell_size * cell_size;
+    if (d2 > radius2) {
+      return;
+    }
+    auto height =
+        cursor.height_at(centre_x + ci * cell_size, centre_y - cj * cell_size);
+    if (!height) {
+      return;
+    }
+
+    auto d = std::sqrt(d2);
+    auto drop = options.curvature ? d2 / effective_earth_diameter : 0.0;
+    auto terrain = (*height - drop - eye) / d;
+    auto target = terrain + options.target_height / d;
+    auto &cell = grid.cells[(n + ci) + size_t(n + cj) * grid.ncols];
+    mark(cell, target >= horizon ? reached | seen : reached);
+    horizon = std::max(horizon, terrain);
+  };
+
+  // A sector's rays are stepped out together, a ring at a time, so the
+  // cells and heights they read are next to each other in memory rather
+  // than a row apart
+  jobs::job_system().parallel_for(
+      0, 8 * n, 64, [&](size_t begin, size_t end) {
+        auto cursor = chunks::ChunkCursor{collection};
+        auto ends = std::vector<std::pair<int, int>>{};
+        for (auto p = begin; p < end; p++) {
+          ends.push_back(perimeter(int(p)));
+        }
+        auto horizons = std::vector<double>(
+            ends.size(), -std::numeric_limits<double>::infinity());
+        for (int k = 1; k <= n; k++) {
+          for (size_t r = 0; r < ends.size(); r++) {
+            step(ends[r].first, ends[r].second, k, horizons[r], cursor);
+          }
+        }
+      });
+
+  for (auto &cell : grid.cells) {
+    if (cell & seen) {
+      cell = viewshed_grid::visible;
+      grid.visible_count++;
+    } else if (cell & reached) {
+      cell = viewshed_grid::hidden;
+      grid.hidden_count++;
+    } else {
+      cell = viewshed_grid::nodata;
+    }
+  }
+  return grid;
+}
+
+} // namespace siliconia::analysis
@@ -0,0 +1,54 @@
+#ifndef SILICONIA_VIEWSHED_HPP
+#define SILICONIA_VIEWSHED_HPP
+
+#include <chunks/chunk_collection.hpp>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace siliconia::analysis {
+
+struct viewshed_options {
+  // In the same coordinates as ChunkCollection::rect
+  double x = 0, y = 0;
+  // Above the ground at the observer and at every target
+  float observer_height = 10.f;
+  float target_height = 0.f;
+  // In map units
+  float radius = 5000.f;
+  // Drops distant terrain by the earth's curvature, less standard
+  // atmospheric refraction
+  bool curvature = true;
+};
+
+// A square of cells centred on the observer, aligned to the tiles' cells,
+// with rows running down as in a tile
+struct viewshed_grid {
+  static constexpr uint8_t hidden = 0;
+  static constexpr uint8_t visible = 1;
+  // Outside the radius or without data
+  static constexpr uint8_t nodata = 255;
+
+  // Top left corner
+  double x = 0, y = 0;
+  double cell_size = 1;
+  unsigned int ncols = 0, nrows = 0;
+  std::vector<uint8_t> cells;
+  size_t visible_count = 0;
+  size_t hidden_count = 0;
+
+  // The cell containing a point, nodata outside the grid
+  uint8_t at(double map_x, double map_y) const;
+};
+
+// Casts a ray to every cell on the edge of the square, in sectors on the
+// job system, keeping the steepest horizon along each (the R2 algorithm).
+// Heights are read from whichever tile each ray has reached. Nothing if the
+// observer isn't over data.
+std::optional<viewshed_grid> compute_viewshed(
+    const chunks::ChunkCollection &collection,
+    const viewshed_options &options);
+
+} // namespace siliconia::analysis
+
+#endif // SILICONIA_VIEWSHED_HPP
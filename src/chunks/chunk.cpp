@@ -1,4 +1,5 @@
 #include "chunk.hpp"
+#include "profiling/startup_timeline.hpp"
 #include <algorithm>
 #include <charconv>
 #include <fstream>
@@ -97,8 +98,38 @@ float range::size() const
   return max-min;
 }
 
-Chunk::Chunk(const std::string &path)
-  : cell_size(0)
+Chunk::Chunk(const std::string &path) : Chunk(path, false)
+{
+}
+
+Chunk::Chunk(std::string path, unsigned int ncols, unsigned int nrows,
+    unsigned int xllcorner, unsigned int yllcorner, unsigned int cell_size,
+    float nodata_value, std::vector<float> data)
+  : path(std::move(path))
+  , range()
+  , cell_size(cell_size)
+  , nrows(nrows)
+  , ncols(ncols)
+  , xllcorner(xllcorner)
+  , yllcorner(yllcorner)
+  , data(std::move(data))
+  , nodata_value(nodata_value)
+{
+  for (auto v : this->data) {
+    if (v != nodata_value) {
+      range.extend(v);
+    }
+  }
+}
+
+Chunk Chunk::read_header(const std::string &path)
+{
+  return Chunk{path, true};
+}
+
+Chunk::Chunk(const std::string &path, bool header_only)
+  : path(path)
+  , cell_size(0)
   , nrows(0)
   , ncols(0)
   , xllcorner(0)
@@ -107,6 +138,20 @@ Chunk::Chunk(const std::string &path)
   , range()
   , nodata_value(std::numeric_limits<float>::min())
 {
+  if (header_only) {
+    auto stream = std::ifstream{path.c_str(), std::ios::binary};
+    auto line = std::string{};
+    auto n = 1;
+    while (std::getline(stream, line) && parse_header(path, n, line)) {
+      n++;
+    }
+    if (nrows == 0 || ncols == 0 || cell_size == 0) {
+      throw asc_parse_exception{path, n, "Didn't get all expected values"};
+    }
+    return;
+  }
+
+  auto phase = profiling::startup_timeline().phase("Parse tile", path);
   std::cout << "Parsing " << path << std::endl;
   auto stream = std::ifstream{path.c_str(), std::ios::binary | std::ios::ate};
   auto size = stream.tellg();
@@ -51,9 +51,17 @@ public:
 class Chunk {
 public:
   explicit Chunk(const std::string &path);
+  // Made in memory rather than parsed, as a reduced level or a cached tile
+  Chunk(std::string path, unsigned int ncols, unsigned int nrows,
+      unsigned int xllcorner, unsigned int yllcorner, unsigned int cell_size,
+      float nodata_value, std::vector<float> data);
+
+  // Only reads as far as the end of the header, leaving data empty
+  static Chunk read_header(const std::string &path);
 
   rect rect() const;
 
+  std::string path;
   range range;
   unsigned int cell_size;
   unsigned int nrows;
@@ -64,6 +72,8 @@ public:
   float nodata_value;
 
 private:
+  Chunk(const std::string &path, bool header_only);
+
   bool parse_header(const std::string &path, int n, std::string_view sv);
   void parse_numbers(const std::string &path, int n, std::string_view line);
 
@@ -1,27 +1,189 @@
 #include "chunk_collection.hpp"
+#include "jobs/job_system.hpp"
+#include "profiling/startup_timeline.hpp"
+#include <algorithm>
+#include <cmath>
 #include <filesystem>
+#include <optional>
 
 namespace siliconia::chunks {
 
+namespace {
+
+uint64_t grid_key(int64_t column, int64_t row)
+{
+  return uint64_t(column) << 32 ^ uint32_t(row);
+}
+
+} // namespace
+
+ChunkCollection::ChunkCollection() : rect(0, 0, 0, 0), chunks_()
+{
+}
+
 ChunkCollection::ChunkCollection(const std::string &path)
-  : rect(0, 0, 0, 0), chunks_()
+  : ChunkCollection(scan(path))
 {
-  auto first = true;
-  for (const auto &p : std::filesystem::directory_iterator{path}) {
-    auto chunk = Chunk{p.path().string()};
-    if (first) {
-      first = false;
-      rect = chunk.rect();
+  auto phase = profiling::startup_timeline().phase("Load chunks", path);
+  // Parsed out of order, but added in order so the collection is the same
+  // from run to run
+  auto loaded = std::vector<std::optional<Chunk>>(headers_.size());
+  jobs::job_system().parallel_for(0, loaded.size(), 1, [&](size_t b, size_t e) {
+    for (auto i = b; i < e; i++) {
+      loaded[i].emplace(headers_[i].path);
+    }
+  });
+  for (auto &chunk : loaded) {
+    add(std::move(*chunk));
+  }
+}
+
+ChunkCollection::ChunkCollection(std::vector<Chunk> headers)
+  : ChunkCollection()
+{
+  for (size_t i = 0; i < headers.size(); i++) {
+    if (i == 0) {
+      rect = headers[i].rect();
     } else {
-      rect |= chunk.rect();
+      rect |= headers[i].rect();
     }
-    range |= chunk.range;
-    chunks_.push_back(std::move(chunk));
   }
+  headers_ = std::move(headers);
 }
+
+ChunkCollection ChunkCollection::scan(const std::string &path)
+{
+  auto phase = profiling::startup_timeline().phase("Scan directory", path);
+
+  auto paths = std::vector<std::string>{};
+  for (const auto &p : std::filesystem::directory_iterator{path}) {
+    paths.push_back(p.path().string());
+  }
+  // Directory order is up to the filesystem
+  std::sort(paths.begin(), paths.end());
+
+  auto headers = std::vector<std::optional<Chunk>>(paths.size());
+  jobs::job_system().parallel_for(0, paths.size(), 0, [&](size_t b, size_t e) {
+    for (auto i = b; i < e; i++) {
+      headers[i] = Chunk::read_header(paths[i]);
+    }
+  });
+
+  auto read = std::vector<Chunk>{};
+  for (auto &header : headers) {
+    read.push_back(std::move(*header));
+  }
+  return ChunkCollection{std::move(read)};
+}
+
+void ChunkCollection::add(Chunk &&chunk)
+{
+  auto r = chunk.rect();
+  if (chunks_.empty()) {
+    grid_x_ = r.x;
+    grid_y_ = r.y;
+    grid_width_ = std::max(1u, r.width);
+    grid_height_ = std::max(1u, r.height);
+  }
+  // Into every grid cell it overlaps, in case it isn't the first's size
+  auto first_column = int64_t(std::floor((r.x - grid_x_) / grid_width_));
+  auto last_column = int64_t(
+      std::ceil((r.x + double(r.width) - grid_x_) / grid_width_));
+  auto first_row = int64_t(std::floor((r.y - grid_y_) / grid_height_));
+  auto last_row = int64_t(
+      std::ceil((r.y + double(r.height) - grid_y_) / grid_height_));
+  for (auto column = first_column; column < last_column; column++) {
+    for (auto row = first_row; row < last_row; row++) {
+      grid_[grid_key(column, row)].push_back(chunks_.size());
+    }
+  }
+
+  range |= chunk.range;
+  chunks_.push_back(std::move(chunk));
+}
+
+const std::vector<Chunk> &ChunkCollection::headers() const
+{
+  return headers_;
+}
+
 const std::vector<Chunk> &ChunkCollection::chunks() const
 {
   return chunks_;
 }
 
-} // namespace siliconia::chunks
\ No newline at end of file
+const Chunk *ChunkCollection::chunk_at(
+    double x, double y, const Chunk *hint) const
+{
+  auto contains = [&](const Chunk &chunk) {
+    auto r = chunk.rect();
+    return x >= r.x && x < r.x + double(r.width) && y >= r.y &&
+           y < r.y + double(r.height);
+  };
+  if (hint && contains(*hint)) {
+    return hint;
+  }
+  auto column = int64_t(std::floor((x - grid_x_) / grid_width_));
+  auto row = int64_t(std::floor((y - grid_y_) / grid_height_));
+  auto cell = grid_.find(grid_key(column, row));
+  if (cell == grid_.end()) {
+    return nullptr;
+  }
+  for (auto i : cell->second) {
+    if (contains(chunks_[i])) {
+      return &chunks_[i];
+    }
+  }
+  return nullptr;
+}
+
+std::optional<float> ChunkCollection::height_at(
+    double x, double y, const Chunk *hint) const
+{
+  const auto *chunk = chunk_at(x, y, hint);
+  if (!chunk) {
+    return std::nullopt;
+  }
+
+  // Rows run down from the top of the tile
+  auto r = chunk->rect();
+  auto col = std::min<unsigned int>(
+      chunk->ncols - 1, (x - r.x) / chunk->cell_size);
+  auto row = std::min<unsigned int>(
+      chunk->nrows - 1, (r.y + double(r.height) - y) / chunk->cell_size);
+  auto v = chunk->data[col + row * chunk->ncols];
+  if (v == chunk->nodata_value) {
+    return std::nullopt;
+  }
+  return v;
+}
+
+ChunkCursor::ChunkCursor(const ChunkCollection &collection)
+  : collection_(collection)
+{
+}
+
+std::optional<float> ChunkCursor::height_at(double x, double y)
+{
+  if (!chunk_ || x < left_ || x >= right_ || y < bottom_ || y >= top_) {
+    chunk_ = collection_.chunk_at(x, y, chunk_);
+    if (!chunk_) {
+      return std::nullopt;
+    }
+    auto r = chunk_->rect();
+    left_ = r.x;
+    right_ = r.x + double(r.width);
+    bottom_ = r.y;
+    top_ = r.y + double(r.height);
+    inv_cell_ = 1.0 / chunk_->cell_size;
+  }
+  auto col = std::min(chunk_->ncols - 1, unsigned((x - left_) * inv_cell_));
+  auto row = std::min(chunk_->nrows - 1, unsigned((top_ - y) * inv_cell_));
+  auto v = chunk_->data[col + size_t(row) * chunk_->ncols];
+  if (v == chunk_->nodata_value) {
+    return std::nullopt;
+  }
+  return v;
+}
+
+} // namespace siliconia::chunks
@@ -2,24 +2,73 @@
 #define SILICONIA_CHUNK_COLLECTION_HPP
 
 #include "chunk.hpp"
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace siliconia::chunks {
 
 class ChunkCollection {
 public:
+  // Parses every tile in the directory
   ChunkCollection(const std::string &path);
 
+  // From headers read elsewhere, with no tiles added yet
+  explicit ChunkCollection(std::vector<Chunk> headers);
+
+  // Only reads the tile headers, so the extent is known straight away but
+  // the tiles have to be added as they are parsed
+  static ChunkCollection scan(const std::string &path);
+
+  void add(Chunk &&chunk);
+
+  const std::vector<Chunk> &headers() const;
   const std::vector<Chunk> &chunks() const;
 
+  // The added tile containing the point, in the same coordinates as rect,
+  // found through a grid rather than a search. Neighbouring lookups usually
+  // land in the same tile, so the last result can be passed back as a hint
+  // to try first.
+  const Chunk *chunk_at(
+      double x, double y, const Chunk *hint = nullptr) const;
+  // The nearest cell, or nothing outside the tiles added so far or on a
+  // nodata cell
+  std::optional<float> height_at(
+      double x, double y, const Chunk *hint = nullptr) const;
+
   rect rect;
+  // Of the tiles added so far
   range range;
 
 private:
+  ChunkCollection();
+
+  std::vector<Chunk> headers_;
   std::vector<Chunk> chunks_;
+  // Indices of the added tiles over each cell of a grid laid out from the
+  // first tile, which all others are usually the size of and aligned to
+  std::unordered_map<uint64_t, std::vector<size_t>> grid_;
+  double grid_x_ = 0, grid_y_ = 0, grid_width_ = 1, grid_height_ = 1;
+};
+
+// For many lookups close together, as along a line: stays in the last
+// tile until a point leaves it, only then searching the collection
+class ChunkCursor {
+public:
+  explicit ChunkCursor(const ChunkCollection &collection);
+
+  // As ChunkCollection::height_at
+  std::optional<float> height_at(double x, double y);
+
+private:
+  const ChunkCollection &collection_;
+  const Chunk *chunk_ = nullptr;
+  double left_ = 0, right_ = 0, bottom_ = 0, top_ = 0;
+  double inv_cell_ = 1;
 };
 
 } // namespace siliconia::chunks
 
-#endif
\ No newline at end of file
+#endif
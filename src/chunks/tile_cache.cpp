@@ -0,0 +1,304 @@
+#include "tile_cache.hpp"
+#include "profiling/profiler.hpp"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace siliconia::chunks {
+
+namespace {
+
+constexpr char magic[4] = {'S', 'L', 'T', 'C'};
+constexpr uint32_t version = 2;
+
+struct file_header {
+  char magic[4];
+  uint32_t version;
+  // Of the tile it was made from, to tell when it is out of date
+  uint64_t source_size;
+  int64_t source_time;
+  uint32_t ncols, nrows;
+  uint32_t xllcorner, yllcorner;
+  uint32_t cell_size;
+  float nodata_value;
+  // Including the tile itself
+  uint32_t levels;
+  // The largest holes filled, 0 for the tile as parsed
+  uint32_t filled_holes;
+};
+
+// Followed by one of these per level, then the cells
+struct level_entry {
+  uint32_t ncols, nrows;
+  uint32_t cell_size;
+  uint32_t padding;
+  // Of the mean, min and max cells. All the same for level 0.
+  uint64_t offsets[3];
+};
+
+struct source_stamp {
+  uint64_t size;
+  int64_t time;
+};
+
+std::optional<source_stamp> stamp(const std::string &path)
+{
+  auto error = std::error_code{};
+  auto size = std::filesystem::file_size(path, error);
+  if (error) {
+    return std::nullopt;
+  }
+  auto time = std::filesystem::last_write_time(path, error);
+  if (error) {
+    return std::nullopt;
+  }
+  return source_stamp{
+      uint64_t(size), int64_t(time.time_since_epoch().count())};
+}
+
+// The header, if the file is for this version and the same hole filling
+// and the tile hasn't changed
+std::optional<file_header> read_header(std::ifstream &file,
+    const std::string &tile_path, unsigned int filled_holes)
+{
+  auto header = file_header{};
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+      header.version != version || header.filled_holes != filled_holes) {
+    return std::nullopt;
+  }
+  auto source = stamp(tile_path);
+  if (!source || source->size != header.source_size ||
+      source->time != header.source_time) {
+    return std::nullopt;
+  }
+  return header;
+}
+
+// Whether the level's cells lie within a file of the size, so a corrupt
+// table can't have them read from past its end or allocated unbounded
+bool fits(const level_entry &entry, uint64_t file_size)
+{
+  auto bytes = uint64_t(entry.ncols) * entry.nrows * sizeof(float);
+  for (auto offset : entry.offsets) {
+    if (offset > file_size || bytes > file_size - offset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Of the file opened, which a writer may have renamed another over since
+// it was, leaving it where it was
+uint64_t opened_size(std::ifstream &file)
+{
+  auto position = file.tellg();
+  file.seekg(0, std::ios::end);
+  auto size = uint64_t(file.tellg());
+  file.seekg(position);
+  return size;
+}
+
+bool table_fits(const file_header &header, uint64_t file_size)
+{
+  return header.levels > 0 &&
+         uint64_t(header.levels) * sizeof(level_entry) <=
+             file_size - sizeof(file_header);
+}
+
+// The full resolution level must be the tile the header describes
+bool matches(const level_entry &entry, const file_header &header)
+{
+  return entry.ncols == header.ncols && entry.nrows == header.nrows &&
+         entry.cell_size == header.cell_size;
+}
+
+std::optional<level_entry> read_entry(std::ifstream &file,
+    const file_header &header, unsigned int level, uint64_t file_size)
+{
+  if (level >= header.levels || !table_fits(header, file_size)) {
+    return std::nullopt;
+  }
+  auto entry = level_entry{};
+  file.seekg(sizeof(file_header) + level * sizeof(level_entry));
+  if (!file.read(reinterpret_cast<char *>(&entry), sizeof(entry)) ||
+      !fits(entry, file_size) || (level == 0 && !matches(entry, header))) {
+    return std::nullopt;
+  }
+  return entry;
+}
+
+std::optional<Chunk> read_cells(std::ifstream &file,
+    const std::string &tile_path, const file_header &header,
+    const level_entry &entry, reduction r)
+{
+  auto data = std::vector<float>(size_t(entry.ncols) * entry.nrows);
+  file.seekg(entry.offsets[int(r)]);
+  if (!file.read(reinterpret_cast<char *>(data.data()),
+          data.size() * sizeof(float))) {
+    return std::nullopt;
+  }
+  return Chunk{tile_path, entry.ncols, entry.nrows, header.xllcorner,
+      header.yllcorner, entry.cell_size, header.nodata_value,
+      std::move(data)};
+}
+
+} // namespace
+
+TileCache::TileCache(const std::string &dir, unsigned int filled_holes)
+  : dir_(dir), filled_holes_(filled_holes)
+{
+  std::filesystem::create_directories(dir_);
+}
+
+bool TileCache::valid() const
+{
+  return !dir_.empty();
+}
+
+bool TileCache::contains(const std::string &tile_path) const
+{
+  auto file = std::ifstream{file_for(tile_path), std::ios::binary};
+  return file && read_header(file, tile_path, filled_holes_);
+}
+
+bool TileCache::write(const Chunk &chunk, const tile_pyramid &pyramid) const
+{
+  auto zone = profiling::Zone{"Write tile cache", chunk.path};
+  auto source = stamp(chunk.path);
+  if (!source) {
+    return false;
+  }
+
+  auto header = file_header{};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = version;
+  header.source_size = source->size;
+  header.source_time = source->time;
+  header.ncols = chunk.ncols;
+  header.nrows = chunk.nrows;
+  header.xllcorner = chunk.xllcorner;
+  header.yllcorner = chunk.yllcorner;
+  header.cell_size = chunk.cell_size;
+  header.nodata_value = chunk.nodata_value;
+  header.levels = pyramid.levels() + 1;
+  header.filled_holes = filled_holes_;
+
+  // Cells follow the table in level order, mean then min then max
+  auto entries = std::vector<level_entry>(header.levels);
+  auto offset = uint64_t(sizeof(file_header)) +
+                entries.size() * sizeof(level_entry);
+  auto arrays = std::vector<const std::vector<float> *>{&chunk.data};
+  entries[0] = {chunk.ncols, chunk.nrows, chunk.cell_size, 0,
+      {offset, offset, offset}};
+  offset += chunk.data.size() * sizeof(float);
+  for (unsigned int l = 1; l < header.levels; l++) {
+    auto &entry = entries[l];
+    const auto &mean = pyramid.level(chunk, l, reduction::mean);
+    entry = {mean.ncols, mean.nrows, mean.cell_size, 0, {}};
+    for (auto r : {reduction::mean, reduction::min, reduction::max}) {
+      const auto &level = pyramid.level(chunk, l, r);
+      entry.offsets[int(r)] = offset;
+      arrays.push_back(&level.data);
+      offset += level.data.size() * sizeof(float);
+    }
+  }
+
+  auto path = file_for(chunk.path);
+  auto temporary = path + ".tmp";
+  {
+    auto file = std::ofstream{temporary, std::ios::binary};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(entries.data()),
+        entries.size() * sizeof(level_entry));
+    for (const auto *array : arrays) {
+      file.write(reinterpret_cast<const char *>(array->data()),
+          array->size() * sizeof(float));
+    }
+    if (!file) {
+      return false;
+    }
+  }
+  auto error = std::error_code{};
+  std::filesystem::rename(temporary, path, error);
+  return !error;
+}
+
+std::optional<Chunk> TileCache::read_level(
+    const std::string &tile_path, unsigned int level, reduction r) const
+{
+  auto zone = profiling::Zone{"Read tile cache level", tile_path};
+  auto file = std::ifstream{file_for(tile_path), std::ios::binary};
+  auto header =
+      file ? read_header(file, tile_path, filled_holes_) : std::nullopt;
+  if (!header) {
+    return std::nullopt;
+  }
+  auto entry = read_entry(file, *header, level, opened_size(file));
+  if (!entry) {
+    return std::nullopt;
+  }
+  return read_cells(file, tile_path, *header, *entry, r);
+}
+
+std::optional<std::pair<Chunk, tile_pyramid>> TileCache::read(
+    const std::string &tile_path) const
+{
+  auto zone = profiling::Zone{"Read tile cache", tile_path};
+  auto file = std::ifstream{file_for(tile_path), std::ios::binary};
+  auto header =
+      file ? read_header(file, tile_path, filled_holes_) : std::nullopt;
+  if (!header) {
+    return std::nullopt;
+  }
+  // Checked against the file before anything is allocated from them
+  auto file_size = opened_size(file);
+  if (!table_fits(*header, file_size)) {
+    return std::nullopt;
+  }
+  auto entries = std::vector<level_entry>(header->levels);
+  if (!file.read(reinterpret_cast<char *>(entries.data()),
+          entries.size() * sizeof(level_entry)) ||
+      !matches(entries[0], *header)) {
+    return std::nullopt;
+  }
+  for (const auto &entry : entries) {
+    if (!fits(entry, file_size)) {
+      return std::nullopt;
+    }
+  }
+  auto tile = read_cells(file, tile_path, *header, entries[0],
+      reduction::mean);
+  if (!tile) {
+    return std::nullopt;
+  }
+  auto pyramid = tile_pyramid{};
+  for (size_t l = 1; l < entries.size(); l++) {
+    auto mean = read_cells(file, tile_path, *header, entries[l],
+        reduction::mean);
+    auto min = read_cells(file, tile_path, *header, entries[l],
+        reduction::min);
+    auto max = read_cells(file, tile_path, *header, entries[l],
+        reduction::max);
+    if (!mean || !min || !max) {
+      return std::nullopt;
+    }
+    pyramid.mean.push_back(std::move(*mean));
+    pyramid.min.push_back(std::move(*min));
+    pyramid.max.push_back(std::move(*max));
+  }
+  return std::pair{std::move(*tile), std::move(pyramid)};
+}
+
+std::string TileCache::file_for(const std::string &tile_path) const
+{
+  auto stem = std::filesystem::path{tile_path}.stem().string();
+  if (filled_holes_ > 0) {
+    stem += "_filled" + std::to_string(filled_holes_);
+  }
+  return (std::filesystem::path{dir_} / (stem + ".tile")).string();
+}
+
+} // namespace siliconia::chunks
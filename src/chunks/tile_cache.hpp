@@ -0,0 +1,51 @@
+#ifndef SILICONIA_TILE_CACHE_HPP
+#define SILICONIA_TILE_CACHE_HPP
+
+#include "chunk.hpp"
+#include "tile_pyramid.hpp"
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace siliconia::chunks {
+
+// Parsed tiles and their reduced levels, one binary file per tile in a
+// directory, so later runs skip the ASCII parse. A level can be read on its
+// own, without the full resolution cells before it. Files are in the
+// machine's byte order, as they are only a cache.
+class TileCache {
+public:
+  TileCache() = default;
+  // Creates the directory if need be. Tiles whose holes were filled up to
+  // a size are kept apart from the raw tiles, and from other sizes.
+  explicit TileCache(const std::string &dir, unsigned int filled_holes = 0);
+
+  bool valid() const;
+
+  // Whether the tile has a file written since the tile last changed
+  bool contains(const std::string &tile_path) const;
+
+  // Written to a temporary file and renamed over the old one, so loaders
+  // reading at the same time see one or the other
+  bool write(const Chunk &chunk, const tile_pyramid &pyramid) const;
+
+  // Only the header and the cells of the level, nothing if the file is
+  // missing, out of date, has fewer levels or the level's cells aren't all
+  // in it
+  std::optional<Chunk> read_level(const std::string &tile_path,
+      unsigned int level, reduction r = reduction::mean) const;
+  // The tile and all its levels, nothing if the file is missing, out of
+  // date, truncated or otherwise not one written here
+  std::optional<std::pair<Chunk, tile_pyramid>> read(
+      const std::string &tile_path) const;
+
+private:
+  std::string file_for(const std::string &tile_path) const;
+
+  std::string dir_;
+  unsigned int filled_holes_ = 0;
+};
+
+} // namespace siliconia::chunks
+
+#endif // SILICONIA_TILE_CACHE_HPP
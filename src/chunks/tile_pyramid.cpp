@@ -0,0 +1,95 @@
+#include "tile_pyramid.hpp"
+#include "profiling/profiler.hpp"
+#include <algorithm>
+
+namespace siliconia::chunks {
+
+unsigned int tile_pyramid::levels() const
+{
+  return mean.size();
+}
+
+const Chunk &tile_pyramid::level(
+    const Chunk &tile, unsigned int level, reduction r) const
+{
+  if (level == 0) {
+    return tile;
+  }
+  const auto &levels = r == reduction::mean ? mean
+                       : r == reduction::min ? min
+                                             : max;
+  return levels[level - 1];
+}
+
+tile_pyramid build_pyramid(const Chunk &chunk)
+{
+  auto zone = profiling::Zone{"Tile pyramid", chunk.path};
+  auto pyramid = tile_pyramid{};
+  auto nodata = chunk.nodata_value;
+
+  // The mean of means is weighted by how many cells with data each covers,
+  // so it is the mean of the full resolution cells however gaps fall
+  auto w = chunk.ncols;
+  auto h = chunk.nrows;
+  auto cell_size = chunk.cell_size;
+  auto counts = std::vector<uint32_t>(size_t(w) * h);
+  for (size_t k = 0; k < counts.size(); k++) {
+    counts[k] = chunk.data[k] != nodata;
+  }
+  const auto *mean = &chunk.data;
+  const auto *min = &chunk.data;
+  const auto *max = &chunk.data;
+
+  while (w > 1 || h > 1) {
+    auto rw = (w + 1) / 2;
+    auto rh = (h + 1) / 2;
+    auto next_mean = std::vector<float>(size_t(rw) * rh, nodata);
+    auto next_min = next_mean;
+    auto next_max = next_mean;
+    auto next_counts = std::vector<uint32_t>(size_t(rw) * rh);
+    for (unsigned int j = 0; j < rh; j++) {
+      for (unsigned int i = 0; i < rw; i++) {
+        auto sum = 0.0;
+        auto count = uint32_t{0};
+        auto lo = 0.f, hi = 0.f;
+        for (auto cj = 2 * j; cj < std::min(2 * j + 2, h); cj++) {
+          for (auto ci = 2 * i; ci < std::min(2 * i + 2, w); ci++) {
+            auto k = ci + size_t(cj) * w;
+            if (counts[k] == 0) {
+              continue;
+            }
+            lo = count ? std::min(lo, (*min)[k]) : (*min)[k];
+            hi = count ? std::max(hi, (*max)[k]) : (*max)[k];
+            sum += double((*mean)[k]) * counts[k];
+            count += counts[k];
+          }
+        }
+        if (count > 0) {
+          auto k = i + size_t(j) * rw;
+          next_mean[k] = float(sum / count);
+          next_min[k] = lo;
+          next_max[k] = hi;
+          next_counts[k] = count;
+        }
+      }
+    }
+
+    w = rw;
+    h = rh;
+    cell_size *= 2;
+    auto level = [&](std::vector<float> &&data) {
+      return Chunk{chunk.path, w, h, chunk.xllcorner, chunk.yllcorner,
+          cell_size, nodata, std::move(data)};
+    };
+    pyramid.mean.push_back(level(std::move(next_mean)));
+    pyramid.min.push_back(level(std::move(next_min)));
+    pyramid.max.push_back(level(std::move(next_max)));
+    mean = &pyramid.mean.back().data;
+    min = &pyramid.min.back().data;
+    max = &pyramid.max.back().data;
+    counts = std::move(next_counts);
+  }
+  return pyramid;
+}
+
+} // namespace siliconia::chunks
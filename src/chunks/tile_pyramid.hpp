@@ -0,0 +1,30 @@
+#ifndef SILICONIA_TILE_PYRAMID_HPP
+#define SILICONIA_TILE_PYRAMID_HPP
+
+#include "chunk.hpp"
+#include <vector>
+
+namespace siliconia::chunks {
+
+enum class reduction { mean, min, max };
+
+// Levels 1 and up of a tile, each with half the cells of the one before
+// along each side (rounding up) at twice the cell size, keeping the tile's
+// top left corner. A reduced cell is the mean, min or max of the full
+// resolution cells under it that have data, and nodata only if none do.
+struct tile_pyramid {
+  std::vector<Chunk> mean, min, max;
+
+  // Not counting the tile itself
+  unsigned int levels() const;
+  // Level 0 is the tile itself
+  const Chunk &level(
+      const Chunk &tile, unsigned int level, reduction r) const;
+};
+
+// Down to a single cell
+tile_pyramid build_pyramid(const Chunk &chunk);
+
+} // namespace siliconia::chunks
+
+#endif // SILICONIA_TILE_PYRAMID_HPP
@@ -18,6 +18,11 @@ glm::mat4 camera::matrix() const
   return glm::lookAt(pos_, pos_ + dir_, up_);
 }
 
+glm::mat4 camera::projection(float far_plane) const
+{
+  return glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, far_plane);
+}
+
 void camera::handle_input(const SDL_Event &e)
 {
 #define HANDLE(sdl_key, dir)                                                   \
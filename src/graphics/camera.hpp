@@ -13,6 +13,9 @@ public:
   void handle_input(const SDL_Event &e);
   void update(float elapsed_s);
   glm::mat4 matrix() const;
+  // With a [0, 1] depth range. Views that only need to reach so far, such
+  // as the prefetcher's, can bring the far plane in.
+  glm::mat4 projection(float far_plane = 10000000000.0f) const;
 
   const glm::vec3 &pos() const;
   const glm::vec3 &dir() const;
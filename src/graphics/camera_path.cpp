@@ -0,0 +1,90 @@
+#include "camera_path.hpp"
+#include <fstream>
+#include <iomanip>
+#include <limits>
+
+namespace siliconia::graphics {
+
+namespace {
+
+const char *header = "siliconia-camera-path 1";
+
+std::ostream &operator<<(std::ostream &os, const glm::vec3 &v)
+{
+  return os << v.x << " " << v.y << " " << v.z;
+}
+
+std::istream &operator>>(std::istream &is, glm::vec3 &v)
+{
+  return is >> v.x >> v.y >> v.z;
+}
+
+} // namespace
+
+void CameraPath::record(const camera &cam)
+{
+  frames_.push_back({cam.pos(), cam.dir(), cam.up(), cam.speed()});
+}
+
+void CameraPath::apply(size_t frame, camera &cam) const
+{
+  const auto &k = frames_[frame];
+  cam.set_pos(k.pos);
+  cam.set_dir(k.dir);
+  cam.set_up(k.up);
+  cam.set_speed(k.speed);
+}
+
+void CameraPath::clear()
+{
+  frames_.clear();
+}
+
+size_t CameraPath::size() const
+{
+  return frames_.size();
+}
+
+bool CameraPath::empty() const
+{
+  return frames_.empty();
+}
+
+bool CameraPath::save(const std::string &path) const
+{
+  auto file = std::ofstream{path};
+  if (!file) {
+    return false;
+  }
+
+  // Enough digits that a float survives the round trip unchanged
+  file << std::setprecision(std::numeric_limits<float>::max_digits10);
+  file << header << "\n";
+  for (const auto &k : frames_) {
+    file << k.pos << " " << k.dir << " " << k.up << " " << k.speed << "\n";
+  }
+  return static_cast<bool>(file);
+}
+
+bool CameraPath::load(const std::string &path)
+{
+  auto file = std::ifstream{path};
+  auto line = std::string{};
+  if (!std::getline(file, line) || line != header) {
+    return false;
+  }
+
+  auto frames = std::vector<keyframe>{};
+  auto k = keyframe{};
+  while (file >> k.pos >> k.dir >> k.up >> k.speed) {
+    frames.push_back(k);
+  }
+  if (!file.eof()) {
+    return false;
+  }
+
+  frames_ = std::move(frames);
+  return true;
+}
+
+} // namespace siliconia::graphics
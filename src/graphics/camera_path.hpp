@@ -0,0 +1,39 @@
+#ifndef SILICONIA_CAMERA_PATH_HPP
+#define SILICONIA_CAMERA_PATH_HPP
+
+#include "camera.hpp"
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+namespace siliconia::graphics {
+
+// The camera state of each frame of a flythrough. Replaying sets the state
+// directly rather than simulating input, so a replay is the same no matter
+// how long the recorded frames took
+class CameraPath {
+public:
+  struct keyframe {
+    glm::vec3 pos;
+    glm::vec3 dir;
+    glm::vec3 up;
+    float speed;
+  };
+
+  void record(const camera &cam);
+  void apply(size_t frame, camera &cam) const;
+  void clear();
+
+  size_t size() const;
+  bool empty() const;
+
+  bool save(const std::string &path) const;
+  bool load(const std::string &path);
+
+private:
+  std::vector<keyframe> frames_;
+};
+
+} // namespace siliconia::graphics
+
+#endif // SILICONIA_CAMERA_PATH_HPP
@@ -0,0 +1,358 @@
+#include "clipmap.hpp"
+#include "profiling/profiler.hpp"
+#include <cmath>
+#include <cstring>
+#include <graphics/vk/helpers.hpp>
+#include <graphics/vk/init.hpp>
+#include <graphics/vk/pipeline_builder.hpp>
+#include <iostream>
+
+namespace siliconia::graphics {
+
+namespace {
+
+struct clipmap_push_constants {
+  glm::mat4 view_proj;
+  glm::ivec2 origin;
+  int32_t level;
+  int32_t size;
+  float spacing;
+  float height_min;
+  float height_max;
+  float padding;
+};
+
+int wrap(int n, int size)
+{
+  return ((n % size) + size) % size;
+}
+
+} // namespace
+
+Clipmap::Clipmap(VkDevice device, VmaAllocator allocator,
+    VkDescriptorPool pool, VkPipelineCache cache, VkRenderPass pass,
+    VkExtent2D extent, uint32_t levels, uint32_t size)
+  : device_(device)
+  , allocator_(allocator)
+  , levels_(levels)
+  , size_(size)
+  , origins_(levels)
+{
+  auto image_info = vk::image_create_info(VK_FORMAT_R32_SFLOAT,
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+      {size_, size_, 1});
+  image_info.arrayLayers = levels_;
+  auto image_alloc_info = VmaAllocationCreateInfo{};
+  image_alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+  VK_CHECK(vmaCreateImage(allocator_, &image_info, &image_alloc_info,
+      &image_.image, &image_.allocation, nullptr));
+
+  auto view_info = vk::image_view_create_info(
+      VK_FORMAT_R32_SFLOAT, image_.image, VK_IMAGE_ASPECT_COLOR_BIT);
+  view_info.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+  view_info.subresourceRange.layerCount = levels_;
+  VK_CHECK(vkCreateImageView(device_, &view_info, nullptr, &view_));
+
+  auto sampler_info = vk::sampler_create_info(VK_FILTER_NEAREST);
+  VK_CHECK(vkCreateSampler(device_, &sampler_info, nullptr, &sampler_));
+
+  auto buffer_info = VkBufferCreateInfo{};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = memory_bytes();
+  buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  auto buffer_alloc_info = VmaAllocationCreateInfo{};
+  buffer_alloc_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+  VK_CHECK(vmaCreateBuffer(allocator_, &buffer_info, &buffer_alloc_info,
+      &staging_buffer_.buffer, &staging_buffer_.allocation, nullptr));
+  void *data;
+  vmaMapMemory(allocator_, staging_buffer_.allocation, &data);
+  staging_ = static_cast<float *>(data);
+
+  // Vertices come from gl_VertexIndex, so only indices are stored. The
+  // next level in is snapped to a multiple of this level's spacing, so it
+  // sits one of two cells in from the quarter mark; only the cells it
+  // covers either way are left out of the ring, and the rest overlap.
+  auto n = size_;
+  auto hole_min = n / 4 + 1;
+  auto hole_max = 3 * n / 4 - 1;
+  auto indices = std::vector<uint32_t>{};
+  auto add_cells = [&](bool ring) {
+    for (uint32_t j = 0; j < n - 1; j++) {
+      for (uint32_t i = 0; i < n - 1; i++) {
+        if (ring && i >= hole_min && i < hole_max && j >= hole_min &&
+            j < hole_max) {
+          continue;
+        }
+        indices.insert(indices.end(),
+            {i + j * n, (i + 1) + j * n, i + (j + 1) * n, (i + 1) + j * n,
+                (i + 1) + (j + 1) * n, i + (j + 1) * n});
+      }
+    }
+  };
+  add_cells(false);
+  full_index_count_ = indices.size();
+  add_cells(true);
+  ring_index_count_ = indices.size() - full_index_count_;
+
+  buffer_info.size = indices.size() * sizeof(uint32_t);
+  buffer_info.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+  buffer_alloc_info.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+  VK_CHECK(vmaCreateBuffer(allocator_, &buffer_info, &buffer_alloc_info,
+      &index_buffer_.buffer, &index_buffer_.allocation, nullptr));
+  vmaMapMemory(allocator_, index_buffer_.allocation, &data);
+  memcpy(data, indices.data(), indices.size() * sizeof(uint32_t));
+  vmaUnmapMemory(allocator_, index_buffer_.allocation);
+
+  auto binding = vk::descriptor_set_layout_binding(
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_VERTEX_BIT,
+      0);
+  auto set_info = VkDescriptorSetLayoutCreateInfo{};
+  set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_info.bindingCount = 1;
+  set_info.pBindings = &binding;
+  VK_CHECK(
+      vkCreateDescriptorSetLayout(device_, &set_info, nullptr, &set_layout_));
+
+  auto alloc_info = VkDescriptorSetAllocateInfo{};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = pool;
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts = &set_layout_;
+  VK_CHECK(vkAllocateDescriptorSets(device_, &alloc_info, &set_));
+
+  auto image_desc = VkDescriptorImageInfo{
+      sampler_, view_, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+  auto write = vk::write_descriptor_image(
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set_, &image_desc, 0);
+  vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+
+  auto push_constant = VkPushConstantRange{};
+  push_constant.size = sizeof(clipmap_push_constants);
+  push_constant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  auto layout_info = vk::pipeline_layout_create_info();
+  layout_info.setLayoutCount = 1;
+  layout_info.pSetLayouts = &set_layout_;
+  layout_info.pushConstantRangeCount = 1;
+  layout_info.pPushConstantRanges = &push_constant;
+  VK_CHECK(vkCreatePipelineLayout(
+      device_, &layout_info, nullptr, &pipeline_layout_));
+
+  auto vertex = VkShaderModule{};
+  if (!vk::load_shader_module(
+          device_, "../shaders/clipmap.vert.spv", &vertex)) {
+    std::cout << "Could not load clipmap vert shader" << std::endl;
+  }
+  auto frag = VkShaderModule{};
+  if (!vk::load_shader_module(
+          device_, "../shaders/triangle.frag.spv", &frag)) {
+    std::cout << "Could not load frag shader" << std::endl;
+  }
+
+  auto builder = vk::PipelineBuilder{};
+  builder.shader_stages.push_back(vk::pipeline_shader_stage_create_info(
+      VK_SHADER_STAGE_VERTEX_BIT, vertex));
+  builder.shader_stages.push_back(vk::pipeline_shader_stage_create_info(
+      VK_SHADER_STAGE_FRAGMENT_BIT, frag));
+  builder.vertex_input_info = vk::vertex_input_state_create_info();
+  builder.assembly =
+      vk::input_assembly_state_create_info(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+
+  builder.viewport.x = 0.0f;
+  builder.viewport.y = 0.0f;
+  builder.viewport.width = (float)extent.width;
+  builder.viewport.height = (float)extent.height;
+  builder.viewport.minDepth = 0.0f;
+  builder.viewport.maxDepth = 1.0f;
+
+  builder.scissor.offset = {0, 0};
+  builder.scissor.extent = extent;
+
+  builder.rasteriser =
+      vk::rasterisation_state_create_info(VK_POLYGON_MODE_FILL);
+  builder.multisampling = vk::multisample_state_create_info();
+  builder.colour_blend_attachment = vk::colour_blend_attachment_state();
+  builder.depth_stencil =
+      vk::depth_stencil_create_info(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+  builder.layout = pipeline_layout_;
+  pipeline_ = builder.build_pipeline(device_, pass, cache);
+
+  vkDestroyShaderModule(device_, vertex, nullptr);
+  vkDestroyShaderModule(device_, frag, nullptr);
+}
+
+void Clipmap::invalidate()
+{
+  for (auto &origin : origins_) {
+    origin.reset();
+  }
+}
+
+void Clipmap::record_update(vk::CommandBufferGuard &cmd,
+    const glm::vec3 &centre, const HeightFn &height)
+{
+  auto zone = profiling::Zone{"Clipmap update"};
+  auto regions = std::vector<VkBufferImageCopy>{};
+  staging_used_ = 0;
+
+  auto n = int(size_);
+  for (uint32_t level = 0; level < levels_; level++) {
+    // Snapped to the next level's spacing, so each level stays inside the
+    // one around it
+    auto spacing = float(1u << level);
+    auto snapped =
+        glm::ivec2{int(std::floor(centre.x / (2 * spacing))) * 2,
+            int(std::floor(centre.z / (2 * spacing))) * 2};
+    auto origin = snapped - n / 2;
+
+    auto &previous = origins_[level];
+    // Past this the strips would add up to more than the whole level
+    auto delta = previous ? origin - *previous : glm::ivec2{n};
+    if (std::abs(delta.x) + std::abs(delta.y) >= n) {
+      add_update(level, {origin, {n, n}}, height, regions);
+    } else {
+      // Columns then rows that have scrolled in. The rows leave out the
+      // columns' corner, as copy regions mustn't overlap.
+      if (delta.x != 0) {
+        auto x = delta.x > 0 ? previous->x + n : origin.x;
+        add_update(level, {{x, origin.y}, {std::abs(delta.x), n}}, height,
+            regions);
+      }
+      if (delta.y != 0) {
+        auto x = delta.x > 0 ? origin.x : origin.x + std::abs(delta.x);
+        auto y = delta.y > 0 ? previous->y + n : origin.y;
+        add_update(level,
+            {{x, y}, {n - std::abs(delta.x), std::abs(delta.y)}}, height,
+            regions);
+      }
+    }
+    previous = origin;
+  }
+
+  updated_texels_ = staging_used_;
+  if (regions.empty()) {
+    return;
+  }
+
+  cmd.image_barrier(image_.image, VK_IMAGE_ASPECT_COLOR_BIT,
+      initialised_ ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                   : VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT);
+  cmd.copy_buffer_to_image(staging_buffer_.buffer, image_.image,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regions);
+  cmd.image_barrier(image_.image, VK_IMAGE_ASPECT_COLOR_BIT,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT);
+  initialised_ = true;
+}
+
+void Clipmap::record_draw(vk::RenderPassGuard &rp, const glm::mat4 &view_proj,
+    chunks::range colour_range)
+{
+  if (!initialised_) {
+    return;
+  }
+  rp.bind_pipeline(pipeline_);
+  rp.bind_descriptor_set(pipeline_layout_, set_);
+  rp.bind_index_buffer(index_buffer_.buffer);
+
+  // Finest first, so where rings overlap the finer level wins the depth
+  // test
+  for (uint32_t level = 0; level < levels_; level++) {
+    auto constants = clipmap_push_constants{};
+    constants.view_proj = view_proj;
+    constants.origin = *origins_[level];
+    constants.level = level;
+    constants.size = size_;
+    constants.spacing = float(1u << level);
+    constants.height_min = colour_range.min;
+    constants.height_max = colour_range.max;
+    rp.push_constants(pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT,
+        sizeof(constants), &constants);
+    if (level == 0) {
+      rp.draw_indexed(full_index_count_, 1, 0, 0, 0);
+    } else {
+      rp.draw_indexed(ring_index_count_, 1, full_index_count_, 0, 0);
+    }
+  }
+}
+
+uint32_t Clipmap::levels() const
+{
+  return levels_;
+}
+
+uint32_t Clipmap::size() const
+{
+  return size_;
+}
+
+size_t Clipmap::updated_texels() const
+{
+  return updated_texels_;
+}
+
+VkDeviceSize Clipmap::memory_bytes() const
+{
+  return VkDeviceSize{levels_} * size_ * size_ * sizeof(float);
+}
+
+void Clipmap::destroy()
+{
+  vkDestroyPipeline(device_, pipeline_, nullptr);
+  vkDestroyPipelineLayout(device_, pipeline_layout_, nullptr);
+  vkDestroyDescriptorSetLayout(device_, set_layout_, nullptr);
+  vkDestroySampler(device_, sampler_, nullptr);
+  vkDestroyImageView(device_, view_, nullptr);
+  vmaDestroyImage(allocator_, image_.image, image_.allocation);
+  vmaUnmapMemory(allocator_, staging_buffer_.allocation);
+  vmaDestroyBuffer(
+      allocator_, staging_buffer_.buffer, staging_buffer_.allocation);
+  vmaDestroyBuffer(allocator_, index_buffer_.buffer, index_buffer_.allocation);
+}
+
+void Clipmap::add_update(uint32_t level, grid_rect rect,
+    const HeightFn &height, std::vector<VkBufferImageCopy> &regions)
+{
+  // The rect can wrap around the edges of the texture, so it is copied in
+  // up to four pieces
+  auto n = int(size_);
+  auto spacing = float(1u << level);
+  auto x = rect.min.x;
+  while (x < rect.min.x + rect.extent.x) {
+    auto tx = wrap(x, n);
+    auto width = std::min(n - tx, rect.min.x + rect.extent.x - x);
+    auto z = rect.min.y;
+    while (z < rect.min.y + rect.extent.y) {
+      auto tz = wrap(z, n);
+      auto depth = std::min(n - tz, rect.min.y + rect.extent.y - z);
+
+      auto region = VkBufferImageCopy{};
+      region.bufferOffset = staging_used_ * sizeof(float);
+      region.bufferRowLength = width;
+      region.bufferImageHeight = depth;
+      region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.mipLevel = 0;
+      region.imageSubresource.baseArrayLayer = level;
+      region.imageSubresource.layerCount = 1;
+      region.imageOffset = {tx, tz, 0};
+      region.imageExtent = {uint32_t(width), uint32_t(depth), 1};
+      regions.push_back(region);
+
+      for (int j = 0; j < depth; j++) {
+        for (int i = 0; i < width; i++) {
+          staging_[staging_used_++] =
+              height((x + i) * spacing, (z + j) * spacing, level);
+        }
+      }
+      z += depth;
+    }
+    x += width;
+  }
+}
+
+} // namespace siliconia::graphics
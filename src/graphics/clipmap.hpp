@@ -0,0 +1,90 @@
+#ifndef SILICONIA_CLIPMAP_HPP
+#define SILICONIA_CLIPMAP_HPP
+
+#include <chunks/chunk.hpp>
+#include <functional>
+#include <glm/glm.hpp>
+#include <graphics/vk/command_buffer.hpp>
+#include <graphics/vk/types.hpp>
+#include <optional>
+#include <vector>
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+namespace siliconia::graphics {
+
+// Geometry clipmap terrain: nested square grids centred on the camera, each
+// with twice the spacing of the one inside it. Heights live in one texture
+// layer per level, addressed toroidally, so as the camera moves only the
+// rows and columns that scroll into view are sampled and uploaded. Memory
+// and draw cost depend on the level count and size, not the dataset.
+class Clipmap {
+public:
+  // Height at a point in world units, for a level whose samples are
+  // 2^level units apart, so coarse levels can read reduced heights
+  using HeightFn = std::function<float(float x, float z, uint32_t level)>;
+
+  Clipmap() = default;
+  Clipmap(VkDevice device, VmaAllocator allocator, VkDescriptorPool pool,
+      VkPipelineCache cache, VkRenderPass pass, VkExtent2D extent,
+      uint32_t levels = 8, uint32_t size = 256);
+
+  // Every texel is resampled on the next update, as when tiles are loaded
+  void invalidate();
+
+  // Outside the render pass, before record_draw
+  void record_update(vk::CommandBufferGuard &cmd, const glm::vec3 &centre,
+      const HeightFn &height);
+  void record_draw(vk::RenderPassGuard &rp, const glm::mat4 &view_proj,
+      chunks::range colour_range);
+
+  uint32_t levels() const;
+  uint32_t size() const;
+  // Rewritten by the last update
+  size_t updated_texels() const;
+  VkDeviceSize memory_bytes() const;
+
+  void destroy();
+
+private:
+  // A rectangle of grid points, in multiples of a level's spacing
+  struct grid_rect {
+    glm::ivec2 min;
+    glm::ivec2 extent;
+  };
+
+  void add_update(uint32_t level, grid_rect rect, const HeightFn &height,
+      std::vector<VkBufferImageCopy> &regions);
+
+  VkDevice device_;
+  VmaAllocator allocator_;
+  uint32_t levels_;
+  uint32_t size_;
+
+  vk::AllocatedImage image_;
+  VkImageView view_;
+  VkSampler sampler_;
+  bool initialised_ = false;
+
+  // Big enough to rewrite every level at once
+  vk::AllocatorBuffer staging_buffer_;
+  float *staging_ = nullptr;
+  size_t staging_used_ = 0;
+
+  // The full grid, then the grid without the middle the next level in covers
+  vk::AllocatorBuffer index_buffer_;
+  uint32_t full_index_count_;
+  uint32_t ring_index_count_;
+
+  VkDescriptorSetLayout set_layout_;
+  VkDescriptorSet set_;
+  VkPipelineLayout pipeline_layout_;
+  VkPipeline pipeline_;
+
+  std::vector<std::optional<glm::ivec2>> origins_;
+  size_t updated_texels_ = 0;
+};
+
+} // namespace siliconia::graphics
+
+#endif // SILICONIA_CLIPMAP_HPP
@@ -0,0 +1,297 @@
+#include "depth_pyramid.hpp"
+#include <algorithm>
+#include <cstring>
+#include <graphics/vk/helpers.hpp>
+#include <graphics/vk/init.hpp>
+#include <graphics/vk/pipeline_builder.hpp>
+
+namespace siliconia::graphics {
+
+namespace {
+
+struct reduce_push_constants {
+  int32_t src_width, src_height;
+  int32_t dst_width, dst_height;
+};
+
+uint32_t previous_pow2(uint32_t n)
+{
+  auto r = 1u;
+  while (r * 2 <= n) {
+    r *= 2;
+  }
+  return r;
+}
+
+VkExtent2D level_extent(VkExtent2D base, uint32_t level)
+{
+  return {std::max(1u, base.width >> level), std::max(1u, base.height >> level)};
+}
+
+// The CPU only needs enough detail to catch whole tiles
+constexpr uint32_t max_readback_width = 64;
+
+} // namespace
+
+DepthPyramid::DepthPyramid(VkDevice device, VmaAllocator allocator,
+    VkDescriptorPool pool, VkPipelineCache cache, VkExtent2D depth_extent,
+    VkImageView depth_view)
+  : device_(device), allocator_(allocator), depth_extent_(depth_extent)
+{
+  // Power of two levels halve exactly all the way down
+  extent_ = {previous_pow2(depth_extent.width),
+      previous_pow2(depth_extent.height)};
+  levels_ = 1;
+  while ((std::max(extent_.width, extent_.height) >> levels_) > 0) {
+    levels_++;
+  }
+
+  auto image_info = vk::image_create_info(VK_FORMAT_R32_SFLOAT,
+      VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+          VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      {extent_.width, extent_.height, 1});
+  image_info.mipLevels = levels_;
+
+  auto image_alloc_info = VmaAllocationCreateInfo{};
+  image_alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+  VK_CHECK(vmaCreateImage(allocator_, &image_info, &image_alloc_info,
+      &image_.image, &image_.allocation, nullptr));
+
+  auto view_info = vk::image_view_create_info(
+      VK_FORMAT_R32_SFLOAT, image_.image, VK_IMAGE_ASPECT_COLOR_BIT);
+  view_info.subresourceRange.levelCount = levels_;
+  VK_CHECK(vkCreateImageView(device_, &view_info, nullptr, &view_));
+
+  level_views_.resize(levels_);
+  for (uint32_t i = 0; i < levels_; i++) {
+    view_info.subresourceRange.baseMipLevel = i;
+    view_info.subresourceRange.levelCount = 1;
+    VK_CHECK(
+        vkCreateImageView(device_, &view_info, nullptr, &level_views_[i]));
+  }
+
+  auto sampler_info = vk::sampler_create_info(VK_FILTER_NEAREST);
+  VK_CHECK(vkCreateSampler(device_, &sampler_info, nullptr, &sampler_));
+
+  readback_level_ = 0;
+  while (level_extent(extent_, readback_level_).width > max_readback_width) {
+    readback_level_++;
+  }
+  readback_extent_ = level_extent(extent_, readback_level_);
+
+  auto buffer_info = VkBufferCreateInfo{};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size =
+      readback_extent_.width * readback_extent_.height * sizeof(float);
+  buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  auto buffer_alloc_info = VmaAllocationCreateInfo{};
+  buffer_alloc_info.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+  VK_CHECK(vmaCreateBuffer(allocator_, &buffer_info, &buffer_alloc_info,
+      &readback_buffer_.buffer, &readback_buffer_.allocation, nullptr));
+
+  VkDescriptorSetLayoutBinding bindings[] = {
+      vk::descriptor_set_layout_binding(
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_SHADER_STAGE_COMPUTE_BIT, 0),
+      vk::descriptor_set_layout_binding(
+          VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 1)};
+  auto set_info = VkDescriptorSetLayoutCreateInfo{};
+  set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_info.bindingCount = std::size(bindings);
+  set_info.pBindings = bindings;
+  VK_CHECK(
+      vkCreateDescriptorSetLayout(device_, &set_info, nullptr, &set_layout_));
+
+  // One set per level, reading the level above (or the depth buffer)
+  sets_.resize(levels_);
+  auto layouts = std::vector<VkDescriptorSetLayout>(levels_, set_layout_);
+  auto alloc_info = VkDescriptorSetAllocateInfo{};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = pool;
+  alloc_info.descriptorSetCount = levels_;
+  alloc_info.pSetLayouts = layouts.data();
+  VK_CHECK(vkAllocateDescriptorSets(device_, &alloc_info, sets_.data()));
+
+  for (uint32_t i = 0; i < levels_; i++) {
+    auto src_info = i == 0 ? VkDescriptorImageInfo{sampler_, depth_view,
+                                 VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL}
+                           : VkDescriptorImageInfo{sampler_,
+                                 level_views_[i - 1], VK_IMAGE_LAYOUT_GENERAL};
+    auto dst_info = VkDescriptorImageInfo{
+        VK_NULL_HANDLE, level_views_[i], VK_IMAGE_LAYOUT_GENERAL};
+    VkWriteDescriptorSet writes[] = {
+        vk::write_descriptor_image(
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, sets_[i], &src_info, 0),
+        vk::write_descriptor_image(
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, sets_[i], &dst_info, 1)};
+    vkUpdateDescriptorSets(device_, std::size(writes), writes, 0, nullptr);
+  }
+
+  auto push_constant = VkPushConstantRange{};
+  push_constant.size = sizeof(reduce_push_constants);
+  push_constant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  auto layout_info = vk::pipeline_layout_create_info();
+  layout_info.setLayoutCount = 1;
+  layout_info.pSetLayouts = &set_layout_;
+  layout_info.pushConstantRangeCount = 1;
+  layout_info.pPushConstantRanges = &push_constant;
+  VK_CHECK(vkCreatePipelineLayout(
+      device_, &layout_info, nullptr, &pipeline_layout_));
+
+  auto builder = vk::ComputePipelineBuilder{};
+  builder.layout = pipeline_layout_;
+  pipeline_ = builder.build_pipeline(
+      device_, "../shaders/hiz_reduce.comp.spv", cache);
+}
+
+void DepthPyramid::record_build(vk::CommandBufferGuard &cmd,
+    VkImage depth_image, const glm::mat4 &view_proj)
+{
+  cmd.image_barrier(depth_image, VK_IMAGE_ASPECT_DEPTH_BIT,
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+  // Every level is rewritten so the old contents can go, but not before
+  // this frame's culling and the last readback are done with them
+  cmd.image_barrier(image_.image, VK_IMAGE_ASPECT_COLOR_BIT,
+      VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+  cmd.bind_compute_pipeline(pipeline_);
+  auto src_extent = depth_extent_;
+  for (uint32_t i = 0; i < levels_; i++) {
+    auto dst_extent = level_extent(extent_, i);
+    auto constants = reduce_push_constants{(int32_t)src_extent.width,
+        (int32_t)src_extent.height, (int32_t)dst_extent.width,
+        (int32_t)dst_extent.height};
+
+    cmd.bind_compute_descriptor_set(pipeline_layout_, sets_[i]);
+    cmd.push_constants(pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT,
+        sizeof(constants), &constants);
+    cmd.dispatch((dst_extent.width + 7) / 8, (dst_extent.height + 7) / 8, 1);
+
+    cmd.image_barrier(image_.image, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT, i, 1);
+    src_extent = dst_extent;
+  }
+
+  cmd.copy_image_to_buffer(image_.image, VK_IMAGE_LAYOUT_GENERAL,
+      readback_buffer_.buffer, readback_level_, readback_extent_);
+  cmd.buffer_barrier(readback_buffer_.buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+      VK_ACCESS_HOST_READ_BIT);
+
+  pending_ = true;
+  pending_view_proj_ = view_proj;
+}
+
+void DepthPyramid::read_back()
+{
+  if (!pending_) {
+    return;
+  }
+  readback_.resize(readback_extent_.width * readback_extent_.height);
+  void *data;
+  vmaMapMemory(allocator_, readback_buffer_.allocation, &data);
+  memcpy(readback_.data(), data, readback_.size() * sizeof(float));
+  vmaUnmapMemory(allocator_, readback_buffer_.allocation);
+
+  view_proj_ = pending_view_proj_;
+  pending_ = false;
+  valid_ = true;
+}
+
+bool DepthPyramid::occluded(const aabb &box) const
+{
+  if (!valid_) {
+    return false;
+  }
+
+  auto lo = glm::vec2{1.f};
+  auto hi = glm::vec2{0.f};
+  auto nearest = 1.f;
+  for (int i = 0; i < 8; i++) {
+    auto corner = glm::vec3{i & 1 ? box.max.x : box.min.x,
+        i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z};
+    auto clip = view_proj_ * glm::vec4{corner, 1.f};
+    // Straddles the camera, so there's no sensible screen rect
+    if (clip.w <= 0) {
+      return false;
+    }
+    auto ndc = glm::vec3{clip} / clip.w;
+    lo = glm::min(lo, glm::vec2{ndc} * 0.5f + 0.5f);
+    hi = glm::max(hi, glm::vec2{ndc} * 0.5f + 0.5f);
+    nearest = std::min(nearest, ndc.z);
+  }
+  lo = glm::clamp(lo, 0.f, 1.f);
+  hi = glm::clamp(hi, 0.f, 1.f);
+
+  auto w = readback_extent_.width;
+  auto h = readback_extent_.height;
+  auto x0 = std::min(w - 1, (uint32_t)(lo.x * w));
+  auto x1 = std::min(w - 1, (uint32_t)(hi.x * w));
+  auto y0 = std::min(h - 1, (uint32_t)(lo.y * h));
+  auto y1 = std::min(h - 1, (uint32_t)(hi.y * h));
+
+  auto furthest = 0.f;
+  for (auto y = y0; y <= y1; y++) {
+    for (auto x = x0; x <= x1; x++) {
+      furthest = std::max(furthest, readback_[x + y * w]);
+    }
+  }
+  return nearest > furthest;
+}
+
+bool DepthPyramid::valid() const
+{
+  return valid_;
+}
+
+const glm::mat4 &DepthPyramid::view_proj() const
+{
+  return view_proj_;
+}
+
+VkImageView DepthPyramid::view() const
+{
+  return view_;
+}
+
+VkSampler DepthPyramid::sampler() const
+{
+  return sampler_;
+}
+
+VkExtent2D DepthPyramid::extent() const
+{
+  return extent_;
+}
+
+uint32_t DepthPyramid::levels() const
+{
+  return levels_;
+}
+
+void DepthPyramid::destroy()
+{
+  vkDestroyPipeline(device_, pipeline_, nullptr);
+  vkDestroyPipelineLayout(device_, pipeline_layout_, nullptr);
+  vkDestroyDescriptorSetLayout(device_, set_layout_, nullptr);
+  vkDestroySampler(device_, sampler_, nullptr);
+  for (auto view : level_views_) {
+    vkDestroyImageView(device_, view, nullptr);
+  }
+  vkDestroyImageView(device_, view_, nullptr);
+  vmaDestroyImage(allocator_, image_.image, image_.allocation);
+  vmaDestroyBuffer(
+      allocator_, readback_buffer_.buffer, readback_buffer_.allocation);
+}
+
+} // namespace siliconia::graphics
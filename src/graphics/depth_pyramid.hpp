@@ -0,0 +1,73 @@
+#ifndef SILICONIA_DEPTH_PYRAMID_HPP
+#define SILICONIA_DEPTH_PYRAMID_HPP
+
+#include "frustum.hpp"
+#include <glm/glm.hpp>
+#include <graphics/vk/command_buffer.hpp>
+#include <graphics/vk/types.hpp>
+#include <vector>
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+namespace siliconia::graphics {
+
+// Hierarchical-Z: a mip chain where each texel holds the furthest depth of
+// the texels below it, built from the last frame's depth buffer. A box whose
+// nearest point is further than that is hidden behind what was drawn.
+class DepthPyramid {
+public:
+  DepthPyramid() = default;
+  DepthPyramid(VkDevice device, VmaAllocator allocator,
+      VkDescriptorPool pool, VkPipelineCache cache, VkExtent2D depth_extent,
+      VkImageView depth_view);
+
+  // Expects the depth image as the render pass left it
+  void record_build(vk::CommandBufferGuard &cmd, VkImage depth_image,
+      const glm::mat4 &view_proj);
+  // Once the frame that recorded the build has finished
+  void read_back();
+
+  // Tests against the CPU copy of a coarse level
+  bool occluded(const aabb &box) const;
+  bool valid() const;
+
+  // The view_proj the last finished build was made with
+  const glm::mat4 &view_proj() const;
+  VkImageView view() const;
+  VkSampler sampler() const;
+  VkExtent2D extent() const;
+  uint32_t levels() const;
+
+  void destroy();
+
+private:
+  VkDevice device_;
+  VmaAllocator allocator_;
+
+  VkExtent2D depth_extent_;
+  VkExtent2D extent_;
+  uint32_t levels_;
+  vk::AllocatedImage image_;
+  VkImageView view_;
+  std::vector<VkImageView> level_views_;
+  VkSampler sampler_;
+
+  VkDescriptorSetLayout set_layout_;
+  std::vector<VkDescriptorSet> sets_;
+  VkPipelineLayout pipeline_layout_;
+  VkPipeline pipeline_;
+
+  uint32_t readback_level_;
+  VkExtent2D readback_extent_;
+  vk::AllocatorBuffer readback_buffer_;
+  std::vector<float> readback_;
+
+  bool pending_ = false;
+  bool valid_ = false;
+  glm::mat4 pending_view_proj_;
+  glm::mat4 view_proj_;
+};
+
+} // namespace siliconia::graphics
+
+#endif // SILICONIA_DEPTH_PYRAMID_HPP
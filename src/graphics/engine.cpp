@@ -1,15 +1,22 @@
-#define GLM_FORCE_DEPTH_ZERO_TO_ONE
-
 #include "engine.hpp"
 #include "VkBootstrap.h"
+#include "frustum.hpp"
+#include "jobs/job_system.hpp"
+#include "profiling/frame_stats.hpp"
+#include "profiling/profiler.hpp"
+#include "profiling/startup_timeline.hpp"
 #include "vk/helpers.hpp"
 #include "vk/pipeline_builder.hpp"
 #include <SDL_vulkan.h>
 #include <array>
+#include <chrono>
+#include <cmath>
 #include <fstream>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform.hpp>
 #include <iostream>
+#include <optional>
+#include <sstream>
 
 #define VMA_IMPLEMENTATION
 #include "vk_mem_alloc.h"
@@ -59,9 +66,148 @@ colour get_colour(const std::array<gradient_point, N> &gradient,
   return c;
 }
 
-Engine::Engine(
-    uint32_t width, uint32_t height, chunks::ChunkCollection &&chunks)
+// Where a tile sits relative to the collection, in cells
+glm::vec3 tile_offset(const chunks::Chunk &chunk, const chunks::rect &rect)
+{
+  auto cell_size = chunk.cell_size;
+  auto x_offset = (chunk.rect().x - rect.x) / cell_size;
+  auto z_offset = rect.height / cell_size -
+                  (chunk.rect().y - rect.y) / cell_size -
+                  chunk.rect().height / cell_size;
+  return {x_offset, 0, z_offset};
+}
+
+// Colours are left to colour_mesh, as they depend on the range of every
+// tile rather than just this one
+vk::Mesh mesh_chunk(const chunks::Chunk &chunk, const chunks::rect &rect)
+{
+  auto mesh = vk::Mesh{};
+  auto offset = tile_offset(chunk, rect);
+  auto has_nodata = false;
+
+  mesh.vertices.reserve(chunk.ncols * chunk.nrows);
+  for (unsigned int j = 0; j < chunk.nrows; j++) {
+    for (unsigned int i = 0; i < chunk.ncols; i++) {
+      auto v = chunk.data[i + j * chunk.ncols];
+      has_nodata |= v == chunk.nodata_value;
+
+      auto vert = vk::Vertex(glm::vec3{i, -v, j}, glm::vec3{1.f});
+      mesh.vertices.push_back(std::move(vert));
+
+      if (i < chunk.ncols - 1 && j < chunk.nrows - 1) {
+        mesh.indices.push_back(i + j * chunk.ncols);       // tl
+        mesh.indices.push_back((i + 1) + j * chunk.ncols); // tr
+        mesh.indices.push_back(i + (j + 1) * chunk.ncols); // bl
+
+        mesh.indices.push_back((i + 1) + j * chunk.ncols);       // tr
+        mesh.indices.push_back((i + 1) + (j + 1) * chunk.ncols); // br
+        mesh.indices.push_back(i + (j + 1) * chunk.ncols);       // bl
+      }
+    }
+  }
+  mesh.model_matrix = glm::translate(glm::mat4(1), offset);
+
+  // Heights are negated when meshing, and nodata cells are meshed at
+  // -nodata_value so they have to be in the box too
+  auto height = chunk.range;
+  if (has_nodata) {
+    height.extend(chunk.nodata_value);
+  }
+  mesh.bounds.min = {offset.x, -height.max, offset.z};
+  mesh.bounds.max = {offset.x + chunk.ncols - 1, -height.min,
+      offset.z + chunk.nrows - 1};
+  return mesh;
+}
+
+// Fully saturated, for a hue in degrees
+glm::vec3 hue(float degrees)
+{
+  auto h = degrees / 60.f;
+  return glm::clamp(
+      glm::vec3{std::abs(h - 3.f) - 1.f, 2.f - std::abs(h - 2.f),
+          2.f - std::abs(h - 4.f)},
+      0.f, 1.f);
+}
+
+// Visible cells are lit green and hidden ones darkened, leaving the
+// elevation colours outside the analysed area
+void overlay_viewshed(vk::Mesh &mesh, const chunks::Chunk &chunk,
+    const analysis::viewshed_grid &viewshed)
+{
+  auto r = chunk.rect();
+  auto top = r.y + double(r.height);
+  for (unsigned int j = 0; j < chunk.nrows; j++) {
+    for (unsigned int i = 0; i < chunk.ncols; i++) {
+      auto &colour = mesh.vertices[i + j * chunk.ncols].colour;
+      auto cell = viewshed.at(r.x + (i + 0.5) * chunk.cell_size,
+          top - (j + 0.5) * chunk.cell_size);
+      if (cell == analysis::viewshed_grid::visible) {
+        colour = glm::mix(colour, glm::vec3{0.f, 1.f, 0.f}, 0.6f);
+      } else if (cell == analysis::viewshed_grid::hidden) {
+        colour *= 0.3f;
+      }
+    }
+  }
+}
+
+// Blue where the ground was lowered through white to red where it was
+// raised, grey without data in both surveys
+void colour_change(vk::Mesh &mesh, const analysis::difference_grid &difference,
+    float range)
+{
+  if (difference.values.size() != mesh.vertices.size()) {
+    return;
+  }
+  for (size_t i = 0; i < mesh.vertices.size(); i++) {
+    auto d = difference.values[i];
+    auto &colour = mesh.vertices[i].colour;
+    if (std::isnan(d)) {
+      colour = glm::vec3{0.4f};
+      continue;
+    }
+    auto t = std::clamp(d / range, -1.f, 1.f);
+    colour = t < 0.f ? glm::mix(glm::vec3{1.f}, glm::vec3{0.f, 0.2f, 0.8f}, -t)
+                     : glm::mix(glm::vec3{1.f}, glm::vec3{0.8f, 0.f, 0.f}, t);
+  }
+}
+
+// The derivative modes need the tile's grids, elevation ignores them
+void colour_mesh(vk::Mesh &mesh, const chunks::Chunk &chunk,
+    chunks::range range, shading_mode mode = shading_mode::elevation,
+    const analysis::derivative_grids *grids = nullptr)
+{
+  auto gradient =
+      std::array<gradient_point, 2>{{{0.0, {0, 0, 0}}, {1.0, {255, 0, 0}}}};
+  if (!grids) {
+    mode = shading_mode::elevation;
+  }
+  for (size_t i = 0; i < mesh.vertices.size(); i++) {
+    auto c = get_colour(gradient, chunk.nodata_value, range, chunk.data[i])
+                 .to_glm();
+    if (mode != shading_mode::elevation) {
+      auto value = mode == shading_mode::hillshade ? grids->hillshade[i]
+                   : mode == shading_mode::slope   ? grids->slope[i]
+                                                   : grids->aspect[i];
+      if (value == grids->nodata_value) {
+        c = glm::vec3{1.f};
+      } else if (mode == shading_mode::hillshade) {
+        // Lit by the sun, tinted by the elevation so both read at once
+        c = glm::mix(glm::vec3{1.f}, c, 0.5f) * value;
+      } else if (mode == shading_mode::slope) {
+        c = glm::mix(glm::vec3{1.f}, glm::vec3{0.5f, 0.f, 0.f},
+            std::min(value / 60.f, 1.f));
+      } else {
+        c = value < 0.f ? glm::vec3{0.5f} : hue(value);
+      }
+    }
+    mesh.vertices[i].colour = c;
+  }
+}
+
+Engine::Engine(uint32_t width, uint32_t height,
+    chunks::ChunkCollection &&chunks, bool headless)
   : win_size_({width, height})
+  , headless_(headless)
   , chunks_(chunks)
   , camera_({100.f, -200.f, -100.f}, {5.0 * 250, 0.0, 5 * 250}, {0.f, 1.f, 0.f})
 {
@@ -69,10 +215,14 @@ Engine::Engine(
 
 Engine::~Engine()
 {
+  *alive_ = false;
+  loader_.reset();
   vkWaitForFences(device_, 1, &render_fence_, true, 1e9);
 
-  vkDestroyDescriptorPool(device_, imgui_pool_, nullptr);
-  ImGui_ImplVulkan_Shutdown();
+  if (!headless_) {
+    vkDestroyDescriptorPool(device_, imgui_pool_, nullptr);
+    ImGui_ImplVulkan_Shutdown();
+  }
 
   for (const auto &mesh : meshes_) {
     vmaDestroyBuffer(
@@ -81,53 +231,123 @@ Engine::~Engine()
         allocator_, mesh.vertex_buffer.buffer, mesh.vertex_buffer.allocation);
   }
 
+  for (const auto &buffer : contour_buffers_) {
+    if (buffer.buffer != VK_NULL_HANDLE) {
+      vmaDestroyBuffer(allocator_, buffer.buffer, buffer.allocation);
+    }
+  }
+  if (profile_buffer_.buffer != VK_NULL_HANDLE) {
+    vmaDestroyBuffer(
+        allocator_, profile_buffer_.buffer, profile_buffer_.allocation);
+  }
+
   vkDestroyPipeline(device_, pipeline_, nullptr);
+  vkDestroyPipeline(device_, contour_pipeline_, nullptr);
   vkDestroyPipelineLayout(device_, pipeline_layout_, nullptr);
 
+  if (gpu_driven_supported_) {
+    destroy_gpu_scene();
+    vkDestroyPipeline(device_, cull_pipeline_, nullptr);
+    vkDestroyPipelineLayout(device_, cull_pipeline_layout_, nullptr);
+    vkDestroyPipeline(device_, indirect_pipeline_, nullptr);
+    vkDestroyPipelineLayout(device_, indirect_pipeline_layout_, nullptr);
+    vkDestroyDescriptorSetLayout(device_, scene_set_layout_, nullptr);
+    vmaDestroyBuffer(
+        allocator_, cull_data_buffer_.buffer, cull_data_buffer_.allocation);
+  }
+  depth_pyramid_.destroy();
+  clipmap_.destroy();
+  gpu_hillshade_.destroy();
+  gpu_profiler_.destroy();
+  vkDestroyDescriptorPool(device_, descriptor_pool_, nullptr);
+
+  pipeline_cache_.save();
+  pipeline_cache_.destroy();
+
   vkDestroySemaphore(device_, present_semaphore_, nullptr);
   vkDestroySemaphore(device_, render_semaphore_, nullptr);
   vkDestroyFence(device_, render_fence_, nullptr);
   vkDestroyFence(device_, upload_context_.upload_fence, nullptr);
 
+  recorder_.reset();
   vkDestroyCommandPool(device_, command_pool_.pool(), nullptr);
   vkDestroyCommandPool(device_, upload_context_.command_pool.pool(), nullptr);
 
   vkDestroyImageView(device_, depth_image_view_, nullptr);
   vmaDestroyImage(allocator_, depth_image_.image, depth_image_.allocation);
 
-  vmaDestroyAllocator(allocator_);
-
   vkDestroySwapchainKHR(device_, swapchain_, nullptr);
   vkDestroyRenderPass(device_, renderpass_, nullptr);
   for (int i = 0; i < framebuffers_.size(); i++) {
     vkDestroyFramebuffer(device_, framebuffers_[i], nullptr);
     vkDestroyImageView(device_, swapchain_image_views_[i], nullptr);
   }
+  if (headless_) {
+    vmaDestroyImage(
+        allocator_, offscreen_image_.image, offscreen_image_.allocation);
+  }
+
+  vmaDestroyAllocator(allocator_);
 
   vkDestroyDevice(device_, nullptr);
   vkDestroySurfaceKHR(instance_, surface_, nullptr);
   vkb::destroy_debug_utils_messenger(instance_, debug_messenger_, nullptr);
   vkDestroyInstance(instance_, nullptr);
 
-  SDL_DestroyWindow(window_);
+  if (window_) {
+    SDL_DestroyWindow(window_);
+  }
 }
 
 void Engine::init()
 {
-  SDL_Init(SDL_INIT_VIDEO);
-  auto flags = (SDL_WindowFlags)SDL_WINDOW_VULKAN;
-  window_ = SDL_CreateWindow("Siliconia", SDL_WINDOWPOS_UNDEFINED,
-      SDL_WINDOWPOS_UNDEFINED, win_size_.width, win_size_.height, flags);
+  auto phase = profiling::startup_timeline().phase("Engine::init");
+  if (!headless_) {
+    auto window_phase = profiling::startup_timeline().phase("Create window");
+    SDL_Init(SDL_INIT_VIDEO);
+    auto flags = (SDL_WindowFlags)SDL_WINDOW_VULKAN;
+    window_ = SDL_CreateWindow("Siliconia", SDL_WINDOWPOS_UNDEFINED,
+        SDL_WINDOWPOS_UNDEFINED, win_size_.width, win_size_.height, flags);
+  }
 
   init_vulkan();
   init_swapchain();
   init_commands();
+  gpu_profiler_ = vk::GpuProfiler{device_, chosen_gpu_};
   init_default_renderpass();
   init_framebuffers();
   init_sync_structures();
+  init_descriptors();
+
+  // Driver shader compilation dominates this, so it shows whether the
+  // pipeline cache was used
+  pipeline_cache_ =
+      vk::PipelineCache{device_, chosen_gpu_, "pipeline_cache.bin"};
+  auto pipelines_start = std::chrono::steady_clock::now();
   init_pipelines();
-  load_meshes();
-  init_imgui();
+  auto pipelines_ms = std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - pipelines_start)
+                          .count();
+  std::cout << "Built pipelines in " << pipelines_ms << "ms ("
+            << (pipeline_cache_.warm() ? "warm" : "cold") << " cache)"
+            << std::endl;
+
+  depth_pyramid_ = DepthPyramid{device_, allocator_, descriptor_pool_,
+      pipeline_cache_.cache(), win_size_, depth_image_view_};
+  if (gpu_driven_supported_) {
+    auto hiz_info = VkDescriptorImageInfo{depth_pyramid_.sampler(),
+        depth_pyramid_.view(), VK_IMAGE_LAYOUT_GENERAL};
+    auto write = vk::write_descriptor_image(
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, scene_set_, &hiz_info, 3);
+    vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+  }
+  clipmap_ = Clipmap{device_, allocator_, descriptor_pool_,
+      pipeline_cache_.cache(), renderpass_, win_size_};
+  gpu_hillshade_ = GpuHillshade{device_, pipeline_cache_.cache()};
+  start_loading();
+  if (!headless_) {
+    init_imgui();
+  }
 }
 
 void Engine::run()
@@ -136,33 +356,52 @@ void Engine::run()
 
   uint32_t frame_number = 0;
 
-  auto start = std::chrono::system_clock::now();
-
   std::cout << "Running" << std::endl;
 
-  auto last_time = std::chrono::system_clock::now();
+  auto last_time = std::chrono::steady_clock::now();
   auto speed = camera_.speed();
 
   while (true) {
+    auto frame_zone = profiling::Zone{"Frame"};
     auto pos = camera_.pos();
     auto pos_arr = std::array<float, 3>{pos.x, pos.y, pos.z};
+    auto input_zone = std::optional<profiling::Zone>{"Input"};
     while (SDL_PollEvent(&e) != 0) {
       if (e.type == SDL_QUIT) {
+        if (!camera_path_file_.empty()) {
+          if (camera_path_.save(camera_path_file_)) {
+            std::cout << "Recorded " << camera_path_.size() << " frames to "
+                      << camera_path_file_ << std::endl;
+          } else {
+            std::cout << "Could not write " << camera_path_file_ << std::endl;
+          }
+        }
+        if (!frame_stats_file_.empty()) {
+          frame_stats_.write_json(frame_stats_file_);
+        }
         return;
       }
       ImGui_ImplSDL2_ProcessEvent(&e);
       camera_.handle_input(e);
     }
 
-    auto now = std::chrono::system_clock::now();
-    auto elapsed =
-        std::chrono::duration_cast<std::chrono::milliseconds>(now - last_time);
-    last_time = now;
+    auto elapsed_ms = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - last_time)
+                          .count();
+    // The first interval is mostly start up
+    if (frame_number > 0) {
+      frame_stats_.add(elapsed_ms);
+    }
+    // After the bookkeeping, so it isn't counted in the next frame
+    last_time = std::chrono::steady_clock::now();
     camera_.set_speed(speed);
+    input_zone.reset();
 
+    auto ui_zone = std::optional<profiling::Zone>{"Build UI"};
     ImGui_ImplVulkan_NewFrame();
     ImGui_ImplSDL2_NewFrame(window_);
     ImGui::NewFrame();
+    update_hover();
 
     auto main_viewport = ImGui::GetMainViewport();
 
@@ -188,105 +427,796 @@ void Engine::run()
       ImGui::Spacing();
       ImGui::DragFloat("Speed", &speed, 5.0f, 0.1f, 3000.0f, "%.2f");
     }
+    ImGui::End();
+
+    ImGui::SetNextWindowPos(ImVec2(main_viewport->GetWorkSize().x - 200,
+                                main_viewport->GetWorkPos().y + 175),
+        ImGuiCond_Once);
+    ImGui::SetNextWindowSize(ImVec2(200, 200), ImGuiCond_Once);
+
+    if (ImGui::Begin("Stats", nullptr, 0)) {
+      ImGui::Checkbox("Frustum culling", &frustum_culling_);
+      if (gpu_driven_supported_) {
+        ImGui::Checkbox("GPU driven", &gpu_driven_);
+      }
+      ImGui::Checkbox("Occlusion culling", &occlusion_culling_);
+      ImGui::Checkbox("Parallel recording", &parallel_recording_);
+      ImGui::Checkbox("Clipmap terrain", &clipmap_terrain_);
+      if (clipmap_terrain_) {
+        ImGui::Text("Clipmap: %u levels, %.1f MB", clipmap_.levels(),
+            clipmap_.memory_bytes() / (1024.f * 1024.f));
+        ImGui::Text("Updated: %zu texels", clipmap_.updated_texels());
+      }
+      auto shading = int(shading_);
+      auto reshade = false;
+      reshade |= ImGui::RadioButton("Elevation", &shading, 0);
+      ImGui::SameLine();
+      reshade |= ImGui::RadioButton("Hillshade", &shading, 1);
+      reshade |= ImGui::RadioButton("Slope", &shading, 2);
+      ImGui::SameLine();
+      reshade |= ImGui::RadioButton("Aspect", &shading, 3);
+      reshade |= ImGui::RadioButton("Viewshed", &shading, 4);
+      if (changes_.valid()) {
+        ImGui::SameLine();
+        reshade |= ImGui::RadioButton("Change", &shading, 5);
+      }
+      shading_ = shading_mode(shading);
+      auto relight = false;
+      if (shading_ == shading_mode::hillshade) {
+        if (gpu_hillshade_.valid()) {
+          reshade |=
+              ImGui::Checkbox("GPU hillshade", &gpu_hillshade_enabled_);
+        }
+        relight |= ImGui::SliderFloat(
+            "Sun azimuth", &sun_.azimuth_deg, 0.f, 360.f);
+        relight |= ImGui::SliderFloat(
+            "Sun altitude", &sun_.altitude_deg, 0.f, 90.f);
+      }
+      // Applied once the last frame is done with the vertex buffers
+      if (relight && gpu_hillshading()) {
+        gpu_hillshade_pending_ = true;
+      } else if (relight) {
+        derivatives_.clear();
+      }
+      shading_dirty_ |= reshade || (relight && !gpu_hillshading());
+      if (cpu_derivatives() && derivatives_ms_ > 0.f) {
+        ImGui::Text("Derivatives: %.1f ms, %.0f Mcells/s", derivatives_ms_,
+            derivative_cells_ / (derivatives_ms_ * 1000.f));
+      }
+      ImGui::Checkbox("Contours", &show_contours_);
+      if (show_contours_) {
+        ImGui::SliderFloat("Interval", &contour_interval_, 1.f, 500.f);
+        if (ImGui::IsItemDeactivatedAfterEdit()) {
+          contours_.set_interval(contour_interval_);
+        }
+        ImGui::Text("Contours: %zu segments, %.1f ms",
+            contours_.segment_count(), contours_ms_);
+      }
+      ImGui::Text("Visible: %u", visible_meshes_);
+      ImGui::Text("Culled: %u", culled_meshes_);
+      ImGui::Text("Occluded: %u", occluded_meshes_);
+      if (loader_) {
+        auto loaded = loader_->loaded();
+        auto total = loader_->total();
+        ImGui::Text("Tiles: %zu/%zu, %zu queued", loaded, total,
+            loader_->queued());
+        ImGui::ProgressBar(total ? float(loaded) / total : 1.f);
+        ImGui::SliderFloat(
+            "Lookahead (s)", &prefetcher_.tuning.lookahead_s, 0.f, 10.f);
+        ImGui::SliderFloat("View distance", &prefetcher_.tuning.view_distance,
+            500.f, 50000.f);
+      }
+      if (hover_) {
+        auto map = hover_map_position();
+        ImGui::Text("Cursor: %.0f, %.0f", map.x, map.y);
+        ImGui::Text("Elevation: %.2f", hover_->elevation);
+      }
+      ImGui::Text("Pick: %.3f ms", pick_ms_);
+      const auto &prefetch = prefetcher_.statistics();
+      if (prefetch.demanded > 0) {
+        ImGui::Text("Prefetch hit rate: %.0f%% of %zu",
+            prefetch.hit_rate() * 100.f, prefetch.demanded);
+        ImGui::Text("Prefetched: %zu, %zu used", prefetch.prefetched,
+            prefetch.prefetch_used);
+      }
+      ImGui::Text("Record: %.2f ms (%u slices)", record_ms_,
+          parallel_recording_ ? recorder_->slice_count() : 1);
+      if (!camera_path_file_.empty()) {
+        ImGui::Text("Camera path: %zu frames", camera_path_.size());
+      }
+    }
+    ImGui::End();
+
+    if (ImGui::Begin("Viewshed", nullptr, 0)) {
+      ImGui::Text("Right click the terrain to place the observer");
+      // A large radius takes a while, so sliders only recompute once
+      // they are let go
+      auto recompute = false;
+      ImGui::SliderFloat(
+          "Observer height", &viewshed_options_.observer_height, 0.f, 300.f);
+      recompute |= ImGui::IsItemDeactivatedAfterEdit();
+      ImGui::SliderFloat(
+          "Target height", &viewshed_options_.target_height, 0.f, 50.f);
+      recompute |= ImGui::IsItemDeactivatedAfterEdit();
+      ImGui::SliderFloat("Radius", &viewshed_options_.radius, 100.f, 20000.f);
+      recompute |= ImGui::IsItemDeactivatedAfterEdit();
+      recompute |=
+          ImGui::Checkbox("Curvature", &viewshed_options_.curvature);
+      if (viewshed_running_) {
+        ImGui::Text("Computing...");
+      }
+      if (viewshed_) {
+        auto total = viewshed_->visible_count + viewshed_->hidden_count;
+        ImGui::Text("Visible: %.1f%% of %zu cells, %.0f ms",
+            total ? 100.f * viewshed_->visible_count / total : 0.f, total,
+            viewshed_ms_);
+        if (recompute) {
+          update_viewshed();
+        }
+      }
+    }
+    ImGui::End();
+
+    if (changes_.valid()) {
+      if (ImGui::Begin("Change", nullptr, 0)) {
+        ImGui::SliderFloat("Range", &change_range_, 0.1f, 50.f);
+        shading_dirty_ |= ImGui::IsItemDeactivatedAfterEdit() &&
+                          shading_ == shading_mode::change;
+        const auto &stats = changes_.statistics();
+        ImGui::Text("Compared: %zu cells, %zu without earlier data",
+            stats.compared, stats.missing);
+        ImGui::Text("Cut: %.1f, fill: %.1f, net: %.1f", stats.cut, stats.fill,
+            stats.net());
+        ImGui::Text("Change: %.2f to %.2f, mean %.3f, RMS %.3f", stats.min,
+            stats.max, stats.mean(), stats.rms());
+        if (changes_.misaligned() > 0) {
+          ImGui::Text("Skipped %zu misaligned earlier tiles",
+              changes_.misaligned());
+        }
+        ImGui::Text("Differenced %zu tiles, %zu queued",
+            changes_.differenced(), changes_.queued());
+      }
+      ImGui::End();
+    }
+
+    if (ImGui::Begin("Profile", nullptr, 0)) {
+      if (ImGui::Checkbox("Draw", &drawing_profile_) && drawing_profile_) {
+        profile_points_.clear();
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("Clear")) {
+        profile_points_.clear();
+        drawing_profile_ = false;
+        profile_stale_ = true;
+      }
+      if (drawing_profile_) {
+        ImGui::Text("Left click to add points, right click to finish");
+      }
+      profile_stale_ |=
+          ImGui::SliderInt("Samples", &profile_samples_, 100, 10000);
+      if (profile_.min <= profile_.max) {
+        // PlotLines has no gaps, so samples without data sit at the bottom
+        auto plotted = profile_.elevations;
+        auto gaps = size_t{0};
+        for (auto &h : plotted) {
+          if (std::isnan(h)) {
+            h = profile_.min;
+            gaps++;
+          }
+        }
+        ImGui::PlotLines("##profile", plotted.data(), plotted.size(), 0,
+            nullptr, profile_.min, profile_.max, ImVec2(0, 150));
+        ImGui::Text("Length: %.0f, elevation %.1f to %.1f", profile_.length,
+            profile_.min, profile_.max);
+        ImGui::Text("%zu samples, %zu without data, %.2f ms",
+            plotted.size(), gaps, profile_ms_);
+      }
+    }
+    ImGui::End();
+
+    if (hover_ && drawing_profile_) {
+      if (ImGui::IsMouseClicked(0)) {
+        profile_points_.push_back(hover_map_position());
+      } else if (ImGui::IsMouseClicked(1)) {
+        drawing_profile_ = false;
+        profile_stale_ = true;
+      }
+    } else if (hover_ && ImGui::IsMouseClicked(1)) {
+      auto map = hover_map_position();
+      viewshed_options_.x = map.x;
+      viewshed_options_.y = map.y;
+      update_viewshed();
+    }
+    // The line follows the cursor while it is drawn
+    if (drawing_profile_ || profile_stale_) {
+      update_profile();
+    }
+
+    if (gpu_profiler_.supported()) {
+      ImGui::SetNextWindowPos(ImVec2(main_viewport->GetWorkSize().x - 200,
+                                  main_viewport->GetWorkPos().y + 375),
+          ImGuiCond_Once);
+      ImGui::SetNextWindowSize(ImVec2(200, 150), ImGuiCond_Once);
+
+      if (ImGui::Begin("GPU", nullptr, 0)) {
+        for (const auto &zone : gpu_profiler_.averages()) {
+          ImGui::Text("%s: %.3f ms", zone.name.c_str(), zone.ms);
+        }
+      }
+      ImGui::End();
+    }
+
+    ImGui::SetNextWindowPos(ImVec2(main_viewport->GetWorkPos().x,
+                                main_viewport->GetWorkPos().y),
+        ImGuiCond_Once);
+    ImGui::SetNextWindowSize(ImVec2(300, 260), ImGuiCond_Once);
+
+    if (ImGui::Begin("Frame times", nullptr, 0)) {
+      auto stats = frame_stats_.summarise();
+      ImGui::Text("p50 %.2f  p95 %.2f  p99 %.2f ms", stats.p50, stats.p95,
+          stats.p99);
+      ImGui::Text("Max %.2f ms, %.0f fps", stats.max,
+          stats.mean > 0 ? 1000.f / stats.mean : 0.f);
+      ImGui::Text("Stutters: %zu", stats.stutters);
+
+      auto history = frame_stats_.history();
+      ImGui::PlotLines("##history", history.data(), history.size(), 0,
+          nullptr, 0.f, std::max(33.3f, stats.max), ImVec2(280, 60));
+      auto histogram = frame_stats_.histogram();
+      ImGui::PlotHistogram("##histogram", histogram.data(), histogram.size(),
+          0, "0-50 ms", 0.f, 3.4e38f, ImVec2(280, 60));
+    }
+    ImGui::End();
 
     ImGui::Render();
+    ui_zone.reset();
 
     camera_.set_pos({pos_arr[0], pos_arr[1], pos_arr[2]});
 
-    camera_.update(elapsed.count() / 1000.f);
+    camera_.update(elapsed_ms / 1000.f);
+    if (!camera_path_file_.empty()) {
+      camera_path_.record(camera_);
+    }
+
+    draw_frame(frame_number, true);
+    frame_number++;
+  }
+}
 
+void Engine::draw_frame(uint32_t frame_number, bool ui)
+{
+  auto zone = profiling::Zone{"draw_frame"};
+  {
+    auto wait_zone = profiling::Zone{"Wait for GPU"};
     VK_CHECK(vkWaitForFences(device_, 1, &render_fence_, true, 1e9));
     VK_CHECK(vkResetFences(device_, 1, &render_fence_));
-    uint32_t swapchain_image_index;
-    VK_CHECK(vkAcquireNextImageKHR(device_, swapchain_, 1e9, present_semaphore_,
-        nullptr, &swapchain_image_index));
-
-    main_command_buffer_.reset();
+  }
 
-    {
-      auto cmd_guard = main_command_buffer_.begin();
+  // The last frame has finished so its cull counts and depth can be read
+  if (gpu_driven_ && gpu_tile_count_ > 0) {
+    void *data;
+    vmaMapMemory(allocator_, cull_stats_buffer_.allocation, &data);
+    visible_meshes_ = static_cast<uint32_t *>(data)[0];
+    occluded_meshes_ = static_cast<uint32_t *>(data)[1];
+    vmaUnmapMemory(allocator_, cull_stats_buffer_.allocation);
+    culled_meshes_ = gpu_tile_count_ - visible_meshes_ - occluded_meshes_;
+  }
+  depth_pyramid_.read_back();
+  // Recoloured along with the next batch of tiles, or straight away once
+  // they are all in
+  if (changes_.valid() && !changes_.update(chunks_).empty() &&
+      shading_ == shading_mode::change) {
+    (loader_ ? scene_dirty_ : shading_dirty_) = true;
+  }
+  // Also safe now, as nothing is reading the buffers it rewrites
+  if (shading_dirty_) {
+    if (cpu_derivatives() &&
+        derivatives_.size() != chunks_.chunks().size()) {
+      update_derivatives();
+    }
+    recolour_meshes();
+    if (gpu_driven_supported_) {
+      build_gpu_scene();
+    }
+    shading_dirty_ = false;
+  }
+  if (show_contours_) {
+    update_contours();
+  }
+  if (profile_line_dirty_) {
+    upload_profile_line();
+  }
+  integrate_loaded_tiles(false);
+
+  // Headless runs render to the one offscreen image and never present
+  uint32_t swapchain_image_index = 0;
+  if (!headless_) {
+    auto acquire_zone = profiling::Zone{"Acquire"};
+    VK_CHECK(vkAcquireNextImageKHR(device_, swapchain_, 1e9,
+        present_semaphore_, nullptr, &swapchain_image_index));
+  }
 
-      auto clear_val = VkClearValue{};
-      auto flash = std::abs(std::sin(frame_number / 120.f));
-      clear_val.color = {{0.0f, 0.0f, flash, 1.0f}};
+  main_command_buffer_.reset();
 
-      auto clear_depth_val = VkClearValue{};
-      clear_depth_val.depthStencil.depth = 1.0f;
+  {
+    auto cmd_guard = main_command_buffer_.begin();
+    gpu_profiler_.begin_frame(main_command_buffer_.buffer());
+    auto frame_zone = cmd_guard.profile_zone(gpu_profiler_, "Frame");
+
+    auto clear_val = VkClearValue{};
+    auto flash = std::abs(std::sin(frame_number / 120.f));
+    clear_val.color = {{0.0f, 0.0f, flash, 1.0f}};
+
+    auto clear_depth_val = VkClearValue{};
+    clear_depth_val.depthStencil.depth = 1.0f;
+
+    auto clears = std::array{clear_val, clear_depth_val};
+
+    auto view = camera_.matrix();
+    auto proj = projection();
+    auto view_frustum = frustum{proj * view};
+
+    auto gpu_driven =
+        gpu_driven_ && gpu_tile_count_ > 0 && !clipmap_terrain_;
+    auto occlusion = occlusion_culling_ && depth_pyramid_.valid();
+    if (gpu_driven) {
+      auto cull_zone = cmd_guard.profile_zone(gpu_profiler_, "Cull");
+      auto cull_data = vk::CullData{};
+      for (int i = 0; i < 6; i++) {
+        cull_data.planes[i] = view_frustum.planes()[i];
+      }
+      cull_data.hiz_view_proj = depth_pyramid_.view_proj();
+      cull_data.hiz_size = {
+          depth_pyramid_.extent().width, depth_pyramid_.extent().height};
+      cull_data.hiz_levels = depth_pyramid_.levels();
+      cull_data.tile_count = gpu_tile_count_;
+      cull_data.flags = (frustum_culling_ ? vk::CullData::frustum : 0) |
+                        (occlusion ? vk::CullData::occlusion : 0);
+
+      void *data;
+      vmaMapMemory(allocator_, cull_data_buffer_.allocation, &data);
+      memcpy(data, &cull_data, sizeof(cull_data));
+      vmaUnmapMemory(allocator_, cull_data_buffer_.allocation);
+
+      cmd_guard.fill_buffer(
+          cull_stats_buffer_.buffer, 0, 2 * sizeof(uint32_t), 0);
+      cmd_guard.buffer_barrier(cull_stats_buffer_.buffer,
+          VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+          VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+      cmd_guard.bind_compute_pipeline(cull_pipeline_);
+      cmd_guard.bind_compute_descriptor_set(cull_pipeline_layout_, scene_set_);
+      cmd_guard.dispatch((gpu_tile_count_ + 63) / 64, 1, 1);
+
+      cmd_guard.buffer_barrier(draw_buffer_.buffer,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+          VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+          VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+      cmd_guard.buffer_barrier(cull_stats_buffer_.buffer,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+          VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+    }
 
-      auto clears = std::array{clear_val, clear_depth_val};
-      auto rp = cmd_guard.begin_render_pass(
-          renderpass_, win_size_, framebuffers_[swapchain_image_index], clears);
-      rp.bind_pipeline(pipeline_);
+    if (gpu_hillshade_pending_ && gpu_hillshading()) {
+      auto hillshade_zone =
+          cmd_guard.profile_zone(gpu_profiler_, "Hillshade");
+      record_gpu_hillshade(cmd_guard);
+    }
 
-      auto view = camera_.matrix();
-      auto proj =
-          glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 10000000000.0f);
+    if (clipmap_terrain_) {
+      auto clipmap_zone =
+          cmd_guard.profile_zone(gpu_profiler_, "Clipmap update");
+      clipmap_.record_update(cmd_guard, camera_.pos(), clipmap_heights());
+    }
 
+    auto view_proj = proj * view;
+    auto visible = std::vector<const vk::Mesh *>{};
+    if (clipmap_terrain_) {
+      visible_meshes_ = culled_meshes_ = occluded_meshes_ = 0;
+    } else if (!gpu_driven) {
+      auto cull_zone = profiling::Zone{"Cull"};
+      culled_meshes_ = 0;
+      occluded_meshes_ = 0;
       for (const auto &mesh : meshes_) {
-        rp.bind_vertex_buffers(0, 1, &mesh.vertex_buffer.buffer);
-        rp.bind_index_buffer(mesh.index_buffer.buffer);
-        auto constant = vk::MeshPushConstants{proj * view * mesh.model_matrix};
-        rp.push_constants(pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT,
+        if (frustum_culling_ && !view_frustum.intersects(mesh.bounds)) {
+          culled_meshes_++;
+        } else if (occlusion && depth_pyramid_.occluded(mesh.bounds)) {
+          occluded_meshes_++;
+        } else {
+          visible.push_back(&mesh);
+        }
+      }
+      visible_meshes_ = visible.size();
+    }
+
+    auto record_meshes = [&](vk::RenderPassGuard &pass, size_t begin,
+                             size_t end) {
+      pass.bind_pipeline(pipeline_);
+      for (auto i = begin; i < end; i++) {
+        const auto &mesh = *visible[i];
+        pass.bind_vertex_buffers(0, 1, &mesh.vertex_buffer.buffer);
+        pass.bind_index_buffer(mesh.index_buffer.buffer);
+        auto constant = vk::MeshPushConstants{view_proj * mesh.model_matrix};
+        pass.push_constants(pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT,
             sizeof(vk::MeshPushConstants), &constant);
-        rp.draw_indexed(mesh.indices.size(), 1, 0, 0, 0);
+        pass.draw_indexed(mesh.indices.size(), 1, 0, 0, 0);
+      }
+    };
+    auto record_contours = [&](vk::RenderPassGuard &pass) {
+      pass.bind_pipeline(contour_pipeline_);
+      for (size_t i = 0; i < contour_vertex_counts_.size(); i++) {
+        auto culled = frustum_culling_ &&
+                      !view_frustum.intersects(meshes_[i].bounds);
+        if (contour_vertex_counts_[i] == 0 || culled) {
+          continue;
+        }
+        pass.bind_vertex_buffers(0, 1, &contour_buffers_[i].buffer);
+        auto constant =
+            vk::MeshPushConstants{view_proj * meshes_[i].model_matrix};
+        pass.push_constants(pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT,
+            sizeof(vk::MeshPushConstants), &constant);
+        pass.draw(contour_vertex_counts_[i], 1, 0, 0);
+      }
+    };
+    auto record_profile = [&](vk::RenderPassGuard &pass) {
+      pass.bind_pipeline(contour_pipeline_);
+      pass.bind_vertex_buffers(0, 1, &profile_buffer_.buffer);
+      auto constant = vk::MeshPushConstants{view_proj};
+      pass.push_constants(pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT,
+          sizeof(vk::MeshPushConstants), &constant);
+      pass.draw(profile_vertex_count_, 1, 0, 0);
+    };
+    auto record_indirect = [&](vk::RenderPassGuard &pass) {
+      pass.bind_pipeline(indirect_pipeline_);
+      pass.bind_descriptor_set(indirect_pipeline_layout_, scene_set_);
+      pass.push_constants(indirect_pipeline_layout_,
+          VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::mat4), &view_proj);
+      pass.bind_vertex_buffers(0, 1, &scene_vertex_buffer_.buffer);
+      pass.bind_index_buffer(scene_index_buffer_.buffer);
+      pass.draw_indexed_indirect(draw_buffer_.buffer, 0, gpu_tile_count_,
+          sizeof(VkDrawIndexedIndirectCommand));
+    };
+
+    auto framebuffer = framebuffers_[swapchain_image_index];
+    auto record_start = std::chrono::steady_clock::now();
+    auto record_zone = std::optional<profiling::Zone>{"Record"};
+    if (parallel_recording_) {
+      // The secondary buffers are recorded on other threads and only they
+      // may record inside the pass, so it is timed from outside as a whole
+      auto pass_zone = cmd_guard.profile_zone(gpu_profiler_, "Main pass");
+      auto rp = cmd_guard.begin_render_pass(renderpass_, win_size_,
+          framebuffer, clears, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+      auto buffers = std::vector<VkCommandBuffer>{};
+      if (!gpu_driven) {
+        buffers = recorder_->record(
+            renderpass_, framebuffer, visible.size(), record_meshes);
       }
 
-      ImGui_ImplVulkan_RenderDrawData(
-          ImGui::GetDrawData(), main_command_buffer_.buffer());
+      // Once a pass takes secondary buffers everything has to go in one,
+      // so the main thread records the indirect draw and the UI
+      {
+        auto ui_guard =
+            ui_command_buffer_.begin_secondary(renderpass_, framebuffer);
+        auto ui_rp = ui_guard.continue_render_pass();
+        if (clipmap_terrain_) {
+          clipmap_.record_draw(ui_rp, view_proj, chunks_.range);
+        } else if (gpu_driven) {
+          record_indirect(ui_rp);
+        }
+        if (show_contours_) {
+          record_contours(ui_rp);
+        }
+        if (profile_vertex_count_ > 0) {
+          record_profile(ui_rp);
+        }
+        if (ui) {
+          ImGui_ImplVulkan_RenderDrawData(
+              ImGui::GetDrawData(), ui_command_buffer_.buffer());
+        }
+      }
+      buffers.push_back(ui_command_buffer_.buffer());
+      rp.execute_commands(buffers);
+    } else {
+      auto rp = cmd_guard.begin_render_pass(
+          renderpass_, win_size_, framebuffer, clears);
+      {
+        auto terrain_zone = rp.profile_zone(gpu_profiler_, "Terrain");
+        if (clipmap_terrain_) {
+          clipmap_.record_draw(rp, view_proj, chunks_.range);
+        } else if (gpu_driven) {
+          record_indirect(rp);
+        } else {
+          record_meshes(rp, 0, visible.size());
+        }
+        if (show_contours_) {
+          record_contours(rp);
+        }
+        if (profile_vertex_count_ > 0) {
+          record_profile(rp);
+        }
+      }
+
+      if (ui) {
+        auto ui_zone = rp.profile_zone(gpu_profiler_, "UI");
+        ImGui_ImplVulkan_RenderDrawData(
+            ImGui::GetDrawData(), main_command_buffer_.buffer());
+      }
+    }
+    record_zone.reset();
+    record_ms_ = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - record_start)
+                     .count();
+
+    // Built after the pass so the next frame can cull against it
+    if (occlusion_culling_) {
+      auto hiz_zone = cmd_guard.profile_zone(gpu_profiler_, "Hi-Z build");
+      depth_pyramid_.record_build(cmd_guard, depth_image_.image, view_proj);
     }
+  }
 
-    auto submit_info = VkSubmitInfo{};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    VkPipelineStageFlags wait_stage =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    submit_info.pWaitDstStageMask = &wait_stage;
+  auto submit_info = VkSubmitInfo{};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  VkPipelineStageFlags wait_stage =
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  submit_info.pWaitDstStageMask = &wait_stage;
+  if (!headless_) {
     submit_info.waitSemaphoreCount = 1;
     submit_info.pWaitSemaphores = &present_semaphore_;
     submit_info.signalSemaphoreCount = 1;
     submit_info.pSignalSemaphores = &render_semaphore_;
-    submit_info.commandBufferCount = 1;
-    auto buf = main_command_buffer_.buffer();
-    submit_info.pCommandBuffers = &buf;
+  }
+  submit_info.commandBufferCount = 1;
+  auto buf = main_command_buffer_.buffer();
+  submit_info.pCommandBuffers = &buf;
+  {
+    auto submit_zone = profiling::Zone{"Submit"};
     VK_CHECK(vkQueueSubmit(graphics_queue_, 1, &submit_info, render_fence_));
+  }
 
-    auto present_info = VkPresentInfoKHR{};
-    present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    present_info.pSwapchains = &swapchain_;
-    present_info.swapchainCount = 1;
-    present_info.pWaitSemaphores = &render_semaphore_;
-    present_info.waitSemaphoreCount = 1;
-    present_info.pImageIndices = &swapchain_image_index;
-    VK_CHECK(vkQueuePresentKHR(graphics_queue_, &present_info));
-    frame_number++;
+  // Counted from submission, as headless frames are never presented
+  if (frame_number == 0) {
+    profiling::startup_timeline().mark_first_frame();
+    profiling::startup_timeline().print(std::cout);
+  }
 
-    if (frame_number % 30 == 0) {
-      auto now = std::chrono::system_clock::now();
-      auto elapsed = now - start;
-      auto mili =
-          std::chrono::duration_cast<std::chrono::milliseconds>(elapsed);
-      std::cout << "fps: " << 30.0 / ((float)mili.count() / 1000) << std::endl;
-      start = now;
+  if (headless_) {
+    return;
+  }
+
+  auto present_info = VkPresentInfoKHR{};
+  present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+  present_info.pSwapchains = &swapchain_;
+  present_info.swapchainCount = 1;
+  present_info.pWaitSemaphores = &render_semaphore_;
+  present_info.waitSemaphoreCount = 1;
+  present_info.pImageIndices = &swapchain_image_index;
+  auto present_zone = profiling::Zone{"Present"};
+  VK_CHECK(vkQueuePresentKHR(graphics_queue_, &present_info));
+}
+
+void Engine::record_camera_path(const std::string &path)
+{
+  camera_path_file_ = path;
+  camera_path_.clear();
+}
+
+void Engine::compare_with(const std::string &earlier_path)
+{
+  changes_ = analysis::ChangeDetector{earlier_path, chunks_};
+  shading_ = shading_mode::change;
+}
+
+void Engine::use_tile_cache(const std::string &dir)
+{
+  tile_cache_dir_ = dir;
+}
+
+void Engine::fill_holes(const analysis::hole_options &options)
+{
+  hole_options_ = options;
+}
+
+void Engine::write_frame_stats_on_exit(const std::string &path)
+{
+  frame_stats_file_ = path;
+}
+
+void Engine::benchmark(const benchmark_options &options)
+{
+  auto frame_count = options.frames;
+  auto csv_path = options.csv_path;
+  if (!options.camera_path.empty()) {
+    if (!camera_path_.load(options.camera_path)) {
+      std::cout << "Could not load camera path " << options.camera_path
+                << std::endl;
+      return;
     }
+    frame_count = camera_path_.size();
+    // A replay always leaves a per-frame report behind
+    if (csv_path.empty()) {
+      csv_path = options.camera_path + ".csv";
+    }
+  }
+
+  // Timings are only comparable once everything is loaded
+  finish_loading();
+
+  frustum_culling_ = options.frustum_culling;
+  occlusion_culling_ = options.occlusion_culling;
+  gpu_driven_ = options.gpu_driven && gpu_driven_supported_;
+  parallel_recording_ = options.parallel_recording;
+  clipmap_terrain_ = options.clipmap;
+  if (options.gpu_hillshade) {
+    shading_ = shading_mode::hillshade;
+    gpu_hillshade_enabled_ = true;
+    shading_dirty_ = true;
   }
+
+  auto csv = std::ofstream{};
+  if (!csv_path.empty()) {
+    csv.open(csv_path);
+    csv << "frame,frame_ms,record_ms,visible,culled,occluded\n";
+  }
+
+  std::cout << "Benchmarking " << frame_count << " frames" << std::endl;
+
+  auto e = SDL_Event{};
+  auto total_ms = 0.0;
+  auto stats = profiling::FrameStats{std::max(1u, frame_count)};
+  auto last = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < frame_count; i++) {
+    // Keep the window responsive, but only a camera path moves the camera
+    while (!headless_ && SDL_PollEvent(&e) != 0) {
+    }
+    if (!camera_path_.empty()) {
+      camera_path_.apply(i, camera_);
+    }
+    // So every frame pays for a dispatch, as dragging the slider would
+    if (gpu_hillshading()) {
+      sun_.azimuth_deg = float(i % 360);
+      gpu_hillshade_pending_ = true;
+    }
+
+    draw_frame(i, false);
+
+    auto frame_ms = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - last)
+                        .count();
+    total_ms += frame_ms;
+    stats.add(frame_ms);
+
+    if (csv.is_open()) {
+      csv << i << "," << frame_ms << "," << record_ms_ << "," << visible_meshes_
+          << "," << culled_meshes_ << "," << occluded_meshes_ << "\n";
+    }
+    // After the bookkeeping, so it isn't counted in the next frame
+    last = std::chrono::steady_clock::now();
+  }
+  VK_CHECK(vkWaitForFences(device_, 1, &render_fence_, true, 1e9));
+
+  if (!options.screenshot_path.empty()) {
+    save_screenshot(options.screenshot_path);
+  }
+
+  auto frames = std::max(1u, frame_count);
+  auto frame_times = stats.summarise();
+  auto summary = std::ostringstream{};
+  summary << "{\"frames\": " << frame_count
+          << ", \"width\": " << win_size_.width
+          << ", \"height\": " << win_size_.height
+          << ", \"headless\": " << (headless_ ? "true" : "false")
+          << ", \"gpu_driven\": " << (gpu_driven_ ? "true" : "false")
+          << ", \"clipmap\": " << (clipmap_terrain_ ? "true" : "false")
+          << ", \"gpu_hillshade\": "
+          << (gpu_hillshading() ? "true" : "false")
+          << ", \"total_ms\": " << total_ms
+          << ", \"mean_ms\": " << frame_times.mean
+          << ", \"p50_ms\": " << frame_times.p50
+          << ", \"p95_ms\": " << frame_times.p95
+          << ", \"p99_ms\": " << frame_times.p99
+          << ", \"max_ms\": " << frame_times.max
+          << ", \"stutters\": " << frame_times.stutters
+          << ", \"fps\": " << (total_ms > 0 ? 1000.0 * frames / total_ms : 0)
+          << ", \"gpu_ms\": {";
+  auto gpu_zones = gpu_profiler_.averages();
+  for (size_t i = 0; i < gpu_zones.size(); i++) {
+    summary << (i ? ", " : "") << "\"" << gpu_zones[i].name
+            << "\": " << gpu_zones[i].ms;
+  }
+  summary << "}}";
+  std::cout << summary.str() << std::endl;
+  if (!options.json_path.empty()) {
+    std::ofstream{options.json_path} << summary.str() << "\n";
+  }
+  if (!frame_stats_file_.empty()) {
+    stats.write_json(frame_stats_file_);
+  }
+}
+
+void Engine::save_screenshot(const std::string &path)
+{
+  if (!headless_) {
+    std::cout << "Screenshots are only taken of headless runs" << std::endl;
+    return;
+  }
+
+  auto size = win_size_.width * win_size_.height * 4;
+  auto buffer = create_buffer(
+      size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+  immediate_submit([&](VkCommandBuffer cmd) {
+    auto barrier = VkImageMemoryBarrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = offscreen_image_.image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+        &barrier);
+
+    auto region = VkBufferImageCopy{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {win_size_.width, win_size_.height, 1};
+    vkCmdCopyImageToBuffer(cmd, offscreen_image_.image,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer.buffer, 1, &region);
+  });
+
+  void *data;
+  vmaMapMemory(allocator_, buffer.allocation, &data);
+  vmaInvalidateAllocation(allocator_, buffer.allocation, 0, VK_WHOLE_SIZE);
+  auto pixels = static_cast<const uint8_t *>(data);
+
+  auto file = std::ofstream{path, std::ios::binary};
+  file << "P6\n" << win_size_.width << " " << win_size_.height << "\n255\n";
+  for (uint32_t i = 0; i < win_size_.width * win_size_.height; i++) {
+    file.write(reinterpret_cast<const char *>(&pixels[i * 4]), 3);
+  }
+
+  vmaUnmapMemory(allocator_, buffer.allocation);
+  vmaDestroyBuffer(allocator_, buffer.buffer, buffer.allocation);
+  std::cout << "Wrote " << path << std::endl;
 }
 
 void Engine::init_vulkan()
 {
+  auto phase = profiling::startup_timeline().phase("init_vulkan");
   auto builder = vkb::InstanceBuilder{};
   auto inst_ret = builder.set_app_name("Siliconia")
                       .request_validation_layers(true)
                       .require_api_version(1, 1, 0)
                       .use_default_debug_messenger()
+                      .set_headless(headless_)
                       .build();
   auto inst = inst_ret.value();
   instance_ = inst.instance;
   debug_messenger_ = inst.debug_messenger;
 
-  SDL_Vulkan_CreateSurface(window_, instance_, &surface_);
-
   auto selector = vkb::PhysicalDeviceSelector{inst};
-  auto physical_device =
-      selector.set_minimum_version(1, 1).set_surface(surface_).select().value();
+  selector.set_minimum_version(1, 1);
+  if (!headless_) {
+    SDL_Vulkan_CreateSurface(window_, instance_, &surface_);
+    selector.set_surface(surface_);
+  }
+  auto physical_device = selector.select().value();
+
+  // The GPU driven path issues one indirect draw per tile with the tile index
+  // as the first instance, so it is only offered when both are supported
+  auto supported_features = VkPhysicalDeviceFeatures{};
+  vkGetPhysicalDeviceFeatures(
+      physical_device.physical_device, &supported_features);
+  gpu_driven_supported_ = supported_features.multiDrawIndirect &&
+                          supported_features.drawIndirectFirstInstance;
+  if (gpu_driven_supported_) {
+    physical_device.features.multiDrawIndirect = VK_TRUE;
+    physical_device.features.drawIndirectFirstInstance = VK_TRUE;
+  }
+
   auto device_builder = vkb::DeviceBuilder{physical_device};
   auto device = device_builder.build().value();
   device_ = device.device;
@@ -304,6 +1234,18 @@ void Engine::init_vulkan()
 }
 
 void Engine::init_swapchain()
+{
+  auto phase = profiling::startup_timeline().phase("init_swapchain");
+  if (headless_) {
+    init_offscreen_target();
+  } else {
+    init_window_swapchain();
+  }
+
+  init_depth_image();
+}
+
+void Engine::init_window_swapchain()
 {
   auto swapchain_builder =
       vkb::SwapchainBuilder{chosen_gpu_, device_, surface_};
@@ -316,11 +1258,41 @@ void Engine::init_swapchain()
   swapchain_images_ = swapchain.get_images().value();
   swapchain_image_views_ = swapchain.get_image_views().value();
   swapchain_image_format_ = swapchain.image_format;
+}
+
+void Engine::init_offscreen_target()
+{
+  // Stands in for a one image swapchain, the last pass leaves it ready to
+  // be copied out
+  swapchain_image_format_ = VK_FORMAT_R8G8B8A8_SRGB;
+  auto extent = VkExtent3D{win_size_.width, win_size_.height, 1};
+  auto img_info = vk::image_create_info(swapchain_image_format_,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      extent);
+
+  auto img_alloc_info = VmaAllocationCreateInfo{};
+  img_alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+  VK_CHECK(vmaCreateImage(allocator_, &img_info, &img_alloc_info,
+      &offscreen_image_.image, &offscreen_image_.allocation, nullptr));
+
+  auto view_info = vk::image_view_create_info(swapchain_image_format_,
+      offscreen_image_.image, VK_IMAGE_ASPECT_COLOR_BIT);
+  auto view = VkImageView{};
+  VK_CHECK(vkCreateImageView(device_, &view_info, nullptr, &view));
+
+  swapchain_images_ = {offscreen_image_.image};
+  swapchain_image_views_ = {view};
+}
 
+void Engine::init_depth_image()
+{
   auto depth_image_extent = VkExtent3D{win_size_.width, win_size_.height, 1};
   depth_format_ = VK_FORMAT_D32_SFLOAT;
   auto dimg_info = vk::image_create_info(depth_format_,
-      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depth_image_extent);
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+          VK_IMAGE_USAGE_SAMPLED_BIT,
+      depth_image_extent);
 
   auto dimg_alloc_info = VmaAllocationCreateInfo{};
   dimg_alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
@@ -341,6 +1313,13 @@ void Engine::init_commands()
 {
   command_pool_ = vk::CommandPool{device_, graphics_queue_family_};
   main_command_buffer_ = command_pool_.allocate_buffer();
+  ui_command_buffer_ =
+      command_pool_.allocate_buffer(VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+
+  // The main thread helps while it waits, so it gets a slice too
+  auto slices = jobs::job_system().thread_count() + 1;
+  recorder_ = std::make_unique<ParallelRecorder>(
+      device_, graphics_queue_family_, slices);
 
   upload_context_.command_pool =
       vk::CommandPool{device_, graphics_queue_family_};
@@ -356,7 +1335,9 @@ void Engine::init_default_renderpass()
   colour_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
   colour_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
   colour_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colour_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  colour_attachment.finalLayout = headless_
+                                      ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                      : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
   auto colour_attachment_ref = VkAttachmentReference{};
   colour_attachment_ref.attachment = 0;
@@ -440,38 +1421,77 @@ void Engine::init_sync_structures()
       &upload_context_.upload_fence));
 }
 
-bool Engine::load_shader_module(const char *path, VkShaderModule *shader_module)
+void Engine::init_descriptors()
 {
-  auto file = std::ifstream{path, std::ios::ate | std::ios::binary};
-  if (!file.is_open())
-    return false;
+  VkDescriptorPoolSize pool_sizes[] = {
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 32},
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 32},
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 32},
+      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 32}};
 
-  auto file_size = file.tellg();
-  auto buffer = std::vector<uint32_t>(file_size / sizeof(uint32_t));
-  file.seekg(0);
-  file.read((char *)buffer.data(), file_size);
-  file.close();
+  auto pool_info = VkDescriptorPoolCreateInfo{};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+  pool_info.maxSets = 32;
+  pool_info.poolSizeCount = std::size(pool_sizes);
+  pool_info.pPoolSizes = pool_sizes;
 
-  auto create_info = VkShaderModuleCreateInfo{};
-  create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  create_info.codeSize = buffer.size() * sizeof(uint32_t);
-  create_info.pCode = buffer.data();
+  VK_CHECK(
+      vkCreateDescriptorPool(device_, &pool_info, nullptr, &descriptor_pool_));
 
-  if (vkCreateShaderModule(device_, &create_info, nullptr, shader_module) !=
-      VK_SUCCESS)
-    return false;
+  if (!gpu_driven_supported_) {
+    return;
+  }
 
-  return true;
+  VkDescriptorSetLayoutBinding bindings[] = {
+      vk::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT, 0),
+      vk::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          VK_SHADER_STAGE_COMPUTE_BIT, 1),
+      vk::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          VK_SHADER_STAGE_COMPUTE_BIT, 2),
+      vk::descriptor_set_layout_binding(
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_SHADER_STAGE_COMPUTE_BIT, 3),
+      vk::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+          VK_SHADER_STAGE_COMPUTE_BIT, 4)};
+
+  auto set_info = VkDescriptorSetLayoutCreateInfo{};
+  set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_info.bindingCount = std::size(bindings);
+  set_info.pBindings = bindings;
+
+  VK_CHECK(vkCreateDescriptorSetLayout(
+      device_, &set_info, nullptr, &scene_set_layout_));
+
+  auto alloc_info = VkDescriptorSetAllocateInfo{};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = descriptor_pool_;
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts = &scene_set_layout_;
+
+  VK_CHECK(vkAllocateDescriptorSets(device_, &alloc_info, &scene_set_));
+
+  cull_data_buffer_ = create_buffer(sizeof(vk::CullData),
+      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+  auto cull_data_info =
+      VkDescriptorBufferInfo{cull_data_buffer_.buffer, 0, sizeof(vk::CullData)};
+  auto write = vk::write_descriptor_buffer(
+      VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, scene_set_, &cull_data_info, 4);
+  vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
 }
 
 void Engine::init_pipelines()
 {
+  auto phase = profiling::startup_timeline().phase("init_pipelines");
   auto frag = VkShaderModule{};
-  if (!load_shader_module("../shaders/triangle.frag.spv", &frag)) {
+  if (!vk::load_shader_module(
+          device_, "../shaders/triangle.frag.spv", &frag)) {
     std::cout << "Could not load frag shader" << std::endl;
   }
   auto vertex = VkShaderModule{};
-  if (!load_shader_module("../shaders/triangle.vert.spv", &vertex)) {
+  if (!vk::load_shader_module(
+          device_, "../shaders/triangle.vert.spv", &vertex)) {
     std::cout << "Could not load vert shader" << std::endl;
   }
 
@@ -524,14 +1544,118 @@ void Engine::init_pipelines()
   builder.depth_stencil =
       vk::depth_stencil_create_info(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
 
-  pipeline_ = builder.build_pipeline(device_, renderpass_);
+  pipeline_ =
+      builder.build_pipeline(device_, renderpass_, pipeline_cache_.cache());
+
+  // Contours are drawn over the terrain with the same shaders
+  builder.assembly =
+      vk::input_assembly_state_create_info(VK_PRIMITIVE_TOPOLOGY_LINE_LIST);
+  builder.depth_stencil =
+      vk::depth_stencil_create_info(true, false, VK_COMPARE_OP_LESS_OR_EQUAL);
+  contour_pipeline_ =
+      builder.build_pipeline(device_, renderpass_, pipeline_cache_.cache());
+
+  if (gpu_driven_supported_) {
+    init_gpu_culling_pipelines();
+  }
+
+  vkDestroyShaderModule(device_, vertex, nullptr);
+  vkDestroyShaderModule(device_, frag, nullptr);
+}
+
+void Engine::init_gpu_culling_pipelines()
+{
+  auto cull = VkShaderModule{};
+  if (!vk::load_shader_module(
+          device_, "../shaders/cull.comp.spv", &cull)) {
+    std::cout << "Could not load cull shader" << std::endl;
+  }
+  auto frag = VkShaderModule{};
+  if (!vk::load_shader_module(
+          device_, "../shaders/triangle.frag.spv", &frag)) {
+    std::cout << "Could not load frag shader" << std::endl;
+  }
+  auto vertex = VkShaderModule{};
+  if (!vk::load_shader_module(
+          device_, "../shaders/terrain_indirect.vert.spv", &vertex)) {
+    std::cout << "Could not load indirect vert shader" << std::endl;
+  }
+
+  auto cull_layout_info = vk::pipeline_layout_create_info();
+  cull_layout_info.setLayoutCount = 1;
+  cull_layout_info.pSetLayouts = &scene_set_layout_;
+
+  VK_CHECK(vkCreatePipelineLayout(
+      device_, &cull_layout_info, nullptr, &cull_pipeline_layout_));
+
+  auto compute_builder = vk::ComputePipelineBuilder{};
+  compute_builder.shader_stage = vk::pipeline_shader_stage_create_info(
+      VK_SHADER_STAGE_COMPUTE_BIT, cull);
+  compute_builder.layout = cull_pipeline_layout_;
+  cull_pipeline_ =
+      compute_builder.build_pipeline(device_, pipeline_cache_.cache());
+
+  auto draw_push_constant = VkPushConstantRange{};
+  draw_push_constant.size = sizeof(glm::mat4);
+  draw_push_constant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  auto draw_layout_info = vk::pipeline_layout_create_info();
+  draw_layout_info.setLayoutCount = 1;
+  draw_layout_info.pSetLayouts = &scene_set_layout_;
+  draw_layout_info.pushConstantRangeCount = 1;
+  draw_layout_info.pPushConstantRanges = &draw_push_constant;
+
+  VK_CHECK(vkCreatePipelineLayout(
+      device_, &draw_layout_info, nullptr, &indirect_pipeline_layout_));
+
+  auto builder = vk::PipelineBuilder{};
+  builder.shader_stages.push_back(vk::pipeline_shader_stage_create_info(
+      VK_SHADER_STAGE_VERTEX_BIT, vertex));
+  builder.shader_stages.push_back(vk::pipeline_shader_stage_create_info(
+      VK_SHADER_STAGE_FRAGMENT_BIT, frag));
+  builder.assembly =
+      vk::input_assembly_state_create_info(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+
+  builder.viewport.x = 0.0f;
+  builder.viewport.y = 0.0f;
+  builder.viewport.width = (float)win_size_.width;
+  builder.viewport.height = (float)win_size_.height;
+  builder.viewport.minDepth = 0.0f;
+  builder.viewport.maxDepth = 1.0f;
+
+  builder.scissor.offset = {0, 0};
+  builder.scissor.extent = win_size_;
+
+  builder.rasteriser =
+      vk::rasterisation_state_create_info(VK_POLYGON_MODE_FILL);
+  builder.multisampling = vk::multisample_state_create_info();
+  builder.colour_blend_attachment = vk::colour_blend_attachment_state();
+  builder.layout = indirect_pipeline_layout_;
+
+  auto desc = vk::Vertex::get_vertex_description();
+  builder.vertex_input_info = vk::vertex_input_state_create_info();
+  builder.vertex_input_info.pVertexAttributeDescriptions =
+      desc.attributes.data();
+  builder.vertex_input_info.vertexAttributeDescriptionCount =
+      desc.attributes.size();
+  builder.vertex_input_info.pVertexBindingDescriptions = desc.bindings.data();
+  builder.vertex_input_info.vertexBindingDescriptionCount =
+      desc.bindings.size();
+
+  builder.depth_stencil =
+      vk::depth_stencil_create_info(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+
+  indirect_pipeline_ =
+      builder.build_pipeline(device_, renderpass_, pipeline_cache_.cache());
 
+  vkDestroyShaderModule(device_, cull, nullptr);
   vkDestroyShaderModule(device_, vertex, nullptr);
   vkDestroyShaderModule(device_, frag, nullptr);
 }
 
 void Engine::init_imgui()
 {
+  auto phase = profiling::startup_timeline().phase("init_imgui");
   VkDescriptorPoolSize pool_sizes[] = {{VK_DESCRIPTOR_TYPE_SAMPLER, 1000},
       {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1000},
       {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1000},
@@ -564,6 +1688,7 @@ void Engine::init_imgui()
   init_info.Device = device_;
   init_info.Queue = graphics_queue_;
   init_info.DescriptorPool = imgui_pool_;
+  init_info.PipelineCache = pipeline_cache_.cache();
   init_info.MinImageCount = 3;
   init_info.ImageCount = 3;
 
@@ -574,56 +1699,435 @@ void Engine::init_imgui()
   ImGui_ImplVulkan_DestroyFontUploadObjects();
 }
 
-void Engine::load_meshes()
+void Engine::start_loading()
 {
-  auto gradient =
-      std::array<gradient_point, 2>{{{0.0, {0, 0, 0}}, {1.0, {255, 0, 0}}}};
+  const auto &headers = chunks_.headers();
+  if (headers.empty()) {
+    return;
+  }
 
-  auto cell_size = chunks_.chunks()[0].cell_size;
-  auto range = chunks_.range;
-  auto x_sf = 2.0f / ((float)chunks_.rect.width / cell_size);
-  auto z_sf = 2.0f / ((float)chunks_.rect.height / cell_size);
+  auto rect = chunks_.rect;
+  auto requests = std::vector<TileLoader::request>{};
+  auto bounds = std::vector<aabb>{};
+  for (const auto &header : headers) {
+    auto offset = tile_offset(header, rect);
+    auto centre =
+        offset + glm::vec3{header.ncols / 2.f, 0.f, header.nrows / 2.f};
+    requests.push_back({header.path, centre});
+    // Heights aren't known until the tile is parsed
+    bounds.push_back({{offset.x, -1e6f, offset.z},
+        {offset.x + header.ncols - 1, 1e6f, offset.z + header.nrows - 1}});
+  }
+  prefetcher_ = Prefetcher{std::move(bounds)};
+
+  auto cache = chunks::TileCache{};
+  if (!tile_cache_dir_.empty()) {
+    cache = chunks::TileCache{tile_cache_dir_,
+        hole_options_ ? hole_options_->max_hole_size : 0};
+  }
 
+  // Half the workers, leaving the rest for recording and analysis
+  auto max_jobs = std::max(1u, jobs::job_system().thread_count() / 2);
+  loader_ = std::make_unique<TileLoader>(std::move(requests),
+      [rect](const chunks::Chunk &chunk) { return mesh_chunk(chunk, rect); },
+      [this](TileLoader::loaded_tile &&tile) { add_tile(std::move(tile)); },
+      max_jobs, std::move(cache), hole_options_);
+}
+
+void Engine::finish_loading()
+{
+  while (loader_) {
+    integrate_loaded_tiles(true);
+  }
+}
+
+void Engine::integrate_loaded_tiles(bool wait)
+{
+  if (!loader_) {
+    // Background jobs still hand their results back after the tiles
+    jobs::job_system().run_main_tasks(std::chrono::milliseconds{4});
+    return;
+  }
+  auto zone = profiling::Zone{"Integrate tiles"};
+  loader_->set_focus(camera_.pos());
+  loader_->set_prefetch(prefetcher_.update(camera_));
+
+  // Uploads happen between frames, so they are capped to keep the frame
+  // rate up while loading
+  if (wait) {
+    while (!loader_->done()) {
+      jobs::job_system().run_main_task(true);
+    }
+  } else {
+    jobs::job_system().run_main_tasks(std::chrono::milliseconds{4});
+  }
+
+  // Colours depend on the range of every tile so far, and rebuilding the GPU
+  // scene copies every tile, so neither is done for each new tile
+  auto done = loader_->done();
+  auto now = std::chrono::steady_clock::now();
+  if (scene_dirty_ &&
+      (done || now - last_scene_update_ > std::chrono::seconds{1})) {
+    // New tiles also change their neighbours' borders
+    if (shading_ != shading_mode::elevation) {
+      if (cpu_derivatives()) {
+        update_derivatives();
+      }
+      recolour_meshes();
+    } else if (chunks_.range.min != coloured_range_.min ||
+               chunks_.range.max != coloured_range_.max) {
+      recolour_meshes();
+    }
+    if (gpu_driven_supported_) {
+      build_gpu_scene();
+    }
+    clipmap_.invalidate();
+    scene_dirty_ = false;
+    last_scene_update_ = now;
+  }
+
+  if (done) {
+    profiling::startup_timeline().mark_loaded();
+    std::cout << "Loaded " << meshes_.size() << " of " << loader_->total()
+              << " tiles after "
+              << *profiling::startup_timeline().time_to_loaded_ms() << "ms"
+              << std::endl;
+    loader_.reset();
+  }
+}
+
+void Engine::add_tile(TileLoader::loaded_tile &&tile)
+{
+  prefetcher_.tile_loaded(tile.index, tile.prefetched);
+  picker_.add(std::move(tile.pyramid), glm::vec3{tile.mesh.model_matrix[3]});
+  chunks_.add(std::move(tile.chunk));
+  tile_levels_.push_back(std::move(tile.levels.mean));
+  colour_mesh(tile.mesh, chunks_.chunks().back(), chunks_.range);
+  contours_.tile_added(chunks_, chunks_.chunks().size() - 1);
+  if (changes_.valid()) {
+    changes_.tile_added(chunks_.chunks().size() - 1);
+  }
+  profile_stale_ |= profile_points_.size() > 1;
+  upload_mesh(tile.mesh);
+  meshes_.push_back(std::move(tile.mesh));
+  scene_dirty_ = true;
+  gpu_hillshade_pending_ = true;
+}
+
+glm::mat4 Engine::projection() const
+{
+  return camera_.projection();
+}
+
+glm::dvec2 Engine::hover_map_position() const
+{
+  auto rect = chunks_.rect;
+  auto cell_size = double(chunks_.chunks()[hover_->tile].cell_size);
+  // Mesh vertices sit on cell centres
+  return {rect.x + (hover_->position.x + 0.5) * cell_size,
+      rect.y + double(rect.height) - (hover_->position.z + 0.5) * cell_size};
+}
+
+void Engine::update_hover()
+{
+  auto zone = profiling::Zone{"Pick"};
+  auto &io = ImGui::GetIO();
+  hover_.reset();
+  if (io.WantCaptureMouse || io.DisplaySize.x <= 0 || io.DisplaySize.y <= 0) {
+    return;
+  }
+
+  // Back through the same projection the frame is drawn with, from the
+  // cursor to a point in front of the camera
+  auto ndc = glm::vec2{io.MousePos.x / io.DisplaySize.x,
+                 io.MousePos.y / io.DisplaySize.y} *
+                 2.f -
+             1.f;
+  auto inverse = glm::inverse(projection() * camera_.matrix());
+  auto point = inverse * glm::vec4{ndc, 0.5f, 1.f};
+  auto dir = glm::vec3{point} / point.w - camera_.pos();
+
+  auto start = std::chrono::steady_clock::now();
+  hover_ = picker_.pick(camera_.pos(), dir, chunks_.chunks());
+  pick_ms_ = std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - start)
+                 .count();
+}
+
+Clipmap::HeightFn Engine::clipmap_heights() const
+{
+  // World units are cells, with z running down from the top of the extent.
+  // Samples are taken at cell centres, as the tile meshes' vertices are.
+  auto rect = chunks_.rect;
+  auto cell_size = chunks_.headers().empty()
+                       ? 1.0
+                       : double(chunks_.headers().front().cell_size);
+  auto fill = chunks_.chunks().empty() ? 0.f : chunks_.range.min;
+  auto hint = static_cast<const chunks::Chunk *>(nullptr);
+  return [this, rect, cell_size, fill, hint](
+             float x, float z, uint32_t level) mutable {
+    auto map_x = rect.x + (x + 0.5) * cell_size;
+    auto map_y = rect.y + double(rect.height) - (z + 0.5) * cell_size;
+    hint = chunks_.chunk_at(map_x, map_y, hint);
+    if (!hint) {
+      return fill;
+    }
+
+    // Coarser levels average the cells between their samples rather than
+    // picking one, which would alias
+    auto index = size_t(hint - chunks_.chunks().data());
+    if (level == 0 || level > tile_levels_[index].size()) {
+      return chunks_.height_at(map_x, map_y, hint).value_or(fill);
+    }
+    const auto &reduced = tile_levels_[index][level - 1];
+    auto r = reduced.rect();
+    auto col = std::min<unsigned int>(
+        reduced.ncols - 1, (map_x - r.x) / reduced.cell_size);
+    auto row = std::min<unsigned int>(reduced.nrows - 1,
+        (r.y + double(r.height) - map_y) / reduced.cell_size);
+    auto v = reduced.data[col + row * reduced.ncols];
+    return v == reduced.nodata_value ? fill : v;
+  };
+}
+
+void Engine::recolour_meshes()
+{
+  auto zone = profiling::Zone{"Recolour meshes"};
+  for (size_t i = 0; i < meshes_.size(); i++) {
+    auto &mesh = meshes_[i];
+    // The GPU lights the elevation colours afterwards
+    auto grids = i < derivatives_.size() && cpu_derivatives()
+                     ? &derivatives_[i]
+                     : nullptr;
+    colour_mesh(mesh, chunks_.chunks()[i], chunks_.range, shading_, grids);
+    if (shading_ == shading_mode::viewshed && viewshed_) {
+      overlay_viewshed(mesh, chunks_.chunks()[i], *viewshed_);
+    }
+    if (shading_ == shading_mode::change) {
+      colour_change(mesh, changes_.difference(i), change_range_);
+    }
+
+    void *data;
+    vmaMapMemory(allocator_, mesh.vertex_buffer.allocation, &data);
+    memcpy(data, mesh.vertices.data(),
+        mesh.vertices.size() * sizeof(vk::Vertex));
+    vmaUnmapMemory(allocator_, mesh.vertex_buffer.allocation);
+  }
+  coloured_range_ = chunks_.range;
+  gpu_hillshade_pending_ = true;
+}
+
+bool Engine::gpu_hillshading() const
+{
+  return shading_ == shading_mode::hillshade && gpu_hillshade_enabled_ &&
+         gpu_hillshade_.valid();
+}
+
+bool Engine::cpu_derivatives() const
+{
+  return (shading_ == shading_mode::hillshade ||
+             shading_ == shading_mode::slope ||
+             shading_ == shading_mode::aspect) &&
+         !gpu_hillshading();
+}
+
+void Engine::update_viewshed()
+{
+  // The job reads copies of the tiles in reach, as the collection's tiles
+  // move when it grows
+  const auto &options = viewshed_options_;
+  auto reaches = [&](const chunks::Chunk &chunk) {
+    auto r = chunk.rect();
+    auto margin = double(options.radius) + chunk.cell_size;
+    return r.x - margin < options.x &&
+           options.x < r.x + double(r.width) + margin &&
+           r.y - margin < options.y &&
+           options.y < r.y + double(r.height) + margin;
+  };
+  auto headers = std::vector<chunks::Chunk>{};
+  for (const auto &header : chunks_.headers()) {
+    if (reaches(header)) {
+      headers.push_back(header);
+    }
+  }
+  auto tiles = std::make_shared<chunks::ChunkCollection>(std::move(headers));
   for (const auto &chunk : chunks_.chunks()) {
-    auto mesh = vk::Mesh{};
-    auto x_offset = (chunk.rect().x - chunks_.rect.x) / cell_size;
-    auto z_offset = chunks_.rect.height / cell_size -
-                    (chunk.rect().y - chunks_.rect.y) / cell_size -
-                    chunk.rect().height / cell_size;
-
-    for (unsigned int j = 0; j < chunk.nrows; j++) {
-      for (unsigned int i = 0; i < chunk.ncols; i++) {
-        auto v = chunk.data[i + j * chunk.ncols];
-        auto c = get_colour(gradient, chunk.nodata_value, range, v);
-
-        auto vert = vk::Vertex(glm::vec3{i, -v, j}, c.to_glm());
-        mesh.vertices.push_back(std::move(vert));
-
-        if (i < chunk.ncols - 1 && j < chunk.nrows - 1) {
-          mesh.indices.push_back(i + j * chunk.ncols);       // tl
-          mesh.indices.push_back((i + 1) + j * chunk.ncols); // tr
-          mesh.indices.push_back(i + (j + 1) * chunk.ncols); // bl
-
-          mesh.indices.push_back((i + 1) + j * chunk.ncols);       // tr
-          mesh.indices.push_back((i + 1) + (j + 1) * chunk.ncols); // br
-          mesh.indices.push_back(i + (j + 1) * chunk.ncols);       // bl
-        }
+    if (reaches(chunk)) {
+      tiles->add(chunks::Chunk{chunk});
+    }
+  }
+
+  auto generation = ++viewshed_generation_;
+  viewshed_running_ = true;
+  jobs::job_system().spawn_background(
+      [this, alive = alive_, tiles, options, generation] {
+        auto start = std::chrono::steady_clock::now();
+        auto grid = std::make_shared<std::optional<analysis::viewshed_grid>>(
+            analysis::compute_viewshed(*tiles, options));
+        auto ms = std::chrono::duration<float, std::milli>(
+            std::chrono::steady_clock::now() - start)
+                      .count();
+        jobs::job_system().post_main([this, alive, grid, ms, generation] {
+          if (!*alive || generation != viewshed_generation_) {
+            return;
+          }
+          viewshed_ = std::move(*grid);
+          viewshed_ms_ = ms;
+          viewshed_running_ = false;
+          shading_ = shading_mode::viewshed;
+          shading_dirty_ = true;
+        });
+      });
+}
+
+void Engine::update_contours()
+{
+  auto start = std::chrono::steady_clock::now();
+  auto changed = contours_.update(chunks_);
+  if (changed.empty()) {
+    return;
+  }
+  contour_buffers_.resize(meshes_.size());
+  contour_vertex_counts_.resize(meshes_.size());
+  for (auto i : changed) {
+    auto &buffer = contour_buffers_[i];
+    if (buffer.buffer != VK_NULL_HANDLE) {
+      vmaDestroyBuffer(allocator_, buffer.buffer, buffer.allocation);
+      buffer = {};
+    }
+    const auto &lines = contours_.lines(i);
+    contour_vertex_counts_[i] = lines.size();
+    if (lines.empty()) {
+      continue;
+    }
+
+    // Heights are negated like the meshes', and lifted a little so the
+    // terrain doesn't cover them
+    auto vertices = std::vector<vk::Vertex>{};
+    vertices.reserve(lines.size());
+    for (const auto &p : lines) {
+      vertices.emplace_back(
+          glm::vec3{p.x, -p.y - 0.5f, p.z}, glm::vec3{1.f, 1.f, 0.6f});
+    }
+    buffer = create_buffer(vertices.size() * sizeof(vk::Vertex),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    void *data;
+    vmaMapMemory(allocator_, buffer.allocation, &data);
+    memcpy(data, vertices.data(), vertices.size() * sizeof(vk::Vertex));
+    vmaUnmapMemory(allocator_, buffer.allocation);
+  }
+  contours_ms_ = std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - start)
+                     .count();
+}
+
+void Engine::update_profile()
+{
+  auto start = std::chrono::steady_clock::now();
+  auto points = profile_points_;
+  if (drawing_profile_ && hover_ && !points.empty()) {
+    points.push_back(hover_map_position());
+  }
+  profile_ = analysis::sample_profile(chunks_, points, profile_samples_);
+  profile_stale_ = false;
+
+  // Back into the world space the meshes are drawn in, broken where there
+  // is no data, and lifted like the contours
+  profile_line_.clear();
+  if (!chunks_.chunks().empty()) {
+    auto rect = chunks_.rect;
+    auto cell_size = double(chunks_.chunks().front().cell_size);
+    auto top = rect.y + double(rect.height);
+    auto world = [&](size_t i) {
+      auto p = profile_.points[i];
+      return glm::vec3{(p.x - rect.x) / cell_size - 0.5,
+          -profile_.elevations[i] - 0.5f, (top - p.y) / cell_size - 0.5};
+    };
+    for (size_t i = 1; i < profile_.points.size(); i++) {
+      if (std::isnan(profile_.elevations[i - 1]) ||
+          std::isnan(profile_.elevations[i])) {
+        continue;
       }
+      profile_line_.emplace_back(world(i - 1), glm::vec3{0.f, 1.f, 1.f});
+      profile_line_.emplace_back(world(i), glm::vec3{0.f, 1.f, 1.f});
     }
-    mesh.model_matrix = glm::translate(glm::mat4(1), {x_offset, 0, z_offset});
+  }
+  profile_line_dirty_ = true;
+  profile_ms_ = std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - start)
+                    .count();
+}
 
-    upload_mesh(mesh);
-    meshes_.push_back(std::move(mesh));
+void Engine::upload_profile_line()
+{
+  auto size = profile_line_.size() * sizeof(vk::Vertex);
+  if (size > profile_buffer_capacity_) {
+    if (profile_buffer_.buffer != VK_NULL_HANDLE) {
+      vmaDestroyBuffer(
+          allocator_, profile_buffer_.buffer, profile_buffer_.allocation);
+    }
+    // Doubled, as the line grows a point at a time while it is drawn
+    profile_buffer_capacity_ = std::max(size, 2 * profile_buffer_capacity_);
+    profile_buffer_ = create_buffer(profile_buffer_capacity_,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+  }
+  if (size > 0) {
+    void *data;
+    vmaMapMemory(allocator_, profile_buffer_.allocation, &data);
+    memcpy(data, profile_line_.data(), size);
+    vmaUnmapMemory(allocator_, profile_buffer_.allocation);
+  }
+  profile_vertex_count_ = profile_line_.size();
+  profile_line_dirty_ = false;
+}
+
+void Engine::record_gpu_hillshade(vk::CommandBufferGuard &cmd)
+{
+  // Both copies of the vertices, so either path draws the result. Tiles
+  // in the packed scene buffer are kept together to share a set.
+  auto targets = std::vector<GpuHillshade::target>{};
+  auto scene_targets = std::vector<GpuHillshade::target>{};
+  auto scene_offset = int32_t{0};
+  for (size_t i = 0; i < meshes_.size(); i++) {
+    const auto &chunk = chunks_.chunks()[i];
+    auto t = GpuHillshade::target{meshes_[i].vertex_buffer.buffer, 0,
+        chunk.ncols, chunk.nrows, chunk.nodata_value, float(chunk.cell_size)};
+    targets.push_back(t);
+    if (gpu_tile_count_ == meshes_.size()) {
+      t.buffer = scene_vertex_buffer_.buffer;
+      t.vertex_offset = scene_offset;
+      scene_targets.push_back(t);
+      scene_offset += meshes_[i].vertices.size();
+    }
+  }
+  targets.insert(targets.end(), scene_targets.begin(), scene_targets.end());
+  gpu_hillshade_.record(cmd, targets, sun_, chunks_.range);
+  gpu_hillshade_pending_ = false;
+}
+
+void Engine::update_derivatives()
+{
+  auto start = std::chrono::steady_clock::now();
+  derivatives_ = analysis::compute_derivatives(chunks_, sun_);
+  derivatives_ms_ = std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - start)
+                        .count();
+  derivative_cells_ = 0;
+  for (const auto &chunk : chunks_.chunks()) {
+    derivative_cells_ += size_t(chunk.ncols) * chunk.nrows;
   }
 }
 
 void Engine::upload_mesh(vk::Mesh &mesh)
 {
+  auto zone = profiling::Zone{"upload_mesh"};
   // Vertices
   auto buffer_info = VkBufferCreateInfo{};
   buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
   buffer_info.size = mesh.vertices.size() * sizeof(vk::Vertex);
-  buffer_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+  // Also a storage buffer so the hillshade pass can recolour it
+  buffer_info.usage =
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 
   auto alloc_info = VmaAllocationCreateInfo{};
   alloc_info.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
@@ -646,8 +2150,117 @@ void Engine::upload_mesh(vk::Mesh &mesh)
   vmaUnmapMemory(allocator_, mesh.index_buffer.allocation);
 }
 
+vk::AllocatorBuffer Engine::create_buffer(
+    size_t size, VkBufferUsageFlags usage, VmaMemoryUsage memory_usage)
+{
+  auto buffer_info = VkBufferCreateInfo{};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = size;
+  buffer_info.usage = usage;
+
+  auto alloc_info = VmaAllocationCreateInfo{};
+  alloc_info.usage = memory_usage;
+
+  auto buffer = vk::AllocatorBuffer{};
+  VK_CHECK(vmaCreateBuffer(allocator_, &buffer_info, &alloc_info,
+      &buffer.buffer, &buffer.allocation, nullptr));
+  return buffer;
+}
+
+void Engine::build_gpu_scene()
+{
+  auto phase = profiling::startup_timeline().phase("build_gpu_scene");
+  destroy_gpu_scene();
+  if (meshes_.empty()) {
+    return;
+  }
+
+  auto vertex_count = size_t{0};
+  auto index_count = size_t{0};
+  auto tiles = std::vector<vk::GpuTile>{};
+  for (const auto &mesh : meshes_) {
+    auto tile = vk::GpuTile{};
+    tile.model_matrix = mesh.model_matrix;
+    tile.bounds_min = glm::vec4{mesh.bounds.min, 1.f};
+    tile.bounds_max = glm::vec4{mesh.bounds.max, 1.f};
+    tile.index_count = mesh.indices.size();
+    tile.first_index = index_count;
+    tile.vertex_offset = vertex_count;
+    tiles.push_back(tile);
+
+    vertex_count += mesh.vertices.size();
+    index_count += mesh.indices.size();
+  }
+  gpu_tile_count_ = tiles.size();
+
+  // Also a storage buffer so the hillshade pass can recolour it
+  scene_vertex_buffer_ = create_buffer(vertex_count * sizeof(vk::Vertex),
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VMA_MEMORY_USAGE_CPU_TO_GPU);
+  scene_index_buffer_ = create_buffer(index_count * sizeof(uint32_t),
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+  void *vertex_data;
+  void *index_data;
+  vmaMapMemory(allocator_, scene_vertex_buffer_.allocation, &vertex_data);
+  vmaMapMemory(allocator_, scene_index_buffer_.allocation, &index_data);
+  for (const auto &mesh : meshes_) {
+    memcpy(vertex_data, mesh.vertices.data(),
+        mesh.vertices.size() * sizeof(vk::Vertex));
+    memcpy(index_data, mesh.indices.data(),
+        mesh.indices.size() * sizeof(uint32_t));
+    vertex_data = static_cast<vk::Vertex *>(vertex_data) + mesh.vertices.size();
+    index_data = static_cast<uint32_t *>(index_data) + mesh.indices.size();
+  }
+  vmaUnmapMemory(allocator_, scene_vertex_buffer_.allocation);
+  vmaUnmapMemory(allocator_, scene_index_buffer_.allocation);
+
+  tile_buffer_ = create_buffer(tiles.size() * sizeof(vk::GpuTile),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+  void *data;
+  vmaMapMemory(allocator_, tile_buffer_.allocation, &data);
+  memcpy(data, tiles.data(), tiles.size() * sizeof(vk::GpuTile));
+  vmaUnmapMemory(allocator_, tile_buffer_.allocation);
+
+  draw_buffer_ = create_buffer(
+      tiles.size() * sizeof(VkDrawIndexedIndirectCommand),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY);
+  cull_stats_buffer_ = create_buffer(2 * sizeof(uint32_t),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+  auto tile_info = VkDescriptorBufferInfo{tile_buffer_.buffer, 0, VK_WHOLE_SIZE};
+  auto draw_info = VkDescriptorBufferInfo{draw_buffer_.buffer, 0, VK_WHOLE_SIZE};
+  auto stats_info =
+      VkDescriptorBufferInfo{cull_stats_buffer_.buffer, 0, VK_WHOLE_SIZE};
+  VkWriteDescriptorSet writes[] = {
+      vk::write_descriptor_buffer(
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, scene_set_, &tile_info, 0),
+      vk::write_descriptor_buffer(
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, scene_set_, &draw_info, 1),
+      vk::write_descriptor_buffer(
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, scene_set_, &stats_info, 2)};
+  vkUpdateDescriptorSets(device_, std::size(writes), writes, 0, nullptr);
+  gpu_hillshade_pending_ = true;
+}
+
+void Engine::destroy_gpu_scene()
+{
+  if (gpu_tile_count_ == 0) {
+    return;
+  }
+  for (auto *buffer : {&scene_vertex_buffer_, &scene_index_buffer_,
+           &tile_buffer_, &draw_buffer_, &cull_stats_buffer_}) {
+    vmaDestroyBuffer(allocator_, buffer->buffer, buffer->allocation);
+    *buffer = vk::AllocatorBuffer{};
+  }
+  gpu_tile_count_ = 0;
+}
+
 void Engine::immediate_submit(std::function<void(VkCommandBuffer)> &&function)
 {
+  auto zone = profiling::Zone{"immediate_submit"};
   auto buf = upload_context_.command_pool.allocate_buffer();
 
   {
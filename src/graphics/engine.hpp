@@ -1,57 +1,163 @@
 #ifndef SILICONIA_ENGINE_HPP
 #define SILICONIA_ENGINE_HPP
 
+#include "analysis/change_detection.hpp"
+#include "analysis/contours.hpp"
+#include "analysis/derivatives.hpp"
+#include "analysis/hole_filling.hpp"
+#include "analysis/profile.hpp"
+#include "analysis/terrain_picker.hpp"
+#include "analysis/viewshed.hpp"
 #include "camera.hpp"
+#include "graphics/camera_path.hpp"
+#include "graphics/depth_pyramid.hpp"
+#include "graphics/gpu_hillshade.hpp"
+#include "graphics/parallel_recorder.hpp"
+#include "graphics/clipmap.hpp"
+#include "graphics/prefetcher.hpp"
+#include "graphics/tile_loader.hpp"
 #include "graphics/vk/init.hpp"
+#include "profiling/frame_stats.hpp"
 #include <SDL.h>
 #include <chunks/chunk_collection.hpp>
 #include <graphics/vk/command_buffer.hpp>
+#include <graphics/vk/pipeline_cache.hpp>
 #include <graphics/vk/types.hpp>
 #include <vk_mem_alloc.h>
 #include <vulkan/vulkan.h>
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <string>
 
 namespace siliconia::graphics {
 
+// What the tile vertices are coloured by
+enum class shading_mode {
+  elevation,
+  hillshade,
+  slope,
+  aspect,
+  viewshed,
+  change
+};
+
+struct benchmark_options {
+  uint32_t frames = 500;
+  std::string csv_path;
+  std::string json_path;
+  std::string screenshot_path;
+  // Replays a recorded camera path, one frame per keyframe
+  std::string camera_path;
+  bool frustum_culling = true;
+  bool occlusion_culling = false;
+  bool gpu_driven = false;
+  bool parallel_recording = false;
+  bool clipmap = false;
+  // Hillshades on the GPU, turning the sun every frame
+  bool gpu_hillshade = false;
+};
+
 class Engine {
 public:
-  Engine(uint32_t width, uint32_t height, chunks::ChunkCollection &&chunks);
+  // Headless engines have no window or swapchain and render offscreen
+  Engine(uint32_t width, uint32_t height, chunks::ChunkCollection &&chunks,
+      bool headless = false);
   ~Engine();
 
   void init();
   void run();
+  // Records the camera of every frame of run() to a file on exit
+  void record_camera_path(const std::string &path);
+  // Writes frame time percentiles and a histogram as JSON on exit
+  void write_frame_stats_on_exit(const std::string &path);
+  // Differences each tile against an earlier survey of the same area as it
+  // is loaded, shading by the change
+  void compare_with(const std::string &earlier_path);
+  // Reads tiles from a binary cache in the directory, caching any missing
+  // as they are parsed. Before init.
+  void use_tile_cache(const std::string &dir);
+  // Fills nodata holes in tiles as they are loaded, or reads them filled
+  // from the tile cache. Before init.
+  void fill_holes(const analysis::hole_options &options);
+  // Renders a fixed number of frames without the UI and reports the timings
+  // as JSON
+  void benchmark(const benchmark_options &options);
 
 private:
   void init_vulkan();
   void init_swapchain();
+  void init_window_swapchain();
+  void init_offscreen_target();
+  void init_depth_image();
   void init_commands();
   void init_default_renderpass();
   void init_framebuffers();
   void init_sync_structures();
-  bool load_shader_module(const char *path, VkShaderModule *shader_module);
+  void init_descriptors();
   void init_pipelines();
+  void init_gpu_culling_pipelines();
   void init_imgui();
-  void load_meshes();
+  void start_loading();
+  void finish_loading();
+  void integrate_loaded_tiles(bool wait);
+  void add_tile(TileLoader::loaded_tile &&tile);
+  void recolour_meshes();
+  // Recomputes derivatives_ for every added tile
+  void update_derivatives();
+  // Whether hillshade is being left to gpu_hillshade_
+  bool gpu_hillshading() const;
+  // Whether the shading needs derivatives_
+  bool cpu_derivatives() const;
+  // From the point under the cursor, as a background job. The last grid
+  // is drawn until the new one is handed back.
+  void update_viewshed();
+  // Recontours stale tiles and replaces their line buffers
+  void update_contours();
+  // Resamples the profile line, following the cursor while it is drawn
+  void update_profile();
+  // Copies the sampled line into profile_buffer_, growing it if need be
+  void upload_profile_line();
+  void record_gpu_hillshade(vk::CommandBufferGuard &cmd);
+  Clipmap::HeightFn clipmap_heights() const;
+  glm::mat4 projection() const;
+  // Picks the terrain under the cursor for the UI readout
+  void update_hover();
+  // Where hover_ is, in the same coordinates as chunks_.rect
+  glm::dvec2 hover_map_position() const;
   void upload_mesh(vk::Mesh &mesh);
+  void build_gpu_scene();
+  void destroy_gpu_scene();
+  vk::AllocatorBuffer create_buffer(
+      size_t size, VkBufferUsageFlags usage, VmaMemoryUsage memory_usage);
+  void draw_frame(uint32_t frame_number, bool ui);
+  void save_screenshot(const std::string &path);
   void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function);
 
   VkExtent2D  win_size_;
-  SDL_Window *window_;
+  bool headless_;
+  SDL_Window *window_ = nullptr;
 
   camera camera_;
+  CameraPath camera_path_;
+  std::string camera_path_file_;
+  profiling::FrameStats frame_stats_;
+  std::string frame_stats_file_;
 
   chunks::ChunkCollection chunks_;
 
   VkInstance instance_;
   VkDebugUtilsMessengerEXT  debug_messenger_;
   VkDevice device_;
-  VkSurfaceKHR surface_;
+  VkSurfaceKHR surface_ = VK_NULL_HANDLE;
   VkPhysicalDevice chosen_gpu_;
 
-  VkSwapchainKHR swapchain_;
+  VkSwapchainKHR swapchain_ = VK_NULL_HANDLE;
   VkFormat swapchain_image_format_;
   std::vector<VkImage> swapchain_images_;
   std::vector<VkImageView> swapchain_image_views_;
+  vk::AllocatedImage offscreen_image_{};
 
   VkImageView depth_image_view_;
   vk::AllocatedImage depth_image_;
@@ -62,6 +168,12 @@ private:
 
   vk::CommandPool command_pool_;
   vk::CommandBuffer main_command_buffer_;
+  vk::CommandBuffer ui_command_buffer_;
+  vk::GpuProfiler gpu_profiler_;
+
+  bool parallel_recording_ = false;
+  std::unique_ptr<ParallelRecorder> recorder_;
+  float record_ms_ = 0;
 
   VkRenderPass renderpass_;
   std::vector<VkFramebuffer> framebuffers_;
@@ -69,12 +181,104 @@ private:
   VkSemaphore present_semaphore_, render_semaphore_;
   VkFence render_fence_;
 
+  vk::PipelineCache pipeline_cache_;
   VkPipelineLayout  pipeline_layout_;
   VkPipeline pipeline_;
+  VkPipeline contour_pipeline_;
 
   VmaAllocator allocator_;
 
+  // In the same order as chunks_.chunks()
   std::vector<vk::Mesh> meshes_;
+  std::unique_ptr<TileLoader> loader_;
+  std::string tile_cache_dir_;
+  std::optional<analysis::hole_options> hole_options_;
+  // Mean heights of each tile in the same order as chunks_.chunks(), for
+  // the clipmap's coarser levels
+  std::vector<std::vector<chunks::Chunk>> tile_levels_;
+  Prefetcher prefetcher_;
+  analysis::TerrainPicker picker_;
+  std::optional<analysis::pick_result> hover_;
+  float pick_ms_ = 0.f;
+  chunks::range coloured_range_;
+  shading_mode shading_ = shading_mode::elevation;
+  analysis::sun sun_;
+  // In the same order as chunks_.chunks(), only kept up to date while
+  // shading by one of them
+  std::vector<analysis::derivative_grids> derivatives_;
+  bool shading_dirty_ = false;
+  GpuHillshade gpu_hillshade_;
+  bool gpu_hillshade_enabled_ = true;
+  // The vertex colours were rewritten or the sun moved
+  bool gpu_hillshade_pending_ = false;
+  analysis::viewshed_options viewshed_options_;
+  std::optional<analysis::viewshed_grid> viewshed_;
+  float viewshed_ms_ = 0.f;
+  // Of the latest viewshed started, so earlier ones that finish late are
+  // dropped
+  uint64_t viewshed_generation_ = 0;
+  bool viewshed_running_ = false;
+  // Cleared on destruction, for main queue tasks that outlive the engine
+  std::shared_ptr<bool> alive_ = std::make_shared<bool>(true);
+  analysis::ContourCache contours_;
+  bool show_contours_ = false;
+  float contour_interval_ = 10.f;
+  float contours_ms_ = 0.f;
+  // Line lists in the same order as meshes_, drawn with the tile's model
+  // matrix
+  std::vector<vk::AllocatorBuffer> contour_buffers_;
+  std::vector<uint32_t> contour_vertex_counts_;
+  analysis::ChangeDetector changes_;
+  // Raised or lowered by this much or more is fully red or blue
+  float change_range_ = 5.f;
+  // Placed with left clicks while drawing, in map coordinates
+  std::vector<glm::dvec2> profile_points_;
+  bool drawing_profile_ = false;
+  // Points, samples or tiles changed since it was last sampled
+  bool profile_stale_ = false;
+  int profile_samples_ = 2000;
+  analysis::elevation_profile profile_;
+  float profile_ms_ = 0.f;
+  // The sampled line as a line list in world space, drawn with the
+  // contours' pipeline. Only uploaded once the last frame is done.
+  std::vector<vk::Vertex> profile_line_;
+  bool profile_line_dirty_ = false;
+  vk::AllocatorBuffer profile_buffer_;
+  size_t profile_buffer_capacity_ = 0;
+  uint32_t profile_vertex_count_ = 0;
+  float derivatives_ms_ = 0.f;
+  size_t derivative_cells_ = 0;
+  bool scene_dirty_ = false;
+  std::chrono::steady_clock::time_point last_scene_update_;
+
+  bool frustum_culling_ = true;
+  bool occlusion_culling_ = false;
+  uint32_t visible_meshes_ = 0;
+  uint32_t culled_meshes_ = 0;
+  uint32_t occluded_meshes_ = 0;
+  DepthPyramid depth_pyramid_;
+  Clipmap clipmap_;
+  bool clipmap_terrain_ = false;
+
+  VkDescriptorPool descriptor_pool_;
+
+  // GPU driven path: every mesh is packed into one vertex/index buffer, a
+  // compute shader culls the tiles and fills in the indirect draws
+  bool gpu_driven_supported_ = false;
+  bool gpu_driven_ = false;
+  VkDescriptorSetLayout scene_set_layout_;
+  VkDescriptorSet scene_set_;
+  VkPipelineLayout cull_pipeline_layout_;
+  VkPipeline cull_pipeline_;
+  VkPipelineLayout indirect_pipeline_layout_;
+  VkPipeline indirect_pipeline_;
+  uint32_t gpu_tile_count_ = 0;
+  vk::AllocatorBuffer scene_vertex_buffer_{};
+  vk::AllocatorBuffer scene_index_buffer_{};
+  vk::AllocatorBuffer tile_buffer_{};
+  vk::AllocatorBuffer draw_buffer_{};
+  vk::AllocatorBuffer cull_stats_buffer_{};
+  vk::AllocatorBuffer cull_data_buffer_{};
 
   vk::UploadContext upload_context_;
 
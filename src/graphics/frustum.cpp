@@ -0,0 +1,39 @@
+#include "frustum.hpp"
+
+namespace siliconia::graphics {
+
+frustum::frustum(const glm::mat4 &view_proj)
+{
+  // glm is column major so the rows have to be picked out by hand
+  auto row = [&](int r) {
+    return glm::vec4{
+        view_proj[0][r], view_proj[1][r], view_proj[2][r], view_proj[3][r]};
+  };
+  auto r0 = row(0), r1 = row(1), r2 = row(2), r3 = row(3);
+
+  planes_ = {r3 + r0, r3 - r0, r3 + r1, r3 - r1, r2, r3 - r2};
+  for (auto &p : planes_) {
+    p /= glm::length(glm::vec3{p});
+  }
+}
+
+bool frustum::intersects(const aabb &box) const
+{
+  for (const auto &p : planes_) {
+    // The corner furthest along the plane normal, if even that is behind the
+    // plane then the whole box is
+    auto v = glm::vec3{p.x >= 0 ? box.max.x : box.min.x,
+        p.y >= 0 ? box.max.y : box.min.y, p.z >= 0 ? box.max.z : box.min.z};
+    if (glm::dot(glm::vec3{p}, v) + p.w < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const std::array<glm::vec4, 6> &frustum::planes() const
+{
+  return planes_;
+}
+
+} // namespace siliconia::graphics
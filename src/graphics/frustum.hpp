@@ -0,0 +1,30 @@
+#ifndef SILICONIA_FRUSTUM_HPP
+#define SILICONIA_FRUSTUM_HPP
+
+#include <array>
+#include <glm/glm.hpp>
+
+namespace siliconia::graphics {
+
+struct aabb {
+  glm::vec3 min;
+  glm::vec3 max;
+};
+
+class frustum {
+public:
+  // Expects a projection with a [0, 1] depth range (GLM_FORCE_DEPTH_ZERO_TO_ONE)
+  explicit frustum(const glm::mat4 &view_proj);
+
+  bool intersects(const aabb &box) const;
+
+  const std::array<glm::vec4, 6> &planes() const;
+
+private:
+  // xyz is the inward facing normal, w the distance
+  std::array<glm::vec4, 6> planes_;
+};
+
+} // namespace siliconia::graphics
+
+#endif // SILICONIA_FRUSTUM_HPP
@@ -0,0 +1,161 @@
+#include "gpu_hillshade.hpp"
+#include <algorithm>
+#include <cmath>
+#include <graphics/vk/helpers.hpp>
+#include <graphics/vk/init.hpp>
+#include <graphics/vk/pipeline_builder.hpp>
+#include <graphics/vk/types.hpp>
+
+namespace siliconia::graphics {
+
+namespace {
+
+// Mirrors the push constants in hillshade.comp
+struct hillshade_push_constants {
+  glm::vec4 towards_sun;
+  int32_t vertex_offset;
+  uint32_t ncols, nrows;
+  float nodata_value;
+  // Horn's weights over the cell size
+  float scale;
+  float range_size;
+};
+
+constexpr uint32_t local_size = 8;
+
+} // namespace
+
+GpuHillshade::GpuHillshade(VkDevice device, VkPipelineCache cache)
+  : device_(device)
+{
+  auto binding = vk::descriptor_set_layout_binding(
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0);
+  auto set_info = VkDescriptorSetLayoutCreateInfo{};
+  set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_info.bindingCount = 1;
+  set_info.pBindings = &binding;
+  VK_CHECK(
+      vkCreateDescriptorSetLayout(device_, &set_info, nullptr, &set_layout_));
+
+  auto push_constant = VkPushConstantRange{};
+  push_constant.size = sizeof(hillshade_push_constants);
+  push_constant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  auto layout_info = vk::pipeline_layout_create_info();
+  layout_info.setLayoutCount = 1;
+  layout_info.pSetLayouts = &set_layout_;
+  layout_info.pushConstantRangeCount = 1;
+  layout_info.pPushConstantRanges = &push_constant;
+  VK_CHECK(vkCreatePipelineLayout(
+      device_, &layout_info, nullptr, &pipeline_layout_));
+
+  auto builder = vk::ComputePipelineBuilder{};
+  builder.layout = pipeline_layout_;
+  pipeline_ =
+      builder.build_pipeline(device_, "../shaders/hillshade.comp.spv", cache);
+}
+
+void GpuHillshade::reserve_sets(uint32_t count)
+{
+  if (count <= pool_capacity_) {
+    VK_CHECK(vkResetDescriptorPool(device_, pool_, 0));
+    return;
+  }
+  if (pool_ != VK_NULL_HANDLE) {
+    vkDestroyDescriptorPool(device_, pool_, nullptr);
+  }
+  pool_capacity_ = std::max(count, pool_capacity_ * 2);
+  auto size =
+      VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, pool_capacity_};
+  auto pool_info = VkDescriptorPoolCreateInfo{};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.maxSets = pool_capacity_;
+  pool_info.poolSizeCount = 1;
+  pool_info.pPoolSizes = &size;
+  VK_CHECK(vkCreateDescriptorPool(device_, &pool_info, nullptr, &pool_));
+}
+
+void GpuHillshade::record(vk::CommandBufferGuard &cmd,
+    const std::vector<target> &targets, const analysis::sun &light,
+    chunks::range colour_range)
+{
+  if (!valid() || targets.empty()) {
+    return;
+  }
+
+  // Tiles packed into one buffer share a set
+  auto buffers = std::vector<VkBuffer>{};
+  for (const auto &t : targets) {
+    if (buffers.empty() || buffers.back() != t.buffer) {
+      buffers.push_back(t.buffer);
+    }
+  }
+  reserve_sets(buffers.size());
+  auto sets = std::vector<VkDescriptorSet>(buffers.size());
+  auto layouts =
+      std::vector<VkDescriptorSetLayout>(buffers.size(), set_layout_);
+  auto alloc_info = VkDescriptorSetAllocateInfo{};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = pool_;
+  alloc_info.descriptorSetCount = sets.size();
+  alloc_info.pSetLayouts = layouts.data();
+  VK_CHECK(vkAllocateDescriptorSets(device_, &alloc_info, sets.data()));
+  for (size_t i = 0; i < sets.size(); i++) {
+    auto info = VkDescriptorBufferInfo{buffers[i], 0, VK_WHOLE_SIZE};
+    auto write = vk::write_descriptor_buffer(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, sets[i], &info, 0);
+    vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+  }
+
+  // The same convention as analysis::compute_derivatives
+  auto azimuth = glm::radians(light.azimuth_deg);
+  auto altitude = glm::radians(light.altitude_deg);
+  auto towards_sun = glm::vec4{std::sin(azimuth) * std::cos(altitude),
+      std::cos(azimuth) * std::cos(altitude), std::sin(altitude), 0.f};
+
+  // The last draw read these as vertices
+  for (auto buffer : buffers) {
+    cmd.buffer_barrier(buffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+  }
+
+  cmd.bind_compute_pipeline(pipeline_);
+  auto set = size_t{0};
+  for (size_t i = 0; i < targets.size(); i++) {
+    const auto &t = targets[i];
+    if (i == 0 || targets[i - 1].buffer != t.buffer) {
+      cmd.bind_compute_descriptor_set(pipeline_layout_, sets[set++]);
+    }
+    auto constants = hillshade_push_constants{towards_sun, t.vertex_offset,
+        t.ncols, t.nrows, t.nodata_value, 1.f / (8.f * t.cell_size),
+        colour_range.size()};
+    cmd.push_constants(pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT,
+        sizeof(constants), &constants);
+    cmd.dispatch_2d(t.ncols, t.nrows, local_size);
+  }
+
+  for (auto buffer : buffers) {
+    cmd.buffer_barrier(buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+  }
+}
+
+bool GpuHillshade::valid() const
+{
+  return pipeline_ != VK_NULL_HANDLE;
+}
+
+void GpuHillshade::destroy()
+{
+  if (pool_ != VK_NULL_HANDLE) {
+    vkDestroyDescriptorPool(device_, pool_, nullptr);
+  }
+  vkDestroyPipeline(device_, pipeline_, nullptr);
+  vkDestroyPipelineLayout(device_, pipeline_layout_, nullptr);
+  vkDestroyDescriptorSetLayout(device_, set_layout_, nullptr);
+}
+
+} // namespace siliconia::graphics
@@ -0,0 +1,55 @@
+#ifndef SILICONIA_GPU_HILLSHADE_HPP
+#define SILICONIA_GPU_HILLSHADE_HPP
+
+#include <analysis/derivatives.hpp>
+#include <chunks/chunk.hpp>
+#include <graphics/vk/command_buffer.hpp>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace siliconia::graphics {
+
+// Hillshade on the GPU, from the heights already in the tiles' vertex
+// buffers. Normals come from Horn's gradient as on the CPU, and the lit
+// colour is written over each vertex's colour, so moving the sun is one
+// dispatch per tile rather than a recolour and upload. The buffers need
+// VK_BUFFER_USAGE_STORAGE_BUFFER_BIT.
+class GpuHillshade {
+public:
+  // One tile's grid of vertices, wherever it is in a buffer
+  struct target {
+    VkBuffer buffer;
+    int32_t vertex_offset;
+    uint32_t ncols, nrows;
+    float nodata_value;
+    float cell_size;
+  };
+
+  GpuHillshade() = default;
+  GpuHillshade(VkDevice device, VkPipelineCache cache);
+
+  // Outside the render pass, once the previous recording has finished.
+  // Tiles are shaded on their own, so their edges repeat rather than
+  // reading the neighbouring tile.
+  void record(vk::CommandBufferGuard &cmd, const std::vector<target> &targets,
+      const analysis::sun &light, chunks::range colour_range);
+
+  bool valid() const;
+
+  void destroy();
+
+private:
+  void reserve_sets(uint32_t count);
+
+  VkDevice device_;
+  VkDescriptorSetLayout set_layout_;
+  VkPipelineLayout pipeline_layout_;
+  VkPipeline pipeline_ = VK_NULL_HANDLE;
+  // Reset on every record, as the sets change with the targets
+  VkDescriptorPool pool_ = VK_NULL_HANDLE;
+  uint32_t pool_capacity_ = 0;
+};
+
+} // namespace siliconia::graphics
+
+#endif // SILICONIA_GPU_HILLSHADE_HPP
@@ -0,0 +1,63 @@
+#include "parallel_recorder.hpp"
+#include "jobs/job_system.hpp"
+#include "profiling/profiler.hpp"
+#include <algorithm>
+
+namespace siliconia::graphics {
+
+ParallelRecorder::ParallelRecorder(
+    VkDevice device, uint32_t family, uint32_t slice_count)
+  : device_(device)
+{
+  for (uint32_t i = 0; i < slice_count; i++) {
+    auto slice = Slice{};
+    slice.pool = vk::CommandPool{device_, family};
+    slice.buffer =
+        slice.pool.allocate_buffer(VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+    slices_.push_back(std::move(slice));
+  }
+}
+
+ParallelRecorder::~ParallelRecorder()
+{
+  for (auto &slice : slices_) {
+    vkDestroyCommandPool(device_, slice.pool.pool(), nullptr);
+  }
+}
+
+std::vector<VkCommandBuffer> ParallelRecorder::record(VkRenderPass pass,
+    VkFramebuffer framebuffer, size_t count, const RecordFn &fn)
+{
+  auto buffers = std::vector<VkCommandBuffer>{};
+  if (count == 0) {
+    return buffers;
+  }
+
+  // Contiguous slices keep neighbouring tiles in the same buffer
+  auto per_slice = (count + slices_.size() - 1) / slices_.size();
+  auto used = (count + per_slice - 1) / per_slice;
+  jobs::job_system().parallel_for(0, used, 1, [&](size_t first, size_t last) {
+    for (auto i = first; i < last; i++) {
+      auto zone = profiling::Zone{"Record slice"};
+      auto &slice = slices_[i];
+      auto begin = i * per_slice;
+      auto end = std::min(count, begin + per_slice);
+      slice.pool.reset();
+      auto guard = slice.buffer.begin_secondary(pass, framebuffer);
+      auto rp = guard.continue_render_pass();
+      fn(rp, begin, end);
+    }
+  });
+
+  for (size_t i = 0; i < used; i++) {
+    buffers.push_back(slices_[i].buffer.buffer());
+  }
+  return buffers;
+}
+
+uint32_t ParallelRecorder::slice_count() const
+{
+  return slices_.size();
+}
+
+} // namespace siliconia::graphics
@@ -0,0 +1,47 @@
+#ifndef SILICONIA_PARALLEL_RECORDER_HPP
+#define SILICONIA_PARALLEL_RECORDER_HPP
+
+#include <functional>
+#include <graphics/vk/command_buffer.hpp>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace siliconia::graphics {
+
+// Splits recording of a render pass into slices run as jobs. Each slice owns
+// a command pool and records one secondary buffer per frame, which the
+// primary buffer then executes.
+class ParallelRecorder {
+public:
+  using RecordFn =
+      std::function<void(vk::RenderPassGuard &rp, size_t begin, size_t end)>;
+
+  ParallelRecorder(VkDevice device, uint32_t family, uint32_t slice_count);
+  ~ParallelRecorder();
+
+  ParallelRecorder(const ParallelRecorder &) = delete;
+  ParallelRecorder &operator=(const ParallelRecorder &) = delete;
+
+  // Calls fn for each slice of [0, count) and waits for them all. Must only
+  // be called once the buffers from the previous call have finished
+  // executing.
+  std::vector<VkCommandBuffer> record(VkRenderPass pass,
+      VkFramebuffer framebuffer, size_t count, const RecordFn &fn);
+
+  uint32_t slice_count() const;
+
+private:
+  // A pool may only be used by one thread at a time, which holds as each
+  // slice is a single job
+  struct Slice {
+    vk::CommandPool pool;
+    vk::CommandBuffer buffer;
+  };
+
+  VkDevice device_;
+  std::vector<Slice> slices_;
+};
+
+} // namespace siliconia::graphics
+
+#endif // SILICONIA_PARALLEL_RECORDER_HPP
@@ -0,0 +1,108 @@
+#include "prefetcher.hpp"
+#include "profiling/profiler.hpp"
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace siliconia::graphics {
+
+float Prefetcher::stats::hit_rate() const
+{
+  return demanded ? float(hits) / demanded : 1.f;
+}
+
+Prefetcher::Prefetcher(std::vector<aabb> tile_bounds)
+  : bounds_(std::move(tile_bounds))
+  , flags_(bounds_.size())
+{
+}
+
+std::vector<size_t> Prefetcher::update(const camera &cam)
+{
+  auto zone = profiling::Zone{"Prefetch"};
+
+  // Measured rather than taken from the keys, so replayed paths and edits
+  // to the position count too. Smoothed over about a quarter of a second,
+  // and capped at the camera's speed so a jump is not followed further.
+  auto now = std::chrono::steady_clock::now();
+  if (last_pos_) {
+    auto elapsed_s = std::chrono::duration<float>(now - last_time_).count();
+    if (elapsed_s > 0.f) {
+      auto measured = (cam.pos() - *last_pos_) / elapsed_s;
+      velocity_ += (measured - velocity_) * std::min(1.f, elapsed_s * 4.f);
+      auto speed = glm::length(velocity_);
+      if (speed > cam.speed()) {
+        velocity_ *= cam.speed() / speed;
+      }
+    }
+  }
+  last_pos_ = cam.pos();
+  last_time_ = now;
+
+  for (auto i : in_view(cam, cam.pos())) {
+    if (flags_[i] & demanded) {
+      continue;
+    }
+    flags_[i] |= demanded;
+    stats_.demanded++;
+    if (flags_[i] & loaded) {
+      stats_.hits++;
+      if (flags_[i] & prefetched) {
+        stats_.prefetch_used++;
+      }
+    }
+  }
+
+  auto wanted = std::vector<size_t>{};
+  if (glm::length(velocity_) < 1e-3f || tuning.step_s <= 0.f) {
+    return wanted;
+  }
+  auto seen = std::vector<bool>(bounds_.size());
+  for (auto t = tuning.step_s; t <= tuning.lookahead_s; t += tuning.step_s) {
+    for (auto i : in_view(cam, cam.pos() + velocity_ * t)) {
+      if (!seen[i] && !(flags_[i] & loaded)) {
+        seen[i] = true;
+        wanted.push_back(i);
+      }
+    }
+  }
+  return wanted;
+}
+
+void Prefetcher::tile_loaded(size_t index, bool was_prefetched)
+{
+  flags_[index] |= loaded;
+  if (was_prefetched) {
+    flags_[index] |= prefetched;
+    stats_.prefetched++;
+  }
+}
+
+const Prefetcher::stats &Prefetcher::statistics() const
+{
+  return stats_;
+}
+
+const glm::vec3 &Prefetcher::velocity() const
+{
+  return velocity_;
+}
+
+std::vector<size_t> Prefetcher::in_view(
+    const camera &cam, const glm::vec3 &pos) const
+{
+  // The engine's projection, but with a far plane that stops at the view
+  // distance
+  auto proj = cam.projection(tuning.view_distance);
+  auto view = glm::lookAt(pos, pos + cam.dir(), cam.up());
+  auto view_frustum = frustum{proj * view};
+
+  auto tiles = std::vector<size_t>{};
+  for (size_t i = 0; i < bounds_.size(); i++) {
+    if (view_frustum.intersects(bounds_[i])) {
+      tiles.push_back(i);
+    }
+  }
+  return tiles;
+}
+
+} // namespace siliconia::graphics
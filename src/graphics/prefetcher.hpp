@@ -0,0 +1,66 @@
+#ifndef SILICONIA_PREFETCHER_HPP
+#define SILICONIA_PREFETCHER_HPP
+
+#include "camera.hpp"
+#include "frustum.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <optional>
+#include <vector>
+
+namespace siliconia::graphics {
+
+// Predicts which tiles will come into view by following the camera's
+// velocity for a few seconds, so they can be loaded before they are needed.
+// A tile is demanded the first time it is in view, and a hit if it was
+// loaded by then.
+class Prefetcher {
+public:
+  struct settings {
+    float lookahead_s = 3.f;
+    float step_s = 0.5f;
+    // Tiles further than this are not counted as in view
+    float view_distance = 5000.f;
+  };
+
+  struct stats {
+    size_t demanded = 0;
+    size_t hits = 0;
+    size_t prefetched = 0;
+    // Prefetched tiles that were demanded later
+    size_t prefetch_used = 0;
+
+    float hit_rate() const;
+  };
+
+  Prefetcher() = default;
+  explicit Prefetcher(std::vector<aabb> tile_bounds);
+
+  // Returns the tiles predicted to come into view that are not loaded yet
+  std::vector<size_t> update(const camera &cam);
+  void tile_loaded(size_t index, bool was_prefetched);
+
+  const stats &statistics() const;
+  const glm::vec3 &velocity() const;
+
+  settings tuning;
+
+private:
+  std::vector<size_t> in_view(const camera &cam, const glm::vec3 &pos) const;
+
+  stats stats_;
+  std::vector<aabb> bounds_;
+
+  enum flags : uint8_t { loaded = 1, demanded = 2, prefetched = 4 };
+  std::vector<uint8_t> flags_;
+
+  std::optional<glm::vec3> last_pos_;
+  std::chrono::steady_clock::time_point last_time_;
+  glm::vec3 velocity_{0.f};
+};
+
+} // namespace siliconia::graphics
+
+#endif // SILICONIA_PREFETCHER_HPP
@@ -0,0 +1,427 @@
+#include "terrain_export.hpp"
+#include "chunks/tile_pyramid.hpp"
+#include "jobs/job_system.hpp"
+#include "profiling/profiler.hpp"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace siliconia::graphics {
+
+namespace {
+
+static_assert(std::endian::native == std::endian::little,
+    "glb buffers are written straight from memory");
+
+constexpr uint32_t glb_magic = 0x46546c67;  // glTF
+constexpr uint32_t json_chunk = 0x4e4f534a; // JSON
+constexpr uint32_t bin_chunk = 0x004e4942;  // BIN
+
+constexpr auto no_vertex = std::numeric_limits<uint32_t>::max();
+
+// Attributes have to be a multiple of 4 bytes apart
+struct quantized_position {
+  uint16_t x, y, z, padding;
+};
+
+struct quantized_normal {
+  int16_t x, y, z, padding;
+};
+
+struct level_mesh {
+  std::vector<quantized_position> positions;
+  std::vector<quantized_normal> normals;
+  std::vector<uint32_t> indices;
+  // The node's, taking quantized positions to metres from the origin
+  glm::dvec3 translation{0};
+  glm::dvec3 scale{1};
+};
+
+// One vertex per cell with data, on its centre but for the edge cells,
+// which are stretched out to the tile's edge so neighbouring tiles meet.
+// Skirts go down from the outline to error and a cell below the lowest.
+level_mesh mesh_level(const chunks::Chunk &tile, const chunks::Chunk &level,
+    glm::dvec2 origin, float error)
+{
+  auto mesh = level_mesh{};
+  auto w = level.ncols;
+  auto h = level.nrows;
+  auto has_data = [&](size_t k) {
+    return level.data[k] != level.nodata_value;
+  };
+  auto lo = std::numeric_limits<float>::infinity();
+  auto hi = -lo;
+  for (size_t k = 0; k < level.data.size(); k++) {
+    if (has_data(k)) {
+      lo = std::min(lo, level.data[k]);
+      hi = std::max(hi, level.data[k]);
+    }
+  }
+  if (lo > hi) {
+    return mesh;
+  }
+
+  auto bottom = double(lo) - error - level.cell_size;
+  auto step = std::max((double(hi) - bottom) / 65535.0, 1e-6);
+  auto r = tile.rect();
+  mesh.translation = {double(r.x) - origin.x, bottom,
+      origin.y - (double(r.y) + r.height)};
+  mesh.scale = {tile.cell_size / 2.0, step, tile.cell_size / 2.0};
+
+  // In half cells of the full resolution tile
+  auto shift = level.cell_size / tile.cell_size;
+  auto half_x = [&](unsigned int i) {
+    return uint16_t(i == 0 ? 0 : i == w - 1 ? 2 * tile.ncols
+                                            : (2 * i + 1) * shift);
+  };
+  auto half_z = [&](unsigned int j) {
+    return uint16_t(j == 0 ? 0 : j == h - 1 ? 2 * tile.nrows
+                                            : (2 * j + 1) * shift);
+  };
+  auto quantize = [&](double height) {
+    auto q = std::lround((height - bottom) / step);
+    return uint16_t(std::min(q, 65535l));
+  };
+
+  // Central differences, one sided at an edge or a gap. The node scales
+  // the normals too, so they are stored scaled back, which leaves y far
+  // smaller than x and z and needs the 16 bits.
+  auto slope = [&](int64_t i, int64_t j, int64_t di, int64_t dj) {
+    auto c = level.data[i + j * w];
+    auto lo = c, hi = c;
+    auto span = 0.0;
+    auto at = [&](int64_t a, int64_t b, float &v) {
+      if (a >= 0 && b >= 0 && a < w && b < h &&
+          level.data[a + b * w] != level.nodata_value) {
+        v = level.data[a + b * w];
+        span += level.cell_size;
+      }
+    };
+    at(i - di, j - dj, lo);
+    at(i + di, j + dj, hi);
+    return span > 0 ? (hi - lo) / span : 0.0;
+  };
+  auto normal = [&](unsigned int i, unsigned int j) {
+    auto n = glm::dvec3{-slope(i, j, 1, 0), 1, -slope(i, j, 0, 1)};
+    n = glm::normalize(n * mesh.scale) * 32767.0;
+    return quantized_normal{int16_t(std::lround(n.x)),
+        int16_t(std::lround(n.y)), int16_t(std::lround(n.z)), 0};
+  };
+
+  auto vertex = std::vector<uint32_t>(size_t(w) * h, no_vertex);
+  for (unsigned int j = 0; j < h; j++) {
+    for (unsigned int i = 0; i < w; i++) {
+      auto k = i + size_t(j) * w;
+      if (has_data(k)) {
+        vertex[k] = uint32_t(mesh.positions.size());
+        mesh.positions.push_back(
+            {half_x(i), quantize(level.data[k]), half_z(j), 0});
+        mesh.normals.push_back(normal(i, j));
+      }
+    }
+  }
+
+  // Anticlockwise seen from above
+  auto triangle = [&](uint32_t a, uint32_t b, uint32_t c) {
+    if (a != no_vertex && b != no_vertex && c != no_vertex) {
+      mesh.indices.insert(mesh.indices.end(), {a, b, c});
+    }
+  };
+  for (unsigned int j = 0; j + 1 < h; j++) {
+    for (unsigned int i = 0; i + 1 < w; i++) {
+      auto tl = vertex[i + size_t(j) * w];
+      auto tr = vertex[i + 1 + size_t(j) * w];
+      auto bl = vertex[i + size_t(j + 1) * w];
+      auto br = vertex[i + 1 + size_t(j + 1) * w];
+      triangle(tl, bl, tr);
+      triangle(tr, bl, br);
+    }
+  }
+
+  // Clockwise round the outline, so the outside is always on the left
+  auto outline = std::vector<size_t>{};
+  for (unsigned int i = 0; i + 1 < w; i++) {
+    outline.push_back(i);
+  }
+  for (unsigned int j = 0; j + 1 < h; j++) {
+    outline.push_back(w - 1 + size_t(j) * w);
+  }
+  for (auto i = w - 1; i > 0; i--) {
+    outline.push_back(i + size_t(h - 1) * w);
+  }
+  for (auto j = h - 1; j > 0; j--) {
+    outline.push_back(size_t(j) * w);
+  }
+  auto skirt = std::vector<uint32_t>(outline.size(), no_vertex);
+  for (size_t s = 0; s < outline.size(); s++) {
+    auto top = vertex[outline[s]];
+    if (top != no_vertex) {
+      skirt[s] = uint32_t(mesh.positions.size());
+      auto p = mesh.positions[top];
+      mesh.positions.push_back({p.x, 0, p.z, 0});
+      mesh.normals.push_back(mesh.normals[top]);
+    }
+  }
+  for (size_t s = 0; s < outline.size(); s++) {
+    auto t = (s + 1) % outline.size();
+    auto a = vertex[outline[s]], b = vertex[outline[t]];
+    triangle(a, b, skirt[s]);
+    triangle(b, skirt[t], skirt[s]);
+  }
+  return mesh;
+}
+
+void pad(std::string &bytes, char with)
+{
+  bytes.resize((bytes.size() + 3) & ~size_t(3), with);
+}
+
+template <typename T>
+void append(std::string &bytes, const std::vector<T> &values)
+{
+  bytes.append(reinterpret_cast<const char *>(values.data()),
+      values.size() * sizeof(T));
+  pad(bytes, 0);
+}
+
+// A single node and primitive, the positions and normals quantized as
+// KHR_mesh_quantization allows, and 16 bit indices if they fit
+std::string encode_glb(const level_mesh &mesh)
+{
+  auto count = mesh.positions.size();
+  auto lo = quantized_position{65535, 65535, 65535, 0};
+  auto hi = quantized_position{0, 0, 0, 0};
+  for (const auto &p : mesh.positions) {
+    lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z), 0};
+    hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z), 0};
+  }
+
+  auto bin = std::string{};
+  append(bin, mesh.positions);
+  auto normals_offset = bin.size();
+  append(bin, mesh.normals);
+  auto indices_offset = bin.size();
+  auto wide = count > std::numeric_limits<uint16_t>::max();
+  if (wide) {
+    append(bin, mesh.indices);
+  } else {
+    append(bin, std::vector<uint16_t>(
+                    mesh.indices.begin(), mesh.indices.end()));
+  }
+  auto indices_size = mesh.indices.size() * (wide ? 4 : 2);
+
+  auto json = std::ostringstream{};
+  json << std::setprecision(std::numeric_limits<double>::max_digits10);
+  auto vec3 = [](auto x, auto y, auto z) {
+    auto out = std::ostringstream{};
+    out << std::setprecision(std::numeric_limits<double>::max_digits10)
+        << "[" << x << "," << y << "," << z << "]";
+    return out.str();
+  };
+  json << R"({"asset":{"version":"2.0","generator":"siliconia"},)"
+       << R"("extensionsUsed":["KHR_mesh_quantization"],)"
+       << R"("extensionsRequired":["KHR_mesh_quantization"],)"
+       << R"("scene":0,"scenes":[{"nodes":[0]}],)"
+       << R"("nodes":[{"mesh":0,"translation":)"
+       << vec3(mesh.translation.x, mesh.translation.y, mesh.translation.z)
+       << R"(,"scale":)" << vec3(mesh.scale.x, mesh.scale.y, mesh.scale.z)
+       << R"(}],"meshes":[{"primitives":[{"attributes":)"
+       << R"({"POSITION":0,"NORMAL":1},"indices":2,"mode":4}]}],)"
+       << R"("buffers":[{"byteLength":)" << bin.size() << "}],"
+       << R"("bufferViews":[)"
+       << R"({"buffer":0,"byteOffset":0,"byteLength":)"
+       << count * sizeof(quantized_position)
+       << R"(,"byteStride":8,"target":34962},)"
+       << R"({"buffer":0,"byteOffset":)" << normals_offset
+       << R"(,"byteLength":)" << count * sizeof(quantized_normal)
+       << R"(,"byteStride":8,"target":34962},)"
+       << R"({"buffer":0,"byteOffset":)" << indices_offset
+       << R"(,"byteLength":)" << indices_size << R"(,"target":34963}],)"
+       << R"("accessors":[)"
+       << R"({"bufferView":0,"componentType":5123,"count":)" << count
+       << R"(,"type":"VEC3","min":)" << vec3(lo.x, lo.y, lo.z)
+       << R"(,"max":)" << vec3(hi.x, hi.y, hi.z) << "},"
+       << R"({"bufferView":1,"componentType":5122,"normalized":true,)"
+       << R"("count":)" << count << R"(,"type":"VEC3"},)"
+       << R"({"bufferView":2,"componentType":)" << (wide ? 5125 : 5123)
+       << R"(,"count":)" << mesh.indices.size()
+       << R"(,"type":"SCALAR"}]})";
+  auto text = json.str();
+  pad(text, ' ');
+
+  auto glb = std::string{};
+  auto word = [&](uint32_t value) {
+    glb.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  };
+  word(glb_magic);
+  word(2);
+  word(uint32_t(12 + 8 + text.size() + 8 + bin.size()));
+  word(uint32_t(text.size()));
+  word(json_chunk);
+  glb += text;
+  word(uint32_t(bin.size()));
+  word(bin_chunk);
+  glb += bin;
+  return glb;
+}
+
+// Written to a temporary file and renamed, so a viewer never reads half
+bool write_file(const std::string &path, const std::string &bytes)
+{
+  auto temporary = path + ".tmp";
+  {
+    auto file = std::ofstream{temporary, std::ios::binary};
+    if (!file.write(bytes.data(), bytes.size())) {
+      return false;
+    }
+  }
+  auto error = std::error_code{};
+  std::filesystem::rename(temporary, path, error);
+  return !error;
+}
+
+// The furthest any full resolution cell under a level's cells is from them
+float level_error(const chunks::tile_pyramid &pyramid, unsigned int level)
+{
+  if (level == 0) {
+    return 0.f;
+  }
+  const auto &mean = pyramid.mean[level - 1];
+  const auto &min = pyramid.min[level - 1].data;
+  const auto &max = pyramid.max[level - 1].data;
+  auto error = 0.f;
+  for (size_t k = 0; k < mean.data.size(); k++) {
+    if (mean.data[k] != mean.nodata_value) {
+      error = std::max(
+          {error, max[k] - mean.data[k], mean.data[k] - min[k]});
+    }
+  }
+  return error;
+}
+
+exported_tile export_tile(const std::string &path, const std::string &dir,
+    glm::dvec2 origin, const terrain_export_options &options)
+{
+  auto zone = profiling::Zone{"Export tile", path};
+  auto result = exported_tile{};
+  try {
+    auto cached = options.cache.valid() ? options.cache.read(path)
+                                        : std::nullopt;
+    auto tile = cached ? std::move(cached->first) : chunks::Chunk{path};
+    if (!cached && options.holes) {
+      tile.data = analysis::fill_holes(nullptr, tile, *options.holes).data;
+    }
+    auto pyramid = cached ? std::move(cached->second)
+                          : chunks::build_pyramid(tile);
+    result.heights = tile.range;
+    result.cells = tile.data.size();
+    if (2 * tile.ncols > 65535 || 2 * tile.nrows > 65535) {
+      result.error = "too many cells to quantize";
+      return result;
+    }
+
+    auto stem = std::filesystem::path{path}.stem().string();
+    auto levels = std::min(options.levels, pyramid.levels());
+    for (unsigned int l = 0; l <= levels; l++) {
+      const auto &level = pyramid.level(tile, l, chunks::reduction::mean);
+      if (level.ncols < 2 || level.nrows < 2) {
+        break;
+      }
+      auto error = level_error(pyramid, l);
+      auto mesh = mesh_level(tile, level, origin, error);
+      if (mesh.indices.empty()) {
+        break;
+      }
+      auto glb = encode_glb(mesh);
+      auto file = stem + "_" + std::to_string(l) + ".glb";
+      if (!write_file((std::filesystem::path{dir} / file).string(), glb)) {
+        result.error = "could not write " + file;
+        return result;
+      }
+      result.levels.push_back({file, level.cell_size, error,
+          uint32_t(mesh.positions.size()),
+          uint32_t(mesh.indices.size() / 3), glb.size()});
+    }
+  } catch (const chunks::asc_parse_exception &e) {
+    result.error = e.what();
+  }
+  return result;
+}
+
+glm::dvec2 top_left(const chunks::ChunkCollection &collection)
+{
+  auto r = collection.rect;
+  return {double(r.x), double(r.y) + r.height};
+}
+
+} // namespace
+
+std::vector<exported_tile> export_terrain(
+    const chunks::ChunkCollection &collection, const std::string &dir,
+    const terrain_export_options &options)
+{
+  auto error = std::error_code{};
+  std::filesystem::create_directories(dir, error);
+  const auto &headers = collection.headers();
+  auto tiles = std::vector<exported_tile>(headers.size());
+  auto origin = top_left(collection);
+  jobs::job_system().parallel_for(
+      0, headers.size(), 1, [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; i++) {
+          tiles[i] = export_tile(headers[i].path, dir, origin, options);
+        }
+      });
+  return tiles;
+}
+
+bool write_terrain_index(const std::string &dir,
+    const chunks::ChunkCollection &collection,
+    const std::vector<exported_tile> &tiles)
+{
+  auto file = std::ofstream{(std::filesystem::path{dir} / "index.json")};
+  if (!file) {
+    return false;
+  }
+  auto origin = top_left(collection);
+  file << std::setprecision(10);
+  file << "{\"origin\": [" << origin.x << ", " << origin.y << "], "
+       << "\"axes\": \"x east, y up, z south\", "
+       << "\"quantization\": \"KHR_mesh_quantization\", \"tiles\": [";
+  auto written = size_t{0};
+  const auto &headers = collection.headers();
+  for (size_t i = 0; i < tiles.size() && i < headers.size(); i++) {
+    const auto &tile = tiles[i];
+    if (!tile.error.empty() || tile.levels.empty()) {
+      continue;
+    }
+    auto r = headers[i].rect();
+    file << (written++ ? ",\n" : "\n") << "{\"source\": \""
+         << profiling::escape_json(
+                std::filesystem::path{headers[i].path}.filename().string())
+         << "\", \"bounds\": [" << r.x << ", " << r.y << ", "
+         << r.x + double(r.width) << ", " << r.y + double(r.height)
+         << "], \"heights\": [" << tile.heights.min << ", "
+         << tile.heights.max << "], \"levels\": [";
+    for (size_t l = 0; l < tile.levels.size(); l++) {
+      const auto &level = tile.levels[l];
+      file << (l ? ", " : "") << "{\"uri\": \""
+           << profiling::escape_json(level.file)
+           << "\", \"cell_size\": " << level.cell_size
+           << ", \"error\": " << level.error
+           << ", \"vertices\": " << level.vertices
+           << ", \"triangles\": " << level.triangles << "}";
+    }
+    file << "]}";
+  }
+  file << "\n]}\n";
+  return bool(file);
+}
+
+} // namespace siliconia::graphics
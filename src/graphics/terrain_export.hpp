@@ -0,0 +1,65 @@
+#ifndef SILICONIA_TERRAIN_EXPORT_HPP
+#define SILICONIA_TERRAIN_EXPORT_HPP
+
+#include <analysis/hole_filling.hpp>
+#include <chunks/chunk_collection.hpp>
+#include <chunks/tile_cache.hpp>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace siliconia::graphics {
+
+struct terrain_export_options {
+  // Levels of detail after the full resolution one, each a level of the
+  // tile's mean pyramid. Levels too small to mesh are left out.
+  unsigned int levels = 4;
+  // Read from if it has the tile, but not written to
+  chunks::TileCache cache;
+  // Filled in each tile on its own, as the neighbours aren't loaded
+  std::optional<analysis::hole_options> holes;
+};
+
+struct exported_level {
+  // Relative to the export directory
+  std::string file;
+  unsigned int cell_size = 0;
+  // The furthest a full resolution cell is from the level's cell over it
+  float error = 0;
+  uint32_t vertices = 0, triangles = 0;
+  size_t bytes = 0;
+};
+
+struct exported_tile {
+  std::vector<exported_level> levels;
+  chunks::range heights;
+  size_t cells = 0;
+  // Empty if the tile was exported
+  std::string error;
+};
+
+// Meshes every tile in the collection's headers to <tile>_<level>.glb in
+// dir, one binary glTF per level of detail. Tiles are parsed, meshed and
+// written as jobs, one per worker at a time, so memory stays bounded
+// however many there are.
+//
+// Meshes are y up with x east and z south, placed relative to the top left
+// of the collection by their node. Positions are quantized to 16 bits
+// (KHR_mesh_quantization): x and z in half cells, so the edge vertices sit
+// on the tile's edge, and heights over the tile's range. Nodata cells are
+// left out, and skirts hang from the tile's edges to hide the cracks
+// between tiles and between levels.
+std::vector<exported_tile> export_terrain(
+    const chunks::ChunkCollection &collection, const std::string &dir,
+    const terrain_export_options &options);
+
+// index.json in dir, listing each exported tile's bounds, heights and
+// levels, for a viewer to pick levels by their error
+bool write_terrain_index(const std::string &dir,
+    const chunks::ChunkCollection &collection,
+    const std::vector<exported_tile> &tiles);
+
+} // namespace siliconia::graphics
+
+#endif // SILICONIA_TERRAIN_EXPORT_HPP
@@ -0,0 +1,149 @@
+#include "tile_loader.hpp"
+#include "jobs/job_system.hpp"
+#include "profiling/profiler.hpp"
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+
+namespace siliconia::graphics {
+
+TileLoader::TileLoader(std::vector<request> requests, MeshFn mesh_fn,
+    LoadedFn on_loaded, uint32_t max_jobs, chunks::TileCache cache,
+    std::optional<analysis::hole_options> holes)
+  : mesh_fn_(std::move(mesh_fn))
+  , on_loaded_(std::move(on_loaded))
+  , cache_(std::move(cache))
+  , holes_(holes)
+  , total_(requests.size())
+  , alive_(std::make_shared<bool>(true))
+  , requests_(std::move(requests))
+  , queue_(requests_.size())
+  , prefetch_(requests_.size())
+{
+  std::iota(queue_.begin(), queue_.end(), 0);
+
+  auto jobs = std::min<size_t>(std::max(1u, max_jobs), queue_.size());
+  running_ = jobs;
+  for (size_t i = 0; i < jobs; i++) {
+    jobs::job_system().spawn_background([this] { load_next(); });
+  }
+}
+
+TileLoader::~TileLoader()
+{
+  auto lock = std::unique_lock{mutex_};
+  quit_ = true;
+  idle_cv_.wait(lock, [&] { return running_ == 0; });
+  *alive_ = false;
+}
+
+void TileLoader::set_focus(const glm::vec3 &focus)
+{
+  auto lock = std::lock_guard{mutex_};
+  focus_ = focus;
+}
+
+void TileLoader::set_prefetch(const std::vector<size_t> &indices)
+{
+  auto lock = std::lock_guard{mutex_};
+  std::fill(prefetch_.begin(), prefetch_.end(), false);
+  for (auto index : indices) {
+    prefetch_[index] = true;
+  }
+}
+
+size_t TileLoader::total() const
+{
+  return total_;
+}
+
+size_t TileLoader::queued() const
+{
+  auto lock = std::lock_guard{mutex_};
+  return queue_.size();
+}
+
+size_t TileLoader::loaded() const
+{
+  return loaded_;
+}
+
+bool TileLoader::done() const
+{
+  return loaded_ + failed_ == total_;
+}
+
+void TileLoader::load_next()
+{
+  auto index = size_t{0};
+  auto prefetched = false;
+  {
+    auto lock = std::lock_guard{mutex_};
+    if (quit_ || queue_.empty()) {
+      running_--;
+      idle_cv_.notify_all();
+      return;
+    }
+
+    // The queue is only a few hundred tiles, so it is searched rather than
+    // kept sorted against a focus that moves every frame
+    auto key = [&](size_t i) {
+      return std::pair{!prefetch_[i],
+          glm::distance(requests_[i].centre, focus_)};
+    };
+    auto nearest = std::min_element(queue_.begin(), queue_.end(),
+        [&](size_t a, size_t b) { return key(a) < key(b); });
+    index = *nearest;
+    prefetched = prefetch_[index];
+    *nearest = queue_.back();
+    queue_.pop_back();
+  }
+
+  // std::function needs a copyable task, so the tile is shared
+  auto alive = alive_;
+  try {
+    const auto &path = requests_[index].path;
+    // Parsed again if the cache can't be read, and written over
+    auto cached = decltype(cache_.read(path)){};
+    try {
+      cached = cache_.valid() ? cache_.read(path) : std::nullopt;
+    } catch (const std::exception &e) {
+      std::cout << "Could not read the cache of " << path << ": " << e.what()
+                << std::endl;
+    }
+    auto chunk = cached ? std::move(cached->first) : chunks::Chunk{path};
+    if (!cached && holes_) {
+      chunk.data = analysis::fill_holes(nullptr, chunk, *holes_).data;
+    }
+    auto levels = cached ? std::move(cached->second)
+                         : chunks::build_pyramid(chunk);
+    if (!cached && !holes_ && cache_.valid() &&
+        !cache_.write(chunk, levels)) {
+      std::cout << "Could not cache " << path << std::endl;
+    }
+    auto mesh = mesh_fn_(chunk);
+    auto pyramid = analysis::HeightPyramid{chunk};
+    auto tile = std::make_shared<loaded_tile>(
+        loaded_tile{index, prefetched, std::move(chunk), std::move(mesh),
+            std::move(pyramid), std::move(levels)});
+    jobs::job_system().post_main([this, alive, tile] {
+      if (*alive) {
+        loaded_++;
+        on_loaded_(std::move(*tile));
+      }
+    });
+  } catch (const std::exception &e) {
+    // Counted rather than rethrown, as nothing waits on these jobs
+    std::cout << e.what() << std::endl;
+    jobs::job_system().post_main([this, alive] {
+      if (*alive) {
+        failed_++;
+      }
+    });
+  }
+
+  // Chained rather than looped, so other jobs get a turn in between
+  jobs::job_system().spawn_background([this] { load_next(); });
+}
+
+} // namespace siliconia::graphics
@@ -0,0 +1,97 @@
+#ifndef SILICONIA_TILE_LOADER_HPP
+#define SILICONIA_TILE_LOADER_HPP
+
+#include <analysis/height_pyramid.hpp>
+#include <analysis/hole_filling.hpp>
+#include <chunks/chunk.hpp>
+#include <chunks/tile_cache.hpp>
+#include <chunks/tile_pyramid.hpp>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <glm/glm.hpp>
+#include <graphics/vk/types.hpp>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace siliconia::graphics {
+
+// Parses and meshes tiles as jobs, nearest to the focus first. Finished
+// tiles are handed to on_loaded through the job system's main queue, so
+// they can be uploaded there.
+class TileLoader {
+public:
+  struct request {
+    std::string path;
+    // Where the tile will be drawn, to sort by distance to the focus
+    glm::vec3 centre;
+  };
+
+  struct loaded_tile {
+    // Of the request it was loaded for
+    size_t index;
+    bool prefetched;
+    chunks::Chunk chunk;
+    vk::Mesh mesh;
+    // For picking, built here as it touches every cell
+    analysis::HeightPyramid pyramid;
+    // Reduced heights, from the cache if it had them
+    chunks::tile_pyramid levels;
+  };
+
+  using MeshFn = std::function<vk::Mesh(const chunks::Chunk &chunk)>;
+  using LoadedFn = std::function<void(loaded_tile &&tile)>;
+
+  // At most max_jobs tiles are loaded at once, leaving workers free for
+  // other jobs. Tiles are read from the cache if it is valid and has them,
+  // and written to it once parsed otherwise. Parsed tiles can have their
+  // holes filled, though only those inside the tile, as the neighbours
+  // aren't loaded; those are left out of the cache.
+  TileLoader(std::vector<request> requests, MeshFn mesh_fn,
+      LoadedFn on_loaded, uint32_t max_jobs, chunks::TileCache cache = {},
+      std::optional<analysis::hole_options> holes = std::nullopt);
+  ~TileLoader();
+
+  TileLoader(const TileLoader &) = delete;
+  TileLoader &operator=(const TileLoader &) = delete;
+
+  void set_focus(const glm::vec3 &focus);
+  // Queued requests in the set are loaded before any others, nearest first
+  void set_prefetch(const std::vector<size_t> &indices);
+
+  size_t total() const;
+  size_t queued() const;
+  // Counted as the main queue hands them over
+  size_t loaded() const;
+  bool done() const;
+
+private:
+  void load_next();
+
+  MeshFn mesh_fn_;
+  LoadedFn on_loaded_;
+  const chunks::TileCache cache_;
+  const std::optional<analysis::hole_options> holes_;
+  size_t total_;
+  size_t failed_ = 0;
+  size_t loaded_ = 0;
+  // Cleared on destruction, for main queue tasks that outlive the loader
+  std::shared_ptr<bool> alive_;
+
+  const std::vector<request> requests_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable idle_cv_;
+  // Indices into requests_
+  std::vector<size_t> queue_;
+  std::vector<bool> prefetch_;
+  glm::vec3 focus_{0.f};
+  uint32_t running_ = 0;
+  bool quit_ = false;
+};
+
+} // namespace siliconia::graphics
+
+#endif // SILICONIA_TILE_LOADER_HPP
@@ -3,13 +3,16 @@
 
 namespace siliconia::graphics::vk {
 
-RenderPassGuard::RenderPassGuard(VkCommandBuffer buffer) : buffer_(buffer)
+RenderPassGuard::RenderPassGuard(VkCommandBuffer buffer, bool ends_pass)
+  : buffer_(buffer), ends_pass_(ends_pass)
 {
 }
 
 RenderPassGuard::~RenderPassGuard()
 {
-  vkCmdEndRenderPass(buffer_);
+  if (ends_pass_) {
+    vkCmdEndRenderPass(buffer_);
+  }
 }
 
 void RenderPassGuard::bind_pipeline(VkPipeline pipeline)
@@ -50,15 +53,152 @@ void RenderPassGuard::push_constants(VkPipelineLayout layout, VkShaderStageFlags
   vkCmdPushConstants(buffer_, layout, flags, 0, size, ptr);
 }
 
+void RenderPassGuard::bind_descriptor_set(
+    VkPipelineLayout layout, VkDescriptorSet set)
+{
+  vkCmdBindDescriptorSets(buffer_, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0,
+      1, &set, 0, nullptr);
+}
+
+void RenderPassGuard::draw_indexed_indirect(
+    VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride)
+{
+  vkCmdDrawIndexedIndirect(buffer_, buffer, offset, draw_count, stride);
+}
+
+void RenderPassGuard::execute_commands(
+    const std::vector<VkCommandBuffer> &buffers)
+{
+  if (!buffers.empty()) {
+    vkCmdExecuteCommands(buffer_, buffers.size(), buffers.data());
+  }
+}
+
+GpuZone RenderPassGuard::profile_zone(GpuProfiler &profiler, const char *name)
+{
+  return GpuZone{profiler, buffer_, name};
+}
+
 CommandBufferGuard::CommandBufferGuard(VkCommandBuffer buffer) : buffer_(buffer)
 {
 }
 
+RenderPassGuard CommandBufferGuard::continue_render_pass()
+{
+  return RenderPassGuard{buffer_, false};
+}
+
 CommandBufferGuard::~CommandBufferGuard()
 {
   VK_CHECK(vkEndCommandBuffer(buffer_));
 }
 
+void CommandBufferGuard::bind_compute_pipeline(VkPipeline pipeline)
+{
+  vkCmdBindPipeline(buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+}
+
+void CommandBufferGuard::bind_compute_descriptor_set(
+    VkPipelineLayout layout, VkDescriptorSet set)
+{
+  vkCmdBindDescriptorSets(buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0,
+      1, &set, 0, nullptr);
+}
+
+void CommandBufferGuard::push_constants(VkPipelineLayout layout,
+    VkShaderStageFlags flags, size_t size, const void *ptr)
+{
+  vkCmdPushConstants(buffer_, layout, flags, 0, size, ptr);
+}
+
+void CommandBufferGuard::dispatch(uint32_t x, uint32_t y, uint32_t z)
+{
+  vkCmdDispatch(buffer_, x, y, z);
+}
+
+void CommandBufferGuard::dispatch_2d(
+    uint32_t width, uint32_t height, uint32_t local_size)
+{
+  vkCmdDispatch(buffer_, (width + local_size - 1) / local_size,
+      (height + local_size - 1) / local_size, 1);
+}
+
+void CommandBufferGuard::fill_buffer(
+    VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, uint32_t data)
+{
+  vkCmdFillBuffer(buffer_, buffer, offset, size, data);
+}
+
+void CommandBufferGuard::buffer_barrier(VkBuffer buffer,
+    VkPipelineStageFlags src_stage, VkAccessFlags src_access,
+    VkPipelineStageFlags dst_stage, VkAccessFlags dst_access)
+{
+  auto barrier = VkBufferMemoryBarrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = src_access;
+  barrier.dstAccessMask = dst_access;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = buffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(buffer_, src_stage, dst_stage, 0, 0, nullptr, 1,
+      &barrier, 0, nullptr);
+}
+
+void CommandBufferGuard::image_barrier(VkImage image, VkImageAspectFlags aspect,
+    VkImageLayout old_layout, VkImageLayout new_layout,
+    VkPipelineStageFlags src_stage, VkAccessFlags src_access,
+    VkPipelineStageFlags dst_stage, VkAccessFlags dst_access,
+    uint32_t base_mip, uint32_t mip_count)
+{
+  auto barrier = VkImageMemoryBarrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = src_access;
+  barrier.dstAccessMask = dst_access;
+  barrier.oldLayout = old_layout;
+  barrier.newLayout = new_layout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = aspect;
+  barrier.subresourceRange.baseMipLevel = base_mip;
+  barrier.subresourceRange.levelCount = mip_count;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+  vkCmdPipelineBarrier(buffer_, src_stage, dst_stage, 0, 0, nullptr, 0,
+      nullptr, 1, &barrier);
+}
+
+void CommandBufferGuard::copy_image_to_buffer(VkImage image,
+    VkImageLayout layout, VkBuffer buffer, uint32_t mip, VkExtent2D extent)
+{
+  auto region = VkBufferImageCopy{};
+  region.bufferOffset = 0;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = mip;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = {0, 0, 0};
+  region.imageExtent = {extent.width, extent.height, 1};
+  vkCmdCopyImageToBuffer(buffer_, image, layout, buffer, 1, &region);
+}
+
+void CommandBufferGuard::copy_buffer_to_image(VkBuffer buffer, VkImage image,
+    VkImageLayout layout, const std::vector<VkBufferImageCopy> &regions)
+{
+  vkCmdCopyBufferToImage(
+      buffer_, buffer, image, layout, regions.size(), regions.data());
+}
+
+GpuZone CommandBufferGuard::profile_zone(
+    GpuProfiler &profiler, const char *name)
+{
+  return GpuZone{profiler, buffer_, name};
+}
+
 CommandBuffer::CommandBuffer(VkCommandBuffer buffer) : buffer_(buffer)
 {
 }
@@ -84,6 +224,26 @@ CommandBufferGuard CommandBuffer::begin()
   return CommandBufferGuard{buffer_};
 }
 
+CommandBufferGuard CommandBuffer::begin_secondary(
+    VkRenderPass pass, VkFramebuffer framebuffer)
+{
+  auto inheritance_info = VkCommandBufferInheritanceInfo{};
+  inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritance_info.renderPass = pass;
+  inheritance_info.subpass = 0;
+  inheritance_info.framebuffer = framebuffer;
+
+  auto cmd_begin_info = VkCommandBufferBeginInfo{};
+  cmd_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  cmd_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                         VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+  cmd_begin_info.pInheritanceInfo = &inheritance_info;
+
+  VK_CHECK(vkBeginCommandBuffer(buffer_, &cmd_begin_info));
+
+  return CommandBufferGuard{buffer_};
+}
+
 CommandPool::CommandPool(VkDevice device, uint32_t family)
   : device_(device), family_(family)
 {
@@ -94,14 +254,14 @@ CommandPool::CommandPool(VkDevice device, uint32_t family)
   VK_CHECK(vkCreateCommandPool(device_, &cmd_pool_info, nullptr, &pool_));
 }
 
-CommandBuffer CommandPool::allocate_buffer()
+CommandBuffer CommandPool::allocate_buffer(VkCommandBufferLevel level)
 {
   auto cmd_alloc_info = VkCommandBufferAllocateInfo{};
   cmd_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
   cmd_alloc_info.pNext = nullptr;
   cmd_alloc_info.commandPool = pool_;
   cmd_alloc_info.commandBufferCount = 1;
-  cmd_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  cmd_alloc_info.level = level;
   VkCommandBuffer buf;
   VK_CHECK(vkAllocateCommandBuffers(device_, &cmd_alloc_info, &buf));
   return CommandBuffer{buf};
@@ -1,15 +1,18 @@
 #ifndef SILICONIA_COMMAND_BUFFER_HPP
 #define SILICONIA_COMMAND_BUFFER_HPP
 
+#include "gpu_profiler.hpp"
 #include <array>
 #include <cstdint>
+#include <vector>
 #include <vulkan/vulkan.h>
 
 namespace siliconia::graphics::vk {
 
 class RenderPassGuard {
 public:
-  RenderPassGuard(VkCommandBuffer buffer);
+  // Secondary buffers continue a pass that the primary buffer ends
+  RenderPassGuard(VkCommandBuffer buffer, bool ends_pass = true);
   ~RenderPassGuard();
 
   void bind_pipeline(VkPipeline pipeline);
@@ -22,9 +25,15 @@ public:
       uint32_t first_vertex, uint32_t first_instance);
   void draw_indexed(uint32_t index_count, uint32_t instance_count,
       uint32_t first_index, int32_t vertex_offset, uint32_t first_instance);
+  void bind_descriptor_set(VkPipelineLayout layout, VkDescriptorSet set);
+  void draw_indexed_indirect(VkBuffer buffer, VkDeviceSize offset,
+      uint32_t draw_count, uint32_t stride);
+  void execute_commands(const std::vector<VkCommandBuffer> &buffers);
+  GpuZone profile_zone(GpuProfiler &profiler, const char *name);
 
 private:
   VkCommandBuffer buffer_;
+  bool ends_pass_;
 };
 
 class CommandBufferGuard {
@@ -33,9 +42,35 @@ public:
 
   ~CommandBufferGuard();
 
+  // Compute work has to be recorded outside of a render pass
+  void bind_compute_pipeline(VkPipeline pipeline);
+  void bind_compute_descriptor_set(
+      VkPipelineLayout layout, VkDescriptorSet set);
+  void push_constants(VkPipelineLayout layout, VkShaderStageFlags flags,
+      size_t size, const void *ptr);
+  void dispatch(uint32_t x, uint32_t y, uint32_t z);
+  // Enough workgroups of local_size x local_size to cover width x height
+  void dispatch_2d(uint32_t width, uint32_t height, uint32_t local_size);
+  void fill_buffer(
+      VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, uint32_t data);
+  void buffer_barrier(VkBuffer buffer, VkPipelineStageFlags src_stage,
+      VkAccessFlags src_access, VkPipelineStageFlags dst_stage,
+      VkAccessFlags dst_access);
+  void image_barrier(VkImage image, VkImageAspectFlags aspect,
+      VkImageLayout old_layout, VkImageLayout new_layout,
+      VkPipelineStageFlags src_stage, VkAccessFlags src_access,
+      VkPipelineStageFlags dst_stage, VkAccessFlags dst_access,
+      uint32_t base_mip = 0, uint32_t mip_count = VK_REMAINING_MIP_LEVELS);
+  void copy_image_to_buffer(VkImage image, VkImageLayout layout,
+      VkBuffer buffer, uint32_t mip, VkExtent2D extent);
+  void copy_buffer_to_image(VkBuffer buffer, VkImage image,
+      VkImageLayout layout, const std::vector<VkBufferImageCopy> &regions);
+  GpuZone profile_zone(GpuProfiler &profiler, const char *name);
+
   template <size_t N>
   RenderPassGuard begin_render_pass(VkRenderPass pass, VkExtent2D extent,
-      VkFramebuffer framebuffer, std::array<VkClearValue, N> clear_values)
+      VkFramebuffer framebuffer, std::array<VkClearValue, N> clear_values,
+      VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE)
   {
     auto rp_info = VkRenderPassBeginInfo{};
     rp_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -46,11 +81,14 @@ public:
     rp_info.framebuffer = framebuffer;
     rp_info.clearValueCount = N;
     rp_info.pClearValues = &clear_values[0];
-    vkCmdBeginRenderPass(buffer_, &rp_info, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(buffer_, &rp_info, contents);
 
     return RenderPassGuard{buffer_};
   }
 
+  // For secondary buffers begun with CommandBuffer::begin_secondary
+  RenderPassGuard continue_render_pass();
+
 private:
   VkCommandBuffer buffer_;
 };
@@ -65,6 +103,8 @@ public:
   void reset();
 
   CommandBufferGuard begin();
+  CommandBufferGuard begin_secondary(
+      VkRenderPass pass, VkFramebuffer framebuffer);
 
   VkCommandBuffer buffer() const;
 
@@ -77,7 +117,8 @@ public:
   CommandPool() = default;
   CommandPool(VkDevice device, uint32_t family);
 
-  CommandBuffer allocate_buffer();
+  CommandBuffer allocate_buffer(
+      VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
 
   VkCommandPool pool() const;
 
@@ -0,0 +1,142 @@
+#include "gpu_profiler.hpp"
+#include "helpers.hpp"
+#include <algorithm>
+
+namespace siliconia::graphics::vk {
+
+namespace {
+
+// Marks zones that went over max_zones_ and so were never written
+constexpr uint32_t no_zone = UINT32_MAX;
+
+} // namespace
+
+GpuProfiler::GpuProfiler(VkDevice device, VkPhysicalDevice gpu)
+  : device_(device)
+{
+  auto props = VkPhysicalDeviceProperties{};
+  vkGetPhysicalDeviceProperties(gpu, &props);
+  if (!props.limits.timestampComputeAndGraphics) {
+    return;
+  }
+  period_ns_ = props.limits.timestampPeriod;
+
+  auto pool_info = VkQueryPoolCreateInfo{};
+  pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  pool_info.queryCount = frames_ * max_zones_ * 2;
+  VK_CHECK(vkCreateQueryPool(device_, &pool_info, nullptr, &pool_));
+}
+
+void GpuProfiler::begin_frame(VkCommandBuffer buffer)
+{
+  if (!supported()) {
+    return;
+  }
+
+  slot_ = (slot_ + 1) % frames_;
+  collect(slot_);
+  frames_in_flight_[slot_].names.clear();
+  vkCmdResetQueryPool(buffer, pool_, slot_ * max_zones_ * 2, max_zones_ * 2);
+  frames_in_flight_[slot_].pending = true;
+}
+
+uint32_t GpuProfiler::begin_zone(VkCommandBuffer buffer, const char *name)
+{
+  auto &names = frames_in_flight_[slot_].names;
+  if (!supported() || names.size() == max_zones_) {
+    return no_zone;
+  }
+
+  auto zone = static_cast<uint32_t>(names.size());
+  names.push_back(name);
+  vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool_,
+      (slot_ * max_zones_ + zone) * 2);
+  return zone;
+}
+
+void GpuProfiler::end_zone(VkCommandBuffer buffer, uint32_t zone)
+{
+  if (zone == no_zone) {
+    return;
+  }
+  vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pool_,
+      (slot_ * max_zones_ + zone) * 2 + 1);
+}
+
+void GpuProfiler::collect(uint32_t slot)
+{
+  auto &frame = frames_in_flight_[slot];
+  if (!frame.pending || frame.names.empty()) {
+    return;
+  }
+  frame.pending = false;
+
+  auto results = std::vector<uint64_t>(frame.names.size() * 2);
+  auto res = vkGetQueryPoolResults(device_, pool_, slot * max_zones_ * 2,
+      results.size(), results.size() * sizeof(uint64_t), results.data(),
+      sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+  // Not ready only happens if the frame was never submitted
+  if (res != VK_SUCCESS) {
+    return;
+  }
+
+  for (size_t i = 0; i < frame.names.size(); i++) {
+    auto ticks = results[i * 2 + 1] - results[i * 2];
+    add_sample(frame.names[i], ticks * period_ns_ / 1e6f);
+  }
+}
+
+void GpuProfiler::add_sample(const char *name, float ms)
+{
+  auto it = std::find_if(zones_.begin(), zones_.end(),
+      [&](const zone_history &z) { return z.name == name; });
+  if (it == zones_.end()) {
+    zones_.push_back({name});
+    it = zones_.end() - 1;
+  }
+
+  it->samples[it->next] = ms;
+  it->next = (it->next + 1) % history_;
+  it->count = std::min(it->count + 1, history_);
+}
+
+std::vector<GpuProfiler::zone_average> GpuProfiler::averages() const
+{
+  auto averages = std::vector<zone_average>{};
+  for (const auto &zone : zones_) {
+    auto total = 0.f;
+    for (size_t i = 0; i < zone.count; i++) {
+      total += zone.samples[i];
+    }
+    averages.push_back({zone.name, total / zone.count});
+  }
+  return averages;
+}
+
+bool GpuProfiler::supported() const
+{
+  return pool_ != VK_NULL_HANDLE;
+}
+
+void GpuProfiler::destroy()
+{
+  if (pool_ != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(device_, pool_, nullptr);
+    pool_ = VK_NULL_HANDLE;
+  }
+}
+
+GpuZone::GpuZone(GpuProfiler &profiler, VkCommandBuffer buffer, const char *name)
+  : profiler_(profiler)
+  , buffer_(buffer)
+  , zone_(profiler.begin_zone(buffer, name))
+{
+}
+
+GpuZone::~GpuZone()
+{
+  profiler_.end_zone(buffer_, zone_);
+}
+
+} // namespace siliconia::graphics::vk
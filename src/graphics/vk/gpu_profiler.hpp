@@ -0,0 +1,81 @@
+#ifndef SILICONIA_GPU_PROFILER_HPP
+#define SILICONIA_GPU_PROFILER_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace siliconia::graphics::vk {
+
+// Times zones of a frame with timestamp queries. Each frame writes to its
+// own range of the query pool and is read back a few frames later, by
+// which point the fence has long been waited on, so reading never stalls.
+class GpuProfiler {
+public:
+  struct zone_average {
+    std::string name;
+    float ms;
+  };
+
+  GpuProfiler() = default;
+  GpuProfiler(VkDevice device, VkPhysicalDevice gpu);
+
+  // Must be recorded outside of a render pass, before any zone
+  void begin_frame(VkCommandBuffer buffer);
+  uint32_t begin_zone(VkCommandBuffer buffer, const char *name);
+  void end_zone(VkCommandBuffer buffer, uint32_t zone);
+
+  // Averaged over the last few dozen frames, in the order zones first ran
+  std::vector<zone_average> averages() const;
+  bool supported() const;
+
+  void destroy();
+
+private:
+  static constexpr uint32_t frames_ = 3;
+  static constexpr uint32_t max_zones_ = 32;
+  static constexpr size_t history_ = 64;
+
+  struct frame {
+    std::vector<const char *> names;
+    bool pending = false;
+  };
+
+  struct zone_history {
+    std::string name;
+    std::array<float, history_> samples;
+    size_t count = 0;
+    size_t next = 0;
+  };
+
+  void collect(uint32_t slot);
+  void add_sample(const char *name, float ms);
+
+  VkDevice device_;
+  VkQueryPool pool_ = VK_NULL_HANDLE;
+  float period_ns_ = 0;
+  uint32_t slot_ = 0;
+  std::array<frame, frames_> frames_in_flight_;
+  std::vector<zone_history> zones_;
+};
+
+// Times everything recorded into the buffer during its lifetime
+class GpuZone {
+public:
+  GpuZone(GpuProfiler &profiler, VkCommandBuffer buffer, const char *name);
+  ~GpuZone();
+
+  GpuZone(const GpuZone &) = delete;
+  GpuZone &operator=(const GpuZone &) = delete;
+
+private:
+  GpuProfiler &profiler_;
+  VkCommandBuffer buffer_;
+  uint32_t zone_;
+};
+
+} // namespace siliconia::graphics::vk
+
+#endif // SILICONIA_GPU_PROFILER_HPP
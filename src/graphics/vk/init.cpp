@@ -1,7 +1,34 @@
 #include "init.hpp"
+#include <fstream>
+#include <vector>
 
 namespace siliconia::graphics::vk {
 
+bool load_shader_module(
+    VkDevice device, const char *path, VkShaderModule *shader_module)
+{
+  auto file = std::ifstream{path, std::ios::ate | std::ios::binary};
+  if (!file.is_open())
+    return false;
+
+  auto file_size = file.tellg();
+  auto buffer = std::vector<uint32_t>(file_size / sizeof(uint32_t));
+  file.seekg(0);
+  file.read((char *)buffer.data(), file_size);
+  file.close();
+
+  auto create_info = VkShaderModuleCreateInfo{};
+  create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  create_info.codeSize = buffer.size() * sizeof(uint32_t);
+  create_info.pCode = buffer.data();
+
+  if (vkCreateShaderModule(device, &create_info, nullptr, shader_module) !=
+      VK_SUCCESS)
+    return false;
+
+  return true;
+}
+
 VkPipelineShaderStageCreateInfo pipeline_shader_stage_create_info(
     VkShaderStageFlagBits stage, VkShaderModule shader_module)
 {
@@ -124,4 +151,56 @@ VkPipelineDepthStencilStateCreateInfo depth_stencil_create_info(
   return info;
 }
 
+VkDescriptorSetLayoutBinding descriptor_set_layout_binding(
+    VkDescriptorType type, VkShaderStageFlags stages, uint32_t binding)
+{
+  auto info = VkDescriptorSetLayoutBinding{};
+  info.binding = binding;
+  info.descriptorCount = 1;
+  info.descriptorType = type;
+  info.stageFlags = stages;
+  return info;
+}
+
+VkWriteDescriptorSet write_descriptor_buffer(VkDescriptorType type,
+    VkDescriptorSet set, const VkDescriptorBufferInfo *info, uint32_t binding)
+{
+  auto write = VkWriteDescriptorSet{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstBinding = binding;
+  write.dstSet = set;
+  write.descriptorCount = 1;
+  write.descriptorType = type;
+  write.pBufferInfo = info;
+  return write;
+}
+
+VkWriteDescriptorSet write_descriptor_image(VkDescriptorType type,
+    VkDescriptorSet set, const VkDescriptorImageInfo *info, uint32_t binding)
+{
+  auto write = VkWriteDescriptorSet{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstBinding = binding;
+  write.dstSet = set;
+  write.descriptorCount = 1;
+  write.descriptorType = type;
+  write.pImageInfo = info;
+  return write;
+}
+
+VkSamplerCreateInfo sampler_create_info(
+    VkFilter filter, VkSamplerAddressMode address_mode)
+{
+  auto info = VkSamplerCreateInfo{};
+  info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  info.magFilter = filter;
+  info.minFilter = filter;
+  info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  info.addressModeU = address_mode;
+  info.addressModeV = address_mode;
+  info.addressModeW = address_mode;
+  info.maxLod = 16.0f;
+  return info;
+}
+
 } // namespace siliconia::graphics::init
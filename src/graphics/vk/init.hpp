@@ -5,6 +5,9 @@
 
 namespace siliconia::graphics::vk {
 
+bool load_shader_module(
+    VkDevice device, const char *path, VkShaderModule *shader_module);
+
 VkPipelineShaderStageCreateInfo pipeline_shader_stage_create_info(
     VkShaderStageFlagBits stage, VkShaderModule shader_module);
 
@@ -30,6 +33,18 @@ VkImageViewCreateInfo image_view_create_info(
 
 VkPipelineDepthStencilStateCreateInfo depth_stencil_create_info(
     bool depth_test, bool depth_write, VkCompareOp op);
+
+VkDescriptorSetLayoutBinding descriptor_set_layout_binding(
+    VkDescriptorType type, VkShaderStageFlags stages, uint32_t binding);
+
+VkWriteDescriptorSet write_descriptor_buffer(VkDescriptorType type,
+    VkDescriptorSet set, const VkDescriptorBufferInfo *info, uint32_t binding);
+
+VkWriteDescriptorSet write_descriptor_image(VkDescriptorType type,
+    VkDescriptorSet set, const VkDescriptorImageInfo *info, uint32_t binding);
+
+VkSamplerCreateInfo sampler_create_info(VkFilter filter,
+    VkSamplerAddressMode address_mode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
 } // namespace siliconia::graphics::vk
 
 #endif // SILICONIA_INIT_HPP
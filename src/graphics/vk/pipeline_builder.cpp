@@ -1,9 +1,11 @@
 #include "pipeline_builder.hpp"
+#include "init.hpp"
 #include <iostream>
 
 namespace siliconia::graphics::vk {
 
-VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass)
+VkPipeline PipelineBuilder::build_pipeline(
+    VkDevice device, VkRenderPass pass, VkPipelineCache cache)
 {
   auto viewport_state = VkPipelineViewportStateCreateInfo{};
   viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
@@ -36,11 +38,43 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass)
   pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
 
   auto pipeline = VkPipeline{};
-  if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &pipeline) != VK_SUCCESS) {
+  if (vkCreateGraphicsPipelines(device, cache, 1, &pipeline_info, nullptr, &pipeline) != VK_SUCCESS) {
     std::cout << "failed to create pipeline" << std::endl;
     return VK_NULL_HANDLE;
   }
   return pipeline;
 }
 
+VkPipeline ComputePipelineBuilder::build_pipeline(
+    VkDevice device, VkPipelineCache cache)
+{
+  auto pipeline_info = VkComputePipelineCreateInfo{};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.stage = shader_stage;
+  pipeline_info.layout = layout;
+  pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+
+  auto pipeline = VkPipeline{};
+  if (vkCreateComputePipelines(device, cache, 1, &pipeline_info, nullptr, &pipeline) != VK_SUCCESS) {
+    std::cout << "failed to create compute pipeline" << std::endl;
+    return VK_NULL_HANDLE;
+  }
+  return pipeline;
+}
+
+VkPipeline ComputePipelineBuilder::build_pipeline(
+    VkDevice device, const char *shader_path, VkPipelineCache cache)
+{
+  auto module = VkShaderModule{};
+  if (!load_shader_module(device, shader_path, &module)) {
+    std::cout << "Could not load " << shader_path << std::endl;
+    return VK_NULL_HANDLE;
+  }
+  shader_stage =
+      pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, module);
+  auto pipeline = build_pipeline(device, cache);
+  vkDestroyShaderModule(device, module, nullptr);
+  return pipeline;
+}
+
 }
\ No newline at end of file
@@ -8,7 +8,8 @@ namespace siliconia::graphics::vk {
 
 class PipelineBuilder {
 public:
-  VkPipeline build_pipeline(VkDevice device, VkRenderPass pass);
+  VkPipeline build_pipeline(VkDevice device, VkRenderPass pass,
+      VkPipelineCache cache = VK_NULL_HANDLE);
 
   std::vector<VkPipelineShaderStageCreateInfo> shader_stages;
   VkPipelineVertexInputStateCreateInfo vertex_input_info;
@@ -22,6 +23,19 @@ public:
   VkPipelineDepthStencilStateCreateInfo  depth_stencil;
 };
 
+class ComputePipelineBuilder {
+public:
+  VkPipeline build_pipeline(
+      VkDevice device, VkPipelineCache cache = VK_NULL_HANDLE);
+  // Loads the shader for just this pipeline, returning VK_NULL_HANDLE if
+  // it can't be read
+  VkPipeline build_pipeline(VkDevice device, const char *shader_path,
+      VkPipelineCache cache = VK_NULL_HANDLE);
+
+  VkPipelineShaderStageCreateInfo shader_stage;
+  VkPipelineLayout layout;
+};
+
 }
 
 #endif // SILICONIA_PIPELINE_BUILDER_HPP
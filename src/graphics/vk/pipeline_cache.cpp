@@ -0,0 +1,109 @@
+#include "pipeline_cache.hpp"
+#include "helpers.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace siliconia::graphics::vk {
+
+namespace {
+
+// VkPipelineCacheHeaderVersionOne, spelled out so it doesn't depend on the
+// header version
+struct cache_header {
+  uint32_t header_size;
+  uint32_t header_version;
+  uint32_t vendor_id;
+  uint32_t device_id;
+  uint8_t uuid[VK_UUID_SIZE];
+};
+
+bool valid_header(const std::vector<char> &data, VkPhysicalDevice gpu)
+{
+  if (data.size() < sizeof(cache_header)) {
+    return false;
+  }
+  auto header = cache_header{};
+  memcpy(&header, data.data(), sizeof(header));
+
+  auto props = VkPhysicalDeviceProperties{};
+  vkGetPhysicalDeviceProperties(gpu, &props);
+
+  return header.header_size >= sizeof(cache_header) &&
+         header.header_size <= data.size() &&
+         header.header_version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         header.vendor_id == props.vendorID &&
+         header.device_id == props.deviceID &&
+         memcmp(header.uuid, props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+} // namespace
+
+PipelineCache::PipelineCache(
+    VkDevice device, VkPhysicalDevice gpu, std::string path)
+  : device_(device), path_(std::move(path))
+{
+  auto data = std::vector<char>{};
+  auto file = std::ifstream{path_, std::ios::ate | std::ios::binary};
+  if (file.is_open()) {
+    data.resize(file.tellg());
+    file.seekg(0);
+    file.read(data.data(), data.size());
+  }
+
+  if (!data.empty() && !valid_header(data, gpu)) {
+    std::cout << "Ignoring pipeline cache " << path_
+              << " from a different device or driver" << std::endl;
+    data.clear();
+  }
+  warm_ = !data.empty();
+
+  auto info = VkPipelineCacheCreateInfo{};
+  info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  info.initialDataSize = data.size();
+  info.pInitialData = data.empty() ? nullptr : data.data();
+  VK_CHECK(vkCreatePipelineCache(device_, &info, nullptr, &cache_));
+}
+
+VkPipelineCache PipelineCache::cache() const
+{
+  return cache_;
+}
+
+bool PipelineCache::warm() const
+{
+  return warm_;
+}
+
+void PipelineCache::save() const
+{
+  auto size = size_t{0};
+  VK_CHECK(vkGetPipelineCacheData(device_, cache_, &size, nullptr));
+  auto data = std::vector<char>(size);
+  VK_CHECK(vkGetPipelineCacheData(device_, cache_, &size, data.data()));
+
+  // Write then rename so a crash can't leave a truncated cache behind
+  auto tmp_path = path_ + ".tmp";
+  {
+    auto file = std::ofstream{tmp_path, std::ios::binary | std::ios::trunc};
+    if (!file.is_open()) {
+      std::cout << "Could not write pipeline cache " << tmp_path << std::endl;
+      return;
+    }
+    file.write(data.data(), size);
+  }
+  std::remove(path_.c_str());
+  if (std::rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    std::cout << "Could not write pipeline cache " << path_ << std::endl;
+  }
+}
+
+void PipelineCache::destroy()
+{
+  vkDestroyPipelineCache(device_, cache_, nullptr);
+  cache_ = VK_NULL_HANDLE;
+}
+
+} // namespace siliconia::graphics::vk
@@ -0,0 +1,32 @@
+#ifndef SILICONIA_PIPELINE_CACHE_HPP
+#define SILICONIA_PIPELINE_CACHE_HPP
+
+#include <string>
+#include <vulkan/vulkan.h>
+
+namespace siliconia::graphics::vk {
+
+// A VkPipelineCache backed by a file. Data written by a different driver or
+// device is thrown away rather than handed to the driver.
+class PipelineCache {
+public:
+  PipelineCache() = default;
+  PipelineCache(VkDevice device, VkPhysicalDevice gpu, std::string path);
+
+  VkPipelineCache cache() const;
+  // Whether usable data was loaded from disk
+  bool warm() const;
+
+  void save() const;
+  void destroy();
+
+private:
+  VkDevice device_;
+  VkPipelineCache cache_ = VK_NULL_HANDLE;
+  std::string path_;
+  bool warm_ = false;
+};
+
+} // namespace siliconia::graphics::vk
+
+#endif // SILICONIA_PIPELINE_CACHE_HPP
@@ -2,7 +2,10 @@
 #define SILICONIA_TYPES_HPP
 
 #include "command_buffer.hpp"
+#include <graphics/frustum.hpp>
 #include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
 #include <glm/vec3.hpp>
 #include <vector>
 #include <vk_mem_alloc.h>
@@ -36,12 +39,39 @@ struct Mesh {
   AllocatorBuffer index_buffer;
 
   glm::mat4 model_matrix;
+
+  // World space, used for culling
+  aabb bounds;
 };
 
 struct MeshPushConstants {
   glm::mat4 model_matrix;
 };
 
+// Mirrors Tile in cull.comp and terrain_indirect.vert (std430)
+struct GpuTile {
+  glm::mat4 model_matrix;
+  glm::vec4 bounds_min;
+  glm::vec4 bounds_max;
+  uint32_t index_count;
+  uint32_t first_index;
+  int32_t vertex_offset;
+  uint32_t padding;
+};
+
+// Mirrors CullData in cull.comp (std140)
+struct CullData {
+  static constexpr uint32_t frustum = 1;
+  static constexpr uint32_t occlusion = 2;
+
+  glm::vec4 planes[6];
+  glm::mat4 hiz_view_proj;
+  glm::ivec2 hiz_size;
+  uint32_t hiz_levels;
+  uint32_t tile_count;
+  uint32_t flags;
+};
+
 
 struct AllocatedImage {
   VkImage image;
@@ -0,0 +1,326 @@
+#include "job_system.hpp"
+#include "profiling/profiler.hpp"
+#include <algorithm>
+#include <string>
+
+namespace siliconia::jobs {
+
+struct Job {
+  JobSystem::Task task;
+  // Dependencies not yet done, plus one held by spawn until it has
+  // registered with all of them
+  std::atomic<size_t> pending = 1;
+  std::atomic<bool> done = false;
+  std::exception_ptr error;
+  bool background = false;
+
+  std::mutex mutex;
+  std::vector<std::shared_ptr<Job>> continuations;
+};
+
+namespace {
+
+// Which system and worker the current thread belongs to, if any
+thread_local JobSystem *current_system = nullptr;
+thread_local int current_index = -1;
+
+} // namespace
+
+JobHandle::JobHandle(std::shared_ptr<Job> job)
+  : job_(std::move(job))
+{
+}
+
+bool JobHandle::done() const
+{
+  return !job_ || job_->done;
+}
+
+JobSystem::JobSystem(uint32_t thread_count)
+{
+  for (uint32_t i = 0; i < std::max(1u, thread_count); i++) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  for (size_t i = 0; i < workers_.size(); i++) {
+    workers_[i]->thread = std::thread{[this, i] {
+      profiling::set_thread_name("Worker " + std::to_string(i));
+      worker_loop(i);
+    }};
+  }
+}
+
+JobSystem::~JobSystem()
+{
+  {
+    auto lock = std::lock_guard{sleep_mutex_};
+    quit_ = true;
+  }
+  wake_cv_.notify_all();
+  for (auto &worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+JobHandle JobSystem::spawn(
+    Task task, const std::vector<JobHandle> &dependencies)
+{
+  auto job = std::make_shared<Job>();
+  job->task = std::move(task);
+  for (const auto &dependency : dependencies) {
+    if (!dependency.job_) {
+      continue;
+    }
+    auto lock = std::lock_guard{dependency.job_->mutex};
+    if (!dependency.job_->done) {
+      job->pending++;
+      dependency.job_->continuations.push_back(job);
+    }
+  }
+  if (--job->pending == 0) {
+    push(job);
+  }
+  return JobHandle{std::move(job)};
+}
+
+JobHandle JobSystem::spawn_background(Task task)
+{
+  auto job = std::make_shared<Job>();
+  job->task = std::move(task);
+  job->background = true;
+  job->pending = 0;
+  push(job);
+  return JobHandle{std::move(job)};
+}
+
+void JobSystem::wait(const JobHandle &handle)
+{
+  wait(std::vector<JobHandle>{handle});
+}
+
+void JobSystem::wait(const std::vector<JobHandle> &handles)
+{
+  auto index = current_system == this ? current_index : -1;
+  for (const auto &handle : handles) {
+    const auto &job = handle.job_;
+    while (job && !job->done) {
+      if (auto other = pop(index)) {
+        run(other);
+        continue;
+      }
+      waiters_++;
+      {
+        auto lock = std::unique_lock{sleep_mutex_};
+        wake_cv_.wait(lock, [&] { return job->done || queued_ > 0; });
+      }
+      waiters_--;
+    }
+  }
+
+  // Only once all are done, as the callers' state may be on the stack
+  for (const auto &handle : handles) {
+    if (handle.job_ && handle.job_->error) {
+      std::rethrow_exception(handle.job_->error);
+    }
+  }
+}
+
+void JobSystem::parallel_for(
+    size_t begin, size_t end, size_t grain, const RangeFn &fn)
+{
+  if (end <= begin) {
+    return;
+  }
+  auto count = end - begin;
+  if (grain == 0) {
+    grain = std::max<size_t>(1, count / (4 * (workers_.size() + 1)));
+  }
+  if (count <= grain) {
+    fn(begin, end);
+    return;
+  }
+
+  auto handles = std::vector<JobHandle>{};
+  for (auto i = begin; i < end; i += grain) {
+    auto slice_end = std::min(end, i + grain);
+    handles.push_back(spawn([&fn, i, slice_end] { fn(i, slice_end); }));
+  }
+  wait(handles);
+}
+
+void JobSystem::post_main(Task task)
+{
+  {
+    auto lock = std::lock_guard{main_mutex_};
+    main_tasks_.push_back(std::move(task));
+  }
+  main_cv_.notify_one();
+}
+
+size_t JobSystem::run_main_tasks(std::chrono::steady_clock::duration budget)
+{
+  auto start = std::chrono::steady_clock::now();
+  auto count = size_t{0};
+  while (std::chrono::steady_clock::now() - start < budget &&
+         run_main_task(false)) {
+    count++;
+  }
+  return count;
+}
+
+bool JobSystem::run_main_task(bool wait)
+{
+  auto task = Task{};
+  {
+    auto lock = std::unique_lock{main_mutex_};
+    if (wait) {
+      main_cv_.wait(lock, [&] { return !main_tasks_.empty(); });
+    }
+    if (main_tasks_.empty()) {
+      return false;
+    }
+    task = std::move(main_tasks_.front());
+    main_tasks_.pop_front();
+  }
+  task();
+  return true;
+}
+
+uint32_t JobSystem::thread_count() const
+{
+  return workers_.size();
+}
+
+void JobSystem::worker_loop(size_t index)
+{
+  current_system = this;
+  current_index = index;
+  while (true) {
+    if (auto job = pop(index)) {
+      run(job);
+      continue;
+    }
+    if (auto job = pop_background()) {
+      run(job);
+      continue;
+    }
+
+    auto lock = std::unique_lock{sleep_mutex_};
+    wake_cv_.wait(lock, [&] {
+      return quit_ || queued_ > 0 || background_queued_ > 0;
+    });
+    if (quit_ && queued_ == 0 && background_queued_ == 0) {
+      return;
+    }
+  }
+}
+
+void JobSystem::push(std::shared_ptr<Job> job)
+{
+  if (job->background) {
+    {
+      auto lock = std::lock_guard{sleep_mutex_};
+      background_queued_++;
+    }
+    {
+      auto lock = std::lock_guard{background_mutex_};
+      background_.push_back(std::move(job));
+    }
+    // One would be lost on a thread waiting on a job, which can't take it
+    wake_cv_.notify_all();
+    return;
+  }
+
+  // Workers keep what they spawn, which is likely to share their caches.
+  // Other threads deal jobs out in turn.
+  auto index = current_system == this
+                   ? size_t(current_index)
+                   : next_worker_++ % workers_.size();
+  // Counted before it can be taken, or a thread taking it straight away
+  // would count below zero
+  {
+    auto lock = std::lock_guard{sleep_mutex_};
+    queued_++;
+  }
+  {
+    auto &worker = *workers_[index];
+    auto lock = std::lock_guard{worker.mutex};
+    worker.jobs.push_back(std::move(job));
+  }
+  wake_cv_.notify_one();
+}
+
+std::shared_ptr<Job> JobSystem::pop(int index)
+{
+  if (index >= 0) {
+    auto &worker = *workers_[index];
+    auto lock = std::lock_guard{worker.mutex};
+    if (!worker.jobs.empty()) {
+      auto job = std::move(worker.jobs.back());
+      worker.jobs.pop_back();
+      queued_--;
+      return job;
+    }
+  }
+
+  auto start = index >= 0 ? size_t(index) + 1 : next_worker_.load();
+  for (size_t i = 0; i < workers_.size(); i++) {
+    auto &victim = *workers_[(start + i) % workers_.size()];
+    auto lock = std::lock_guard{victim.mutex};
+    if (!victim.jobs.empty()) {
+      auto job = std::move(victim.jobs.front());
+      victim.jobs.pop_front();
+      queued_--;
+      return job;
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<Job> JobSystem::pop_background()
+{
+  auto lock = std::lock_guard{background_mutex_};
+  if (background_.empty()) {
+    return nullptr;
+  }
+  auto job = std::move(background_.front());
+  background_.pop_front();
+  background_queued_--;
+  return job;
+}
+
+void JobSystem::run(const std::shared_ptr<Job> &job)
+{
+  try {
+    job->task();
+  } catch (...) {
+    job->error = std::current_exception();
+  }
+  // Frees whatever the task captured
+  job->task = nullptr;
+
+  auto continuations = std::vector<std::shared_ptr<Job>>{};
+  {
+    auto lock = std::lock_guard{job->mutex};
+    job->done = true;
+    continuations.swap(job->continuations);
+  }
+  for (auto &continuation : continuations) {
+    if (--continuation->pending == 0) {
+      push(std::move(continuation));
+    }
+  }
+
+  if (waiters_ > 0) {
+    auto lock = std::lock_guard{sleep_mutex_};
+    wake_cv_.notify_all();
+  }
+}
+
+JobSystem &job_system()
+{
+  static auto system =
+      JobSystem{std::max(2u, std::thread::hardware_concurrency()) - 1};
+  return system;
+}
+
+} // namespace siliconia::jobs
@@ -0,0 +1,117 @@
+#ifndef SILICONIA_JOB_SYSTEM_HPP
+#define SILICONIA_JOB_SYSTEM_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace siliconia::jobs {
+
+struct Job;
+
+// Shared ownership of a spawned job, to wait on it or make others depend on
+// it. A default constructed handle counts as done.
+class JobHandle {
+public:
+  JobHandle() = default;
+
+  bool done() const;
+
+private:
+  friend class JobSystem;
+
+  explicit JobHandle(std::shared_ptr<Job> job);
+
+  std::shared_ptr<Job> job_;
+};
+
+// A work-stealing scheduler. Each worker has its own deque, taking the newest
+// job from the back of it and stealing the oldest from the front of others
+// when it runs dry. Threads that wait on a job run others in the meantime,
+// though never background jobs, which only idle workers take.
+//
+// Vulkan objects are only used from the main thread, so jobs hand results
+// back through the main queue, which the frame loop drains.
+class JobSystem {
+public:
+  using Task = std::function<void()>;
+  // Called with a [begin, end) slice of the range
+  using RangeFn = std::function<void(size_t begin, size_t end)>;
+
+  explicit JobSystem(uint32_t thread_count);
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  // The task runs once every dependency is done
+  JobHandle spawn(Task task, const std::vector<JobHandle> &dependencies = {});
+  // For long jobs that nothing waits on, such as loading a tile, so a frame
+  // waiting on its own jobs never ends up running one
+  JobHandle spawn_background(Task task);
+
+  // Rethrows anything the job threw
+  void wait(const JobHandle &handle);
+  void wait(const std::vector<JobHandle> &handles);
+
+  // Splits [begin, end) into slices of at most grain and waits for them all.
+  // A grain of 0 picks one that gives each worker a few slices.
+  void parallel_for(size_t begin, size_t end, size_t grain, const RangeFn &fn);
+
+  void post_main(Task task);
+  // Runs main queue tasks until it is empty or the budget is spent, returning
+  // how many ran
+  size_t run_main_tasks(std::chrono::steady_clock::duration budget);
+  // Runs one main queue task, waiting for one to be posted if wait is set
+  bool run_main_task(bool wait);
+
+  uint32_t thread_count() const;
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<std::shared_ptr<Job>> jobs;
+    std::thread thread;
+  };
+
+  void worker_loop(size_t index);
+  void push(std::shared_ptr<Job> job);
+  std::shared_ptr<Job> pop(int index);
+  std::shared_ptr<Job> pop_background();
+  void run(const std::shared_ptr<Job> &job);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // Shared, as background jobs are only taken by workers with nothing else
+  std::mutex background_mutex_;
+  std::deque<std::shared_ptr<Job>> background_;
+  std::atomic<size_t> next_worker_ = 0;
+
+  // Guards sleeping, so a push between checking for work and waiting is not
+  // missed
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_cv_;
+  std::atomic<size_t> queued_ = 0;
+  std::atomic<size_t> background_queued_ = 0;
+  std::atomic<size_t> waiters_ = 0;
+  bool quit_ = false;
+
+  std::mutex main_mutex_;
+  std::condition_variable main_cv_;
+  std::deque<Task> main_tasks_;
+};
+
+// Sized to leave a core for the main thread
+JobSystem &job_system();
+
+} // namespace siliconia::jobs
+
+#endif // SILICONIA_JOB_SYSTEM_HPP
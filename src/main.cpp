@@ -1,25 +1,510 @@
 #include "chunks/chunk.hpp"
 #include "chunks/chunk_collection.hpp"
+#include "chunks/tile_cache.hpp"
 #include <SDL.h>
+#include <analysis/change_detection.hpp>
+#include <analysis/contours.hpp>
+#include <analysis/derivatives.hpp>
+#include <analysis/hole_filling.hpp>
 #include <graphics/engine.hpp>
+#include <graphics/terrain_export.hpp>
+#include <jobs/job_system.hpp>
+#include <profiling/profiler.hpp>
+#include <profiling/startup_timeline.hpp>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <string>
+
+namespace {
+
+void usage(const char *program)
+{
+  std::cerr
+      << "usage: " << program << " <data dir> [options]\n"
+      << "  --headless           render offscreen without a window\n"
+      << "  --size <w>x<h>       render size (default 1920x1080)\n"
+      << "  --frames <n>         render n frames then exit, printing timings\n"
+      << "  --csv <path>         write per-frame timings to a CSV file\n"
+      << "  --json <path>        write the timing summary to a JSON file\n"
+      << "  --screenshot <path>  write the last headless frame to a PPM file\n"
+      << "  --record <path>      record the camera path of an interactive run\n"
+      << "  --replay <path>      benchmark a recorded camera path\n"
+      << "  --trace <path>       write a Chrome trace of CPU zones on exit\n"
+      << "  --frame-stats <path> write frame time statistics on exit\n"
+      << "  --startup <path>     write the startup phase timeline as JSON\n"
+      << "  --no-frustum         disable frustum culling\n"
+      << "  --occlusion          enable occlusion culling\n"
+      << "  --gpu-driven         use the GPU driven path if supported\n"
+      << "  --parallel           record draws on worker threads\n"
+      << "  --clipmap            draw the terrain as a geometry clipmap\n"
+      << "  --gpu-hillshade      hillshade on the GPU, turning the sun each\n"
+      << "                       frame\n"
+      << "  --derivatives <dir>  write slope, aspect and hillshade grids for\n"
+      << "                       every tile to a directory, then exit\n"
+      << "  --contours <path>    write contour lines as GeoJSON, then exit\n"
+      << "  --contour-interval <m> between contour lines (default 10)\n"
+      << "  --compare <dir>      shade by the change since an earlier survey\n"
+      << "  --change <dir>       write each tile's change to a directory and\n"
+      << "                       exit (needs --compare)\n"
+      << "  --tile-cache <dir>   read tiles from a binary cache, filling it\n"
+      << "                       with any it is missing\n"
+      << "  --build-cache <dir>  cache every tile with its reduced levels and\n"
+      << "                       exit\n"
+      << "  --fill-holes <cells> fill nodata holes up to this many cells\n"
+      << "                       across, as tiles are loaded or cached\n"
+      << "  --export-tiles <dir> write every tile as binary glTF meshes with\n"
+      << "                       an index, then exit\n"
+      << "  --export-levels <n>  reduced levels to export (default 4)\n";
+}
+
+// The whole of the text as a number, not if it isn't one or is out of range
+template <typename T>
+bool parse_number(const char *text, T &value)
+{
+  auto end = text + strlen(text);
+  auto [last, error] = std::from_chars(text, end, value);
+  return error == std::errc{} && last == end;
+}
+
+// Writes <tile>_slope.asc, _aspect.asc and _hillshade.asc for each tile and
+// reports the kernel throughput
+int export_derivatives(const std::string &data_path, const std::string &dir)
+{
+  using namespace siliconia;
+  auto chunks = chunks::ChunkCollection{data_path};
+  auto start = std::chrono::steady_clock::now();
+  auto grids = analysis::compute_derivatives(chunks, analysis::sun{});
+  auto seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start)
+                     .count();
+
+  auto cells = size_t{0};
+  std::filesystem::create_directories(dir);
+  for (size_t i = 0; i < grids.size(); i++) {
+    const auto &chunk = chunks.chunks()[i];
+    const auto &grid = grids[i];
+    cells += size_t(chunk.ncols) * chunk.nrows;
+    auto stem = (std::filesystem::path{dir} /
+                 std::filesystem::path{chunk.path}.stem())
+                    .string();
+    if (!analysis::write_asc(
+            stem + "_slope.asc", chunk, grid.slope, grid.nodata_value) ||
+        !analysis::write_asc(
+            stem + "_aspect.asc", chunk, grid.aspect, grid.nodata_value) ||
+        !analysis::write_asc(stem + "_hillshade.asc", chunk, grid.hillshade,
+            grid.nodata_value)) {
+      std::cout << "Could not write to " << dir << std::endl;
+      return 1;
+    }
+  }
+  std::cout << "Derivatives of " << cells << " cells in " << seconds * 1000
+            << "ms, " << cells / seconds / 1e6 << " Mcells/s on "
+            << jobs::job_system().thread_count() << " threads" << std::endl;
+  return 0;
+}
+
+int export_contours(
+    const std::string &data_path, const std::string &path, float interval)
+{
+  using namespace siliconia;
+  auto chunks = chunks::ChunkCollection{data_path};
+  auto contours = analysis::ContourCache{};
+  contours.set_interval(interval);
+  for (size_t i = 0; i < chunks.chunks().size(); i++) {
+    contours.tile_added(chunks, i);
+  }
+  auto start = std::chrono::steady_clock::now();
+  contours.update(chunks);
+  auto ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start)
+                .count();
+  std::cout << "Contoured " << chunks.chunks().size() << " tiles at "
+            << interval << " in " << ms << "ms, "
+            << contours.segment_count() << " segments" << std::endl;
+  if (!contours.write_geojson(path, chunks)) {
+    std::cout << "Could not write " << path << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Writes <tile>_change.asc for each tile of the later survey, a few tile
+// pairs at a time so only those are ever in memory, and prints the totals
+int export_changes(const std::string &data_path,
+    const std::string &earlier_path, const std::string &dir)
+{
+  using namespace siliconia;
+  auto later = chunks::ChunkCollection::scan(data_path);
+  auto earlier = chunks::ChunkCollection::scan(earlier_path);
+  const auto &headers = later.headers();
+  auto statistics = std::vector<analysis::change_statistics>(headers.size());
+  auto written = std::vector<char>(headers.size());
+  auto misaligned = std::vector<size_t>(headers.size());
+  std::filesystem::create_directories(dir);
+
+  auto start = std::chrono::steady_clock::now();
+  jobs::job_system().parallel_for(
+      0, headers.size(), 1, [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; i++) {
+          auto tile = chunks::Chunk{headers[i].path};
+          auto overlaps = std::vector<chunks::Chunk>{};
+          for (auto h : analysis::overlapping(earlier, tile)) {
+            auto other = chunks::Chunk{earlier.headers()[h].path};
+            if (analysis::aligned(tile, other)) {
+              overlaps.push_back(std::move(other));
+            } else {
+              misaligned[i]++;
+            }
+          }
+          auto pointers = std::vector<const chunks::Chunk *>{};
+          for (const auto &other : overlaps) {
+            pointers.push_back(&other);
+          }
+
+          auto difference =
+              analysis::difference_tile(tile, pointers, statistics[i]);
+          for (auto &v : difference.values) {
+            v = std::isnan(v) ? tile.nodata_value : v;
+          }
+          auto stem = (std::filesystem::path{dir} /
+                       std::filesystem::path{tile.path}.stem())
+                          .string();
+          written[i] = analysis::write_asc(stem + "_change.asc", tile,
+              difference.values, tile.nodata_value);
+        }
+      });
+  auto seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start)
+                     .count();
+
+  auto total = analysis::change_statistics{};
+  auto skipped = size_t{0};
+  for (size_t i = 0; i < headers.size(); i++) {
+    total.merge(statistics[i]);
+    skipped += misaligned[i];
+    if (!written[i]) {
+      std::cout << "Could not write to " << dir << std::endl;
+      return 1;
+    }
+  }
+  std::cout << "Differenced " << headers.size() << " tiles in " << seconds
+            << "s: " << total.compared << " cells, " << total.missing
+            << " without earlier data\n"
+            << "Cut " << total.cut << ", fill " << total.fill << ", net "
+            << total.net() << "\n"
+            << "Change " << total.min << " to " << total.max << ", mean "
+            << total.mean() << ", RMS " << total.rms() << std::endl;
+  if (skipped > 0) {
+    std::cout << "Skipped " << skipped
+              << " earlier tiles not aligned with the later ones" << std::endl;
+  }
+  return 0;
+}
+
+// Parses every tile not already cached and writes it with its reduced
+// levels, one tile per job so only a few are in memory at once. Holes are
+// filled with a halo from the neighbours they reach, parsed in the same
+// job, so those crossing between tiles are filled the same from both sides.
+int build_tile_cache(const std::string &data_path, const std::string &dir,
+    unsigned int max_hole_size)
+{
+  using namespace siliconia;
+  auto headers = chunks::ChunkCollection::scan(data_path).headers();
+  auto cache = chunks::TileCache{dir, max_hole_size};
+  auto cached = std::vector<char>(headers.size());
+  auto failed = std::vector<char>(headers.size());
+  auto cells = std::vector<size_t>(headers.size());
+  auto options = analysis::hole_options{.max_hole_size = max_hole_size};
+  auto filled = std::vector<analysis::hole_fill_result>(headers.size());
+
+  auto start = std::chrono::steady_clock::now();
+  jobs::job_system().parallel_for(
+      0, headers.size(), 1, [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; i++) {
+          if (cache.contains(headers[i].path)) {
+            cached[i] = true;
+            continue;
+          }
+          auto tile = chunks::Chunk{headers[i].path};
+          if (max_hole_size > 0) {
+            auto result = analysis::fill_holes(headers, tile, options);
+            tile.data = std::move(result.data);
+            // Only the counts are left
+            filled[i] = std::move(result);
+          }
+          cells[i] = tile.data.size();
+          failed[i] = !cache.write(tile, chunks::build_pyramid(tile));
+        }
+      });
+  auto seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start)
+                     .count();
+
+  auto written = size_t{0}, skipped = size_t{0}, total_cells = size_t{0};
+  for (size_t i = 0; i < headers.size(); i++) {
+    if (failed[i]) {
+      std::cout << "Could not cache " << headers[i].path << " in " << dir
+                << std::endl;
+      return 1;
+    }
+    written += !cached[i];
+    skipped += cached[i];
+    total_cells += cells[i];
+  }
+  std::cout << "Cached " << written << " tiles (" << skipped
+            << " already up to date) in " << seconds << "s, "
+            << total_cells / seconds / 1e6 << " Mcells/s" << std::endl;
+  if (max_hole_size > 0) {
+    auto holes = size_t{0}, holes_cells = size_t{0}, holes_skipped = size_t{0};
+    for (const auto &result : filled) {
+      holes += result.holes_filled;
+      holes_cells += result.cells_filled;
+      holes_skipped += result.holes_skipped;
+    }
+    std::cout << "Filled " << holes << " holes (" << holes_cells
+              << " cells), left " << holes_skipped << std::endl;
+  }
+  return 0;
+}
+
+// Writes each tile's levels as .glb files and index.json, reading tiles
+// from the tile cache if there is one
+int export_tiles(const std::string &data_path, const std::string &dir,
+    siliconia::graphics::terrain_export_options options)
+{
+  using namespace siliconia;
+  auto collection = chunks::ChunkCollection::scan(data_path);
+  auto start = std::chrono::steady_clock::now();
+  auto tiles = graphics::export_terrain(collection, dir, options);
+  auto seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start)
+                     .count();
+
+  auto exported = size_t{0}, files = size_t{0};
+  auto cells = size_t{0}, bytes = size_t{0};
+  for (size_t i = 0; i < tiles.size(); i++) {
+    if (!tiles[i].error.empty()) {
+      std::cout << "Could not export " << collection.headers()[i].path
+                << ": " << tiles[i].error << std::endl;
+      continue;
+    }
+    exported++;
+    cells += tiles[i].cells;
+    files += tiles[i].levels.size();
+    for (const auto &level : tiles[i].levels) {
+      bytes += level.bytes;
+    }
+  }
+  if (!graphics::write_terrain_index(dir, collection, tiles)) {
+    std::cout << "Could not write the index to " << dir << std::endl;
+    return 1;
+  }
+  std::cout << "Exported " << exported << " of " << tiles.size()
+            << " tiles to " << files << " files, " << bytes / 1e6
+            << "MB in " << seconds << "s, " << cells / seconds / 1e6
+            << " Mcells/s on " << jobs::job_system().thread_count()
+            << " threads" << std::endl;
+  return exported == tiles.size() ? 0 : 1;
+}
+
+} // namespace
 
 int main(int argc, char **argv)
 {
+  auto data_path = std::string{};
+  auto width = 1920u;
+  auto height = 1080u;
+  auto headless = false;
+  auto benchmark = false;
+  auto record_path = std::string{};
+  auto trace_path = std::string{};
+  auto frame_stats_path = std::string{};
+  auto startup_path = std::string{};
+  auto derivatives_path = std::string{};
+  auto contours_path = std::string{};
+  auto contour_interval = 10.f;
+  auto compare_path = std::string{};
+  auto tile_cache_path = std::string{};
+  auto build_cache_path = std::string{};
+  auto max_hole_size = 0u;
+  auto export_path = std::string{};
+  auto export_levels = 4u;
+  auto change_path = std::string{};
+  auto options = siliconia::graphics::benchmark_options{};
+
+  for (int i = 1; i < argc; i++) {
+    auto arg = argv[i];
+    auto has_value = i + 1 < argc;
+    if (strcmp(arg, "--headless") == 0) {
+      headless = true;
+    } else if (strcmp(arg, "--size") == 0 && has_value) {
+      if (sscanf(argv[++i], "%ux%u", &width, &height) != 2) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(arg, "--frames") == 0 && has_value) {
+      benchmark = true;
+      if (!parse_number(argv[++i], options.frames)) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(arg, "--csv") == 0 && has_value) {
+      options.csv_path = argv[++i];
+    } else if (strcmp(arg, "--json") == 0 && has_value) {
+      options.json_path = argv[++i];
+    } else if (strcmp(arg, "--screenshot") == 0 && has_value) {
+      options.screenshot_path = argv[++i];
+    } else if (strcmp(arg, "--record") == 0 && has_value) {
+      record_path = argv[++i];
+    } else if (strcmp(arg, "--replay") == 0 && has_value) {
+      benchmark = true;
+      options.camera_path = argv[++i];
+    } else if (strcmp(arg, "--trace") == 0 && has_value) {
+      trace_path = argv[++i];
+    } else if (strcmp(arg, "--frame-stats") == 0 && has_value) {
+      frame_stats_path = argv[++i];
+    } else if (strcmp(arg, "--startup") == 0 && has_value) {
+      startup_path = argv[++i];
+    } else if (strcmp(arg, "--no-frustum") == 0) {
+      options.frustum_culling = false;
+    } else if (strcmp(arg, "--occlusion") == 0) {
+      options.occlusion_culling = true;
+    } else if (strcmp(arg, "--gpu-driven") == 0) {
+      options.gpu_driven = true;
+    } else if (strcmp(arg, "--parallel") == 0) {
+      options.parallel_recording = true;
+    } else if (strcmp(arg, "--clipmap") == 0) {
+      options.clipmap = true;
+    } else if (strcmp(arg, "--gpu-hillshade") == 0) {
+      options.gpu_hillshade = true;
+    } else if (strcmp(arg, "--contours") == 0 && has_value) {
+      contours_path = argv[++i];
+    } else if (strcmp(arg, "--contour-interval") == 0 && has_value) {
+      if (!parse_number(argv[++i], contour_interval)) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(arg, "--compare") == 0 && has_value) {
+      compare_path = argv[++i];
+    } else if (strcmp(arg, "--change") == 0 && has_value) {
+      change_path = argv[++i];
+    } else if (strcmp(arg, "--tile-cache") == 0 && has_value) {
+      tile_cache_path = argv[++i];
+    } else if (strcmp(arg, "--build-cache") == 0 && has_value) {
+      build_cache_path = argv[++i];
+    } else if (strcmp(arg, "--fill-holes") == 0 && has_value) {
+      if (!parse_number(argv[++i], max_hole_size)) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(arg, "--export-tiles") == 0 && has_value) {
+      export_path = argv[++i];
+    } else if (strcmp(arg, "--export-levels") == 0 && has_value) {
+      if (!parse_number(argv[++i], export_levels)) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(arg, "--derivatives") == 0 && has_value) {
+      derivatives_path = argv[++i];
+    } else if (arg[0] != '-' && data_path.empty()) {
+      data_path = arg;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (data_path.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+  // There is no window to close, so a headless run always has an end
+  benchmark = benchmark || headless;
+
+  siliconia::profiling::set_thread_name("Main");
+  siliconia::profiling::set_enabled(!trace_path.empty());
+
   try {
-    auto chunks = siliconia::chunks::ChunkCollection{
-        "C:/Users/matth/Documents/lidar/TL45nw/"};
+    if (!derivatives_path.empty()) {
+      return export_derivatives(data_path, derivatives_path);
+    }
+    if (!contours_path.empty()) {
+      return export_contours(data_path, contours_path, contour_interval);
+    }
+    if (!build_cache_path.empty()) {
+      return build_tile_cache(data_path, build_cache_path, max_hole_size);
+    }
+    if (!export_path.empty()) {
+      auto export_options = siliconia::graphics::terrain_export_options{};
+      export_options.levels = export_levels;
+      if (!tile_cache_path.empty()) {
+        export_options.cache =
+            siliconia::chunks::TileCache{tile_cache_path, max_hole_size};
+      }
+      if (max_hole_size > 0) {
+        export_options.holes =
+            siliconia::analysis::hole_options{.max_hole_size = max_hole_size};
+      }
+      return export_tiles(data_path, export_path, export_options);
+    }
+    if (!change_path.empty()) {
+      if (compare_path.empty()) {
+        usage(argv[0]);
+        return 1;
+      }
+      return export_changes(data_path, compare_path, change_path);
+    }
+    // Tiles are parsed in the background once the engine is running
+    auto chunks = siliconia::chunks::ChunkCollection::scan(data_path);
     auto r = chunks.rect;
     std::cout << "(" << r.x << ", " << r.y << ") " << r.width << "x" << r.height
-              << " " << chunks.range.min << "-" << chunks.range.max
-              << std::endl;
+              << ", " << chunks.headers().size() << " tiles" << std::endl;
 
-    auto engine = siliconia::graphics::Engine{1920, 1080, std::move(chunks)};
+    auto engine = siliconia::graphics::Engine{
+        width, height, std::move(chunks), headless};
+    if (!tile_cache_path.empty()) {
+      engine.use_tile_cache(tile_cache_path);
+    }
+    if (max_hole_size > 0) {
+      engine.fill_holes(
+          siliconia::analysis::hole_options{.max_hole_size = max_hole_size});
+    }
     engine.init();
-    engine.run();
+    if (!compare_path.empty()) {
+      engine.compare_with(compare_path);
+    }
+    if (!frame_stats_path.empty()) {
+      engine.write_frame_stats_on_exit(frame_stats_path);
+    }
+    if (benchmark) {
+      engine.benchmark(options);
+    } else {
+      if (!record_path.empty()) {
+        engine.record_camera_path(record_path);
+      }
+      engine.run();
+    }
   } catch (const siliconia::chunks::asc_parse_exception &e) {
     std::cout << e.what() << std::endl;
     return 1;
   }
+
+  if (!startup_path.empty()) {
+    std::ofstream{startup_path}
+        << siliconia::profiling::startup_timeline().to_json() << "\n";
+  }
+  if (!trace_path.empty()) {
+    if (siliconia::profiling::write_chrome_trace(trace_path)) {
+      std::cout << "Wrote trace to " << trace_path << std::endl;
+    } else {
+      std::cout << "Could not write " << trace_path << std::endl;
+    }
+  }
   return 0;
 }
\ No newline at end of file
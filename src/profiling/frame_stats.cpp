@@ -0,0 +1,107 @@
+#include "frame_stats.hpp"
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+namespace siliconia::profiling {
+
+namespace {
+
+// Nearest rank on an already sorted list
+float percentile(const std::vector<float> &sorted, float p)
+{
+  if (sorted.empty()) {
+    return 0;
+  }
+  auto rank = static_cast<size_t>(p / 100.f * (sorted.size() - 1) + 0.5f);
+  return sorted[rank];
+}
+
+} // namespace
+
+FrameStats::FrameStats(size_t window) : window_(std::max<size_t>(window, 1))
+{
+  times_.reserve(window_);
+}
+
+void FrameStats::add(float ms)
+{
+  // Too few frames make for a meaningless median
+  auto recent = std::min(total_frames_, recent_frames);
+  if (recent >= 30) {
+    auto sorted = recent_;
+    auto mid = sorted.begin() + recent / 2;
+    std::nth_element(sorted.begin(), mid, sorted.begin() + recent);
+    if (ms > 2 * *mid) {
+      stutters_++;
+    }
+  }
+  recent_[total_frames_ % recent_frames] = ms;
+
+  if (times_.size() < window_) {
+    times_.push_back(ms);
+  } else {
+    times_[next_] = ms;
+  }
+  next_ = (next_ + 1) % window_;
+  total_frames_++;
+}
+
+FrameStats::summary FrameStats::summarise() const
+{
+  auto sorted = times_;
+  std::sort(sorted.begin(), sorted.end());
+  auto total = std::accumulate(sorted.begin(), sorted.end(), 0.0);
+  return {total_frames_, sorted.empty() ? 0.f : float(total / sorted.size()),
+      percentile(sorted, 50), percentile(sorted, 95), percentile(sorted, 99),
+      sorted.empty() ? 0.f : sorted.back(), stutters_};
+}
+
+std::array<float, FrameStats::bins> FrameStats::histogram() const
+{
+  auto histogram = std::array<float, bins>{};
+  for (auto ms : times_) {
+    auto bin = std::min(static_cast<size_t>(ms / bin_ms), bins - 1);
+    histogram[bin]++;
+  }
+  return histogram;
+}
+
+std::vector<float> FrameStats::history() const
+{
+  if (times_.size() < window_) {
+    return times_;
+  }
+  auto history = std::vector<float>{};
+  history.reserve(times_.size());
+  history.insert(history.end(), times_.begin() + next_, times_.end());
+  history.insert(history.end(), times_.begin(), times_.begin() + next_);
+  return history;
+}
+
+std::string FrameStats::to_json() const
+{
+  auto s = summarise();
+  auto json = std::ostringstream{};
+  json << "{\"frames\": " << s.frames << ", \"window\": " << times_.size()
+       << ", \"mean_ms\": " << s.mean << ", \"p50_ms\": " << s.p50
+       << ", \"p95_ms\": " << s.p95 << ", \"p99_ms\": " << s.p99
+       << ", \"max_ms\": " << s.max << ", \"stutters\": " << s.stutters
+       << ", \"histogram_bin_ms\": " << bin_ms << ", \"histogram\": [";
+  auto h = histogram();
+  for (size_t i = 0; i < h.size(); i++) {
+    json << (i ? ", " : "") << h[i];
+  }
+  json << "]}";
+  return json.str();
+}
+
+bool FrameStats::write_json(const std::string &path) const
+{
+  auto file = std::ofstream{path};
+  file << to_json() << "\n";
+  return static_cast<bool>(file);
+}
+
+} // namespace siliconia::profiling
@@ -0,0 +1,57 @@
+#ifndef SILICONIA_FRAME_STATS_HPP
+#define SILICONIA_FRAME_STATS_HPP
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace siliconia::profiling {
+
+// Frame times over a rolling window. A stutter is a frame that takes more
+// than twice the median of the frames just before it, which catches
+// hitches an average hides.
+class FrameStats {
+public:
+  static constexpr float bin_ms = 1.f;
+  static constexpr size_t bins = 50;
+  // Frames the stutter median is over, so adding a frame stays cheap
+  // however large the window
+  static constexpr size_t recent_frames = 63;
+
+  struct summary {
+    size_t frames;
+    float mean;
+    float p50;
+    float p95;
+    float p99;
+    float max;
+    size_t stutters;
+  };
+
+  explicit FrameStats(size_t window = 1000);
+
+  void add(float ms);
+
+  // Percentiles are over the window, the stutter count is since the start
+  summary summarise() const;
+  // One bin per millisecond, the last one also counts everything slower
+  std::array<float, bins> histogram() const;
+  // Oldest first
+  std::vector<float> history() const;
+
+  std::string to_json() const;
+  bool write_json(const std::string &path) const;
+
+private:
+  size_t window_;
+  std::vector<float> times_;
+  size_t next_ = 0;
+  std::array<float, recent_frames> recent_{};
+  size_t total_frames_ = 0;
+  size_t stutters_ = 0;
+};
+
+} // namespace siliconia::profiling
+
+#endif // SILICONIA_FRAME_STATS_HPP
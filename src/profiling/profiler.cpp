@@ -0,0 +1,172 @@
+#include "profiler.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace siliconia::profiling {
+
+namespace {
+
+struct event {
+  const char *name;
+  std::string detail;
+  int64_t start_ns;
+  int64_t duration_ns;
+};
+
+// Each thread only ever locks its own buffer, so the lock is uncontended
+// except while a trace is being written
+struct thread_buffer {
+  std::mutex mutex;
+  uint32_t id;
+  std::string name;
+  std::vector<event> events;
+};
+
+// Keeps a forgotten trace from eating all the memory
+constexpr size_t max_events_per_thread = 1 << 20;
+
+std::atomic<bool> enabled_{false};
+const auto epoch = std::chrono::steady_clock::now();
+
+std::mutex registry_mutex;
+// Shared so a thread's events outlive the thread
+std::vector<std::shared_ptr<thread_buffer>> registry;
+
+int64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+thread_buffer &local_buffer()
+{
+  thread_local auto buffer = [] {
+    auto b = std::make_shared<thread_buffer>();
+    auto lock = std::lock_guard{registry_mutex};
+    b->id = registry.size();
+    registry.push_back(b);
+    return b;
+  }();
+  return *buffer;
+}
+
+} // namespace
+
+std::string escape_json(const std::string &s)
+{
+  auto out = std::string{};
+  for (auto c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+void set_enabled(bool enabled)
+{
+  enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+bool enabled()
+{
+  return enabled_.load(std::memory_order_relaxed);
+}
+
+void set_thread_name(const std::string &name)
+{
+  auto &buffer = local_buffer();
+  auto lock = std::lock_guard{buffer.mutex};
+  buffer.name = name;
+}
+
+bool write_chrome_trace(const std::string &path)
+{
+  auto file = std::ofstream{path};
+  if (!file) {
+    return false;
+  }
+
+  auto buffers = std::vector<std::shared_ptr<thread_buffer>>{};
+  {
+    auto lock = std::lock_guard{registry_mutex};
+    buffers = registry;
+  }
+
+  // Timestamps are in microseconds, written out in full so long traces
+  // don't lose precision
+  file << std::fixed << std::setprecision(3);
+  file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  auto first = true;
+  for (const auto &buffer : buffers) {
+    auto lock = std::lock_guard{buffer->mutex};
+    if (!buffer->name.empty()) {
+      file << (first ? "" : ",\n")
+           << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+           << "\"tid\": " << buffer->id << ", \"args\": {\"name\": \""
+           << escape_json(buffer->name) << "\"}}";
+      first = false;
+    }
+    for (const auto &e : buffer->events) {
+      file << (first ? "" : ",\n") << "{\"name\": \""
+           << escape_json(e.name)
+           << "\", \"cat\": \"cpu\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+           << buffer->id << ", \"ts\": " << e.start_ns / 1000.0
+           << ", \"dur\": " << e.duration_ns / 1000.0;
+      if (!e.detail.empty()) {
+        file << ", \"args\": {\"detail\": \"" << escape_json(e.detail)
+             << "\"}";
+      }
+      file << "}";
+      first = false;
+    }
+  }
+  file << "\n]}\n";
+  return static_cast<bool>(file);
+}
+
+Zone::Zone(const char *name) : name_(name)
+{
+  if (enabled()) {
+    start_ns_ = now_ns();
+  }
+}
+
+Zone::Zone(const char *name, std::string detail) : name_(name)
+{
+  if (enabled()) {
+    detail_ = std::move(detail);
+    start_ns_ = now_ns();
+  }
+}
+
+Zone::~Zone()
+{
+  if (start_ns_ < 0) {
+    return;
+  }
+
+  auto end_ns = now_ns();
+  auto &buffer = local_buffer();
+  auto lock = std::lock_guard{buffer.mutex};
+  if (buffer.events.size() < max_events_per_thread) {
+    buffer.events.push_back(
+        {name_, std::move(detail_), start_ns_, end_ns - start_ns_});
+  }
+}
+
+} // namespace siliconia::profiling
@@ -0,0 +1,201 @@
+#include "startup_timeline.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace siliconia::profiling {
+
+namespace {
+
+auto global_timeline = StartupTimeline{};
+
+} // namespace
+
+StartupTimeline &startup_timeline()
+{
+  return global_timeline;
+}
+
+StartupTimeline::Phase::Phase(
+    StartupTimeline &timeline, const char *name, std::string detail)
+  : timeline_(timeline), zone_(name, std::move(detail))
+{
+  auto lock = std::lock_guard{timeline_.mutex_};
+  auto background = std::this_thread::get_id() != timeline_.main_thread_;
+  if (background ? timeline_.loaded_ms_.has_value()
+                 : timeline_.first_frame_ms_.has_value()) {
+    return;
+  }
+  index_ = timeline_.records_.size();
+  timeline_.records_.push_back({name, background,
+      background ? 0 : timeline_.depth_, timeline_.now_ms(), 0});
+  if (!background) {
+    timeline_.depth_++;
+  }
+}
+
+StartupTimeline::Phase::~Phase()
+{
+  if (!index_) {
+    return;
+  }
+  auto lock = std::lock_guard{timeline_.mutex_};
+  auto &r = timeline_.records_[*index_];
+  r.end_ms = timeline_.now_ms();
+  if (!r.background) {
+    timeline_.depth_--;
+  }
+}
+
+StartupTimeline::StartupTimeline()
+  : start_(std::chrono::steady_clock::now())
+  , main_thread_(std::this_thread::get_id())
+{
+}
+
+StartupTimeline::Phase StartupTimeline::phase(
+    const char *name, std::string detail)
+{
+  return Phase{*this, name, std::move(detail)};
+}
+
+void StartupTimeline::mark_first_frame()
+{
+  auto lock = std::lock_guard{mutex_};
+  if (!first_frame_ms_) {
+    first_frame_ms_ = now_ms();
+  }
+}
+
+void StartupTimeline::mark_loaded()
+{
+  auto lock = std::lock_guard{mutex_};
+  if (!loaded_ms_) {
+    loaded_ms_ = now_ms();
+  }
+}
+
+std::optional<double> StartupTimeline::time_to_first_frame_ms() const
+{
+  auto lock = std::lock_guard{mutex_};
+  return first_frame_ms_;
+}
+
+std::optional<double> StartupTimeline::time_to_loaded_ms() const
+{
+  auto lock = std::lock_guard{mutex_};
+  return loaded_ms_;
+}
+
+std::vector<StartupTimeline::phase_summary> StartupTimeline::summarise() const
+{
+  auto lock = std::lock_guard{mutex_};
+  auto summaries = std::vector<phase_summary>{};
+  // The summary last seen at each depth, which a sibling of the same name
+  // is merged into
+  auto last_at_depth = std::vector<size_t>{};
+  auto background = std::vector<phase_summary>{};
+  for (const auto &r : records_) {
+    // Still running
+    if (r.end_ms == 0) {
+      continue;
+    }
+    auto ms = r.end_ms - r.start_ms;
+    if (r.background) {
+      auto it = std::find_if(background.begin(), background.end(),
+          [&](const phase_summary &s) { return s.name == r.name; });
+      if (it == background.end()) {
+        background.push_back({r.name, true, 0, 1, ms, ms});
+      } else {
+        it->count++;
+        it->total_ms += ms;
+        it->max_ms = std::max(it->max_ms, ms);
+      }
+      continue;
+    }
+    if (r.depth < last_at_depth.size() &&
+        summaries[last_at_depth[r.depth]].name == r.name) {
+      auto &s = summaries[last_at_depth[r.depth]];
+      s.count++;
+      s.total_ms += ms;
+      s.max_ms = std::max(s.max_ms, ms);
+    } else {
+      summaries.push_back({r.name, false, r.depth, 1, ms, ms});
+      last_at_depth.resize(r.depth + 1);
+      last_at_depth[r.depth] = summaries.size() - 1;
+    }
+    last_at_depth.resize(r.depth + 1);
+  }
+  summaries.insert(summaries.end(), background.begin(), background.end());
+  return summaries;
+}
+
+void StartupTimeline::print(std::ostream &os) const
+{
+  auto first_frame = time_to_first_frame_ms();
+  auto flags = os.flags();
+  os << std::fixed << std::setprecision(1);
+  os << "Startup";
+  if (first_frame) {
+    os << ", first frame after " << *first_frame << " ms";
+  }
+  os << "\n";
+
+  auto in_background = false;
+  for (const auto &s : summarise()) {
+    if (s.background && !in_background) {
+      os << "Background\n";
+      in_background = true;
+    }
+    auto label = std::string(2 + s.depth * 2, ' ') + s.name;
+    if (s.count > 1) {
+      label += " (x" + std::to_string(s.count) + ")";
+    }
+    os << std::left << std::setw(40) << label << std::right << std::setw(10)
+       << s.total_ms << " ms";
+    if (s.count > 1) {
+      os << "  max " << s.max_ms << " ms";
+    }
+    os << "\n";
+  }
+  os.flags(flags);
+}
+
+std::string StartupTimeline::to_json() const
+{
+  auto json = std::ostringstream{};
+  json << "{\"time_to_first_frame_ms\": ";
+  if (auto first_frame = time_to_first_frame_ms()) {
+    json << *first_frame;
+  } else {
+    json << "null";
+  }
+  json << ", \"time_to_loaded_ms\": ";
+  if (auto loaded = time_to_loaded_ms()) {
+    json << *loaded;
+  } else {
+    json << "null";
+  }
+  json << ", \"phases\": [";
+  auto first = true;
+  for (const auto &s : summarise()) {
+    json << (first ? "" : ", ") << "{\"name\": \"" << escape_json(s.name)
+         << "\", \"background\": " << (s.background ? "true" : "false")
+         << ", \"depth\": " << s.depth << ", \"count\": " << s.count
+         << ", \"total_ms\": " << s.total_ms << ", \"max_ms\": " << s.max_ms
+         << "}";
+    first = false;
+  }
+  json << "]}";
+  return json.str();
+}
+
+double StartupTimeline::now_ms() const
+{
+  return std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start_)
+      .count();
+}
+
+} // namespace siliconia::profiling
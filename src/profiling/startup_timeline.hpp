@@ -0,0 +1,86 @@
+#ifndef SILICONIA_STARTUP_TIMELINE_HPP
+#define SILICONIA_STARTUP_TIMELINE_HPP
+
+#include "profiler.hpp"
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace siliconia::profiling {
+
+// Where the time between the process starting and the first frame goes.
+// Phases on the main thread nest, and consecutive ones with the same name
+// are reported as one. Phases on other threads, such as background tile
+// loads, are totalled by name and recorded until loading is marked done.
+class StartupTimeline {
+public:
+  // Also a profiler zone, so phases show up in traces
+  class Phase {
+  public:
+    Phase(StartupTimeline &timeline, const char *name, std::string detail);
+    ~Phase();
+
+    Phase(const Phase &) = delete;
+    Phase &operator=(const Phase &) = delete;
+
+  private:
+    StartupTimeline &timeline_;
+    std::optional<size_t> index_;
+    Zone zone_;
+  };
+
+  struct phase_summary {
+    std::string name;
+    bool background;
+    size_t depth;
+    size_t count;
+    double total_ms;
+    double max_ms;
+  };
+
+  StartupTimeline();
+
+  Phase phase(const char *name, std::string detail = {});
+  // Later calls are ignored
+  void mark_first_frame();
+  void mark_loaded();
+
+  std::optional<double> time_to_first_frame_ms() const;
+  std::optional<double> time_to_loaded_ms() const;
+  std::vector<phase_summary> summarise() const;
+
+  void print(std::ostream &os) const;
+  std::string to_json() const;
+
+private:
+  struct record {
+    const char *name;
+    bool background;
+    size_t depth;
+    double start_ms;
+    double end_ms;
+  };
+
+  double now_ms() const;
+
+  std::chrono::steady_clock::time_point start_;
+  std::thread::id main_thread_;
+  mutable std::mutex mutex_;
+  std::vector<record> records_;
+  size_t depth_ = 0;
+  std::optional<double> first_frame_ms_;
+  std::optional<double> loaded_ms_;
+};
+
+// Created during static initialisation, which is as close to the process
+// starting as we can get
+StartupTimeline &startup_timeline();
+
+} // namespace siliconia::profiling
+
+#endif // SILICONIA_STARTUP_TIMELINE_HPP